@@ -0,0 +1,27 @@
+#pragma once
+
+#include "audio_ring.h"
+#include <stdint.h>
+
+// 繰り返しに使う直前のフレーム数
+#define AUDIO_CONCEAL_HISTORY 64
+// 繰り返しのつなぎ目, 復帰, 間引きのクロスフェード長（フレーム）
+#define AUDIO_CONCEAL_XFADE 16
+// 補間を始めてから無音になるまでのフレーム数
+#define AUDIO_CONCEAL_FADE 256
+// 溢れそうなとき1周期で間引く最大フレーム数
+#define AUDIO_CONCEAL_DROP 16
+
+typedef struct {
+  uint32_t underruns;        // データ不足で補間を始めた回数
+  uint32_t concealed_frames; // 補間で埋めたフレーム数
+  uint32_t fades;            // 無音までフェードしきった回数
+  uint32_t drops;            // 溢れそうで間引いた回数
+  uint32_t dropped_frames;   // 間引いたフレーム数
+} audio_conceal_stats_t;
+
+extern volatile audio_conceal_stats_t audio_conceal_stats;
+
+void audio_conceal_reset(void);
+uint32_t audio_conceal_read(audio_ring_t *ring, uint32_t *dst, uint32_t frames,
+                            uint32_t high_water);
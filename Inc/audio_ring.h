@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+
+// リングの深さ（32bitワード数）。2のべき乗であること
+// 96kHz, 24bit でジッタバッファ目標の最大 20ms の倍以上入る大きさ
+#ifndef AUDIO_RING_WORDS
+#define AUDIO_RING_WORDS 8192
+#endif
+
+_Static_assert((AUDIO_RING_WORDS & (AUDIO_RING_WORDS - 1)) == 0,
+               "AUDIO_RING_WORDS must be a power of two");
+
+// USB OUT割り込み（プロデューサ）とI2S DMA補充（コンシューマ）の間の
+// ロックフリーSPSCリング。1フレームは frame_words 個の32bitワード
+//   16bit: L/R を1ワードに詰める（Lが下位）
+//   24bit: L, R を1ワードずつ（上位/下位ハーフワード入れ替え済み）
+// head/tail はワード単位で単調増加させ、AUDIO_RING_WORDS でマスクする
+typedef struct {
+  uint32_t buf[AUDIO_RING_WORDS];
+  volatile uint32_t head;           // 書き込み位置（プロデューサのみ更新）
+  volatile uint32_t tail;           // 読み出し位置（コンシューマのみ更新）
+  uint32_t frame_words;             // 1フレームのワード数（1 or 2）
+  volatile uint32_t overrun_count;  // 空き不足でフレームを捨てた回数
+  volatile uint32_t underrun_count; // データ不足で読み出しが欠けた回数
+} audio_ring_t;
+
+void audio_ring_init(audio_ring_t *ring);
+void audio_ring_set_frame_words(audio_ring_t *ring, uint32_t frame_words);
+uint32_t audio_ring_write(audio_ring_t *ring, const uint32_t *src,
+                          uint32_t frames);
+uint32_t audio_ring_read(audio_ring_t *ring, uint32_t *dst, uint32_t frames);
+void audio_ring_flush(audio_ring_t *ring);
+uint32_t audio_ring_write_begin(audio_ring_t *ring, uint32_t frames);
+void audio_ring_write_end(audio_ring_t *ring, uint32_t frames);
+uint32_t audio_ring_fill(const audio_ring_t *ring);
+uint32_t audio_ring_space(const audio_ring_t *ring);
+uint32_t audio_ring_capacity(const audio_ring_t *ring);
+
+// ゼロコピー書き込み: write_begin で確保した範囲の index 番目に書く
+static inline void audio_ring_put(audio_ring_t *ring, uint32_t index,
+                                  uint32_t word) {
+  ring->buf[(ring->head + index) & (AUDIO_RING_WORDS - 1)] = word;
+}
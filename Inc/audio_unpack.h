@@ -0,0 +1,77 @@
+#pragma once
+
+#include "audio_ring.h"
+#include "usb_reg.h"
+#include <stdint.h>
+
+// The unpack kernels pop whole words from the RX FIFO straight into the
+// ring reserved by audio_ring_write_begin(). `frames` is the number the ring
+// accepted; any remaining words are still popped and discarded. Every pop
+// goes through usb_reg_read(). They live here so the host benchmark runs the
+// same code as the RXFLVL handler.
+
+// I2S sends a 32-bit sample as MSB half-word first, and the DMA reads
+// memory words low half first, so swap the halves up front.
+static inline uint32_t audio_i2s_word(uint32_t sample) {
+  return (sample << 16) | (sample >> 16);
+}
+
+// 16bit: each FIFO word is already one stereo frame (L low, R high)
+static inline void audio_unpack_pcm16(audio_ring_t *ring,
+                                      volatile uint32_t *fifo, uint32_t words,
+                                      uint32_t frames) {
+  uint32_t i = 0;
+
+  for (; i < frames; i++) {
+    audio_ring_put(ring, i, usb_reg_read(fifo));
+  }
+  for (; i < words; i++) {
+    (void)usb_reg_read(fifo);
+  }
+}
+
+// 24bit in 4-byte subslot: one MSB-justified sample per FIFO word
+static inline void audio_unpack_pcm24_in_32(audio_ring_t *ring,
+                                            volatile uint32_t *fifo,
+                                            uint32_t words, uint32_t frames) {
+  uint32_t i = 0;
+
+  for (; i < frames * 2; i++) {
+    audio_ring_put(ring, i, audio_i2s_word(usb_reg_read(fifo)));
+  }
+  for (; i < words; i++) {
+    (void)usb_reg_read(fifo);
+  }
+}
+
+// 24bit packed: every 3 FIFO words carry 4 samples (2 frames)
+static inline void audio_unpack_pcm24_packed(audio_ring_t *ring,
+                                             volatile uint32_t *fifo,
+                                             uint32_t words, uint32_t frames) {
+  uint32_t out = 0;
+  uint32_t popped = 0;
+
+  for (; out + 4 <= frames * 2; out += 4, popped += 3) {
+    uint32_t w0 = usb_reg_read(fifo);
+    uint32_t w1 = usb_reg_read(fifo);
+    uint32_t w2 = usb_reg_read(fifo);
+    audio_ring_put(ring, out, audio_i2s_word(w0 << 8));
+    audio_ring_put(ring, out + 1,
+                   audio_i2s_word(((w0 >> 16) & 0xFF00) | (w1 << 16)));
+    audio_ring_put(ring, out + 2,
+                   audio_i2s_word(((w1 >> 8) & 0xFFFF00) | (w2 << 24)));
+    audio_ring_put(ring, out + 3, audio_i2s_word(w2 & 0xFFFFFF00));
+  }
+  if (out < frames * 2) {
+    // Odd frame count: the last frame spans 2 words
+    uint32_t w0 = usb_reg_read(fifo);
+    uint32_t w1 = usb_reg_read(fifo);
+    popped += 2;
+    audio_ring_put(ring, out, audio_i2s_word(w0 << 8));
+    audio_ring_put(ring, out + 1,
+                   audio_i2s_word(((w0 >> 16) & 0xFF00) | (w1 << 16)));
+  }
+  for (; popped < words; popped++) {
+    (void)usb_reg_read(fifo);
+  }
+}
@@ -1,3 +1,6 @@
 #pragma once
 
+#include <stdint.h>
+
 void clock_init(void);
+void clock_set_plli2s(uint32_t n, uint32_t r);
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <stdbool.h>
+
 #define CS43L22_ADDR 0x94
 
 void cs43l22_init(void);
+void cs43l22_set_power(bool on);
@@ -1,3 +1,27 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
+// DMA 1周期の長さ [us]。USB のパケット長とは独立に選べる
+// 短いほど遅延が減り、長いほど割り込みが減る
+#define I2S_PERIOD_US_MIN 250
+#define I2S_PERIOD_US_MAX 4000
+#ifndef I2S_PERIOD_US
+#define I2S_PERIOD_US 1000
+#endif
+
+// 1周期分のサンプルを dst に書き、書いたフレーム数を返す（DMA割り込みから
+// 呼ばれる）。足りない分は無音で埋められる
+typedef uint32_t (*i2s_source_t)(uint32_t *dst, uint32_t frames);
+
 void i2s3_init(void);
+bool i2s3_is_rate_supported(uint32_t rate);
+bool i2s3_set_sample_rate(uint32_t rate);
+bool i2s3_set_format(uint32_t bits);
+bool i2s3_set_period(uint32_t period_us);
+uint32_t i2s3_period_frames(void);
+void i2s3_set_source(i2s_source_t source);
+void i2s3_pause(void);
+void i2s3_resume(void);
+uint32_t i2s3_frames_played(void);
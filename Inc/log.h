@@ -1,5 +1,13 @@
 #pragma once
 
+#include <stdint.h>
+
+// 1 にするとログを整形せず、書式IDと引数だけのバイナリレコードで送る
+// （tools/log_decode.py で ELF の .log_fmt セクションから復元する）
+#ifndef LOG_BINARY
+#define LOG_BINARY 0
+#endif
+
 // usart.h または専用のヘッダーファイルに追加
 #define ANSI_COLOR_RED "\x1b[31m"
 #define ANSI_COLOR_GREEN "\x1b[32m"
@@ -18,15 +26,35 @@
 #define ANSI_BG_YELLOW "\x1b[43m"
 #define ANSI_BG_BLUE "\x1b[44m"
 
-// ログレベル定義
+// ログレベル定義（#if で使うため数値マクロも用意する）
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARN 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_DEBUG 3
+#define LOG_LEVEL_TRACE 4
+
 typedef enum {
-  LOG_ERROR = 0,
-  LOG_WARN,
-  LOG_INFO,
-  LOG_DEBUG,
-  LOG_TRACE
+  LOG_ERROR = LOG_LEVEL_ERROR,
+  LOG_WARN = LOG_LEVEL_WARN,
+  LOG_INFO = LOG_LEVEL_INFO,
+  LOG_DEBUG = LOG_LEVEL_DEBUG,
+  LOG_TRACE = LOG_LEVEL_TRACE
 } log_level_t;
 
+// コンパイル時の最低レベル。これより詳細なログはコードごと消える
+// （CMake で Debug: TRACE, Release: INFO を指定）
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_TRACE
+#endif
+
+// モジュールごとに絞る場合は log.h より前に LOG_MODULE_LEVEL を定義する
+#ifndef LOG_MODULE_LEVEL
+#define LOG_MODULE_LEVEL LOG_COMPILE_LEVEL
+#elif LOG_MODULE_LEVEL > LOG_COMPILE_LEVEL
+#undef LOG_MODULE_LEVEL
+#define LOG_MODULE_LEVEL LOG_COMPILE_LEVEL
+#endif
+
 // 現在のログレベル設定（デフォルト: INFO）
 extern log_level_t current_log_level;
 
@@ -34,78 +62,137 @@ extern log_level_t current_log_level;
 void log_set_level(log_level_t level);
 log_level_t log_get_level(void);
 
-// カラー付きログマクロ（レベルチェック付き）
-#define LOG_ERROR(fmt, ...)                                                    \
+// バイナリレコードの種別（テキスト時のプレフィックスに対応）
+typedef enum {
+  LOG_TAG_ERROR = 0,
+  LOG_TAG_WARN,
+  LOG_TAG_INFO,
+  LOG_TAG_DEBUG,
+  LOG_TAG_TRACE,
+  LOG_TAG_USB,
+  LOG_TAG_USB_ERR,
+  LOG_TAG_SETUP,
+  LOG_TAG_DATA
+} log_tag_t;
+
+// バイナリレコード: 0xA5, tag << 4 | 引数の数, 書式ID(16bit),
+//                   タイムスタンプ[us](32bit), 引数(32bit × 引数の数)
+// 値はすべてリトルエンディアン。引数は32bit以下の整数かポインタに限る
+#define LOG_RECORD_SYNC 0xA5
+#define LOG_RECORD_MAX_ARGS 15
+
+void log_binary_write(log_tag_t tag, const char *fmt, uint32_t nargs, ...);
+
+// LOG_RECORD_MAX_ARGS (15) まで数える
+#define LOG_NARGS(...)                                                         \
+  LOG_NARGS_(0, ##__VA_ARGS__, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, \
+             1, 0)
+#define LOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, \
+                   _14, _15, n, ...)                                           \
+  n
+
+#if LOG_BINARY
+// 書式文字列は非ロードの .log_fmt に置き、セクション内オフセットをIDにする
+#define LOG_EMIT(level, tag, prefix, fmt, ...)                                 \
   do {                                                                         \
-    if (current_log_level >= LOG_ERROR) {                                      \
-      printf_usart2(ANSI_COLOR_RED ANSI_BOLD "[ERROR] " ANSI_COLOR_RESET fmt,  \
-                    ##__VA_ARGS__);                                            \
+    if (current_log_level >= (level)) {                                        \
+      static const char log_fmt_[]                                             \
+          __attribute__((section(".log_fmt"), used)) = fmt;                    \
+      log_binary_write((tag), log_fmt_, LOG_NARGS(__VA_ARGS__),                \
+                       ##__VA_ARGS__);                                         \
     }                                                                          \
   } while (0)
-
-#define LOG_WARN(fmt, ...)                                                     \
+#else
+#define LOG_EMIT(level, tag, prefix, fmt, ...)                                 \
   do {                                                                         \
-    if (current_log_level >= LOG_WARN) {                                       \
-      printf_usart2(ANSI_COLOR_YELLOW "[WARN]  " ANSI_COLOR_RESET fmt,         \
-                    ##__VA_ARGS__);                                            \
+    if (current_log_level >= (level)) {                                        \
+      printf_usart2(prefix fmt, ##__VA_ARGS__);                                \
     }                                                                          \
   } while (0)
+#endif
 
-#define LOG_INFO(fmt, ...)                                                     \
+// 無効なレベル: 書式チェックだけ残して何も生成しない
+#define LOG_DISCARD(fmt, ...)                                                  \
   do {                                                                         \
-    if (current_log_level >= LOG_INFO) {                                       \
-      printf_usart2(ANSI_COLOR_GREEN "[INFO]  " ANSI_COLOR_RESET fmt,          \
-                    ##__VA_ARGS__);                                            \
+    if (0) {                                                                   \
+      printf_usart2(fmt, ##__VA_ARGS__);                                       \
     }                                                                          \
   } while (0)
 
+// カラー付きログマクロ（レベルチェック付き）
+#if LOG_MODULE_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(fmt, ...)                                                    \
+  LOG_EMIT(LOG_ERROR, LOG_TAG_ERROR,                                           \
+           ANSI_COLOR_RED ANSI_BOLD "[ERROR] " ANSI_COLOR_RESET, fmt,          \
+           ##__VA_ARGS__)
+#else
+#define LOG_ERROR(fmt, ...) LOG_DISCARD(fmt, ##__VA_ARGS__)
+#endif
+
+#if LOG_MODULE_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(fmt, ...)                                                     \
+  LOG_EMIT(LOG_WARN, LOG_TAG_WARN,                                             \
+           ANSI_COLOR_YELLOW "[WARN]  " ANSI_COLOR_RESET, fmt, ##__VA_ARGS__)
+#else
+#define LOG_WARN(fmt, ...) LOG_DISCARD(fmt, ##__VA_ARGS__)
+#endif
+
+#if LOG_MODULE_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(fmt, ...)                                                     \
+  LOG_EMIT(LOG_INFO, LOG_TAG_INFO,                                             \
+           ANSI_COLOR_GREEN "[INFO]  " ANSI_COLOR_RESET, fmt, ##__VA_ARGS__)
+#else
+#define LOG_INFO(fmt, ...) LOG_DISCARD(fmt, ##__VA_ARGS__)
+#endif
+
+#if LOG_MODULE_LEVEL >= LOG_LEVEL_DEBUG
 #define LOG_DEBUG(fmt, ...)                                                    \
-  do {                                                                         \
-    if (current_log_level >= LOG_DEBUG) {                                      \
-      printf_usart2(ANSI_COLOR_CYAN "[DEBUG] " ANSI_COLOR_RESET fmt,           \
-                    ##__VA_ARGS__);                                            \
-    }                                                                          \
-  } while (0)
+  LOG_EMIT(LOG_DEBUG, LOG_TAG_DEBUG,                                           \
+           ANSI_COLOR_CYAN "[DEBUG] " ANSI_COLOR_RESET, fmt, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(fmt, ...) LOG_DISCARD(fmt, ##__VA_ARGS__)
+#endif
 
+#if LOG_MODULE_LEVEL >= LOG_LEVEL_TRACE
 #define LOG_TRACE(fmt, ...)                                                    \
-  do {                                                                         \
-    if (current_log_level >= LOG_TRACE) {                                      \
-      printf_usart2(ANSI_COLOR_MAGENTA "[TRACE] " ANSI_COLOR_RESET fmt,        \
-                    ##__VA_ARGS__);                                            \
-    }                                                                          \
-  } while (0)
+  LOG_EMIT(LOG_TRACE, LOG_TAG_TRACE,                                           \
+           ANSI_COLOR_MAGENTA "[TRACE] " ANSI_COLOR_RESET, fmt, ##__VA_ARGS__)
+#else
+#define LOG_TRACE(fmt, ...) LOG_DISCARD(fmt, ##__VA_ARGS__)
+#endif
 
 // USB専用ログ（レベルチェック付き）
+#if LOG_MODULE_LEVEL >= LOG_LEVEL_INFO
 #define USB_LOG(fmt, ...)                                                      \
-  do {                                                                         \
-    if (current_log_level >= LOG_INFO) {                                       \
-      printf_usart2(ANSI_COLOR_BLUE ANSI_BOLD "[USB]   " ANSI_COLOR_RESET fmt, \
-                    ##__VA_ARGS__);                                            \
-    }                                                                          \
-  } while (0)
+  LOG_EMIT(LOG_INFO, LOG_TAG_USB,                                              \
+           ANSI_COLOR_BLUE ANSI_BOLD "[USB]   " ANSI_COLOR_RESET, fmt,         \
+           ##__VA_ARGS__)
+#else
+#define USB_LOG(fmt, ...) LOG_DISCARD(fmt, ##__VA_ARGS__)
+#endif
 
+#if LOG_MODULE_LEVEL >= LOG_LEVEL_ERROR
 #define USB_ERROR(fmt, ...)                                                    \
-  do {                                                                         \
-    if (current_log_level >= LOG_ERROR) {                                      \
-      printf_usart2(ANSI_COLOR_RED ANSI_BG_YELLOW                              \
-                    "[USB-ERR] " ANSI_COLOR_RESET fmt,                         \
-                    ##__VA_ARGS__);                                            \
-    }                                                                          \
-  } while (0)
+  LOG_EMIT(LOG_ERROR, LOG_TAG_USB_ERR,                                         \
+           ANSI_COLOR_RED ANSI_BG_YELLOW "[USB-ERR] " ANSI_COLOR_RESET, fmt,   \
+           ##__VA_ARGS__)
+#else
+#define USB_ERROR(fmt, ...) LOG_DISCARD(fmt, ##__VA_ARGS__)
+#endif
 
+#if LOG_MODULE_LEVEL >= LOG_LEVEL_DEBUG
 #define USB_SETUP(fmt, ...)                                                    \
-  do {                                                                         \
-    if (current_log_level >= LOG_DEBUG) {                                      \
-      printf_usart2(ANSI_COLOR_CYAN ANSI_UNDERLINE                             \
-                    "[SETUP] " ANSI_COLOR_RESET fmt,                           \
-                    ##__VA_ARGS__);                                            \
-    }                                                                          \
-  } while (0)
+  LOG_EMIT(LOG_DEBUG, LOG_TAG_SETUP,                                           \
+           ANSI_COLOR_CYAN ANSI_UNDERLINE "[SETUP] " ANSI_COLOR_RESET, fmt,    \
+           ##__VA_ARGS__)
+#else
+#define USB_SETUP(fmt, ...) LOG_DISCARD(fmt, ##__VA_ARGS__)
+#endif
 
+#if LOG_MODULE_LEVEL >= LOG_LEVEL_TRACE
 #define USB_DATA(fmt, ...)                                                     \
-  do {                                                                         \
-    if (current_log_level >= LOG_TRACE) {                                      \
-      printf_usart2(ANSI_COLOR_GREEN "[DATA]  " ANSI_COLOR_RESET fmt,          \
-                    ##__VA_ARGS__);                                            \
-    }                                                                          \
-  } while (0)
+  LOG_EMIT(LOG_TRACE, LOG_TAG_DATA,                                            \
+           ANSI_COLOR_GREEN "[DATA]  " ANSI_COLOR_RESET, fmt, ##__VA_ARGS__)
+#else
+#define USB_DATA(fmt, ...) LOG_DISCARD(fmt, ##__VA_ARGS__)
+#endif
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <stm32f411xe.h>
+
+// 0 にするとプローブはすべて空になる
+#ifndef PROF_ENABLE
+#define PROF_ENABLE 1
+#endif
+
+// プローブ一覧（prof.c の名前テーブルと同じ順）
+typedef enum {
+  PROF_OTG_FS_IRQ = 0,  // OTG_FS_IRQHandler 全体
+  PROF_USB_RXFLVL,      // usb_handle_rxflvl
+  PROF_AUDIO_UNPACK,    // RX FIFO → リングの展開
+  PROF_I2S_DMA_IRQ,     // DMA1_Stream5_IRQHandler（補充込み）
+  PROF_USB_BOTTOM_HALF, // usb_bottom_half（PendSV）
+  PROF_AUDIO_RX_DMA,    // DMA2_Stream0_IRQHandler（AUDIO_RX_DMA の完了処理）
+  PROF_PROBE_COUNT
+} prof_probe_t;
+
+// ヒストグラムは log2(サイクル数) ごと
+//   bin 0: 0, bin k: [2^(k-1), 2^k), 最後の bin はそれ以上すべて
+#define PROF_HIST_BINS 16
+
+typedef struct {
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint64_t sum;
+  uint32_t hist[PROF_HIST_BINS];
+} prof_stats_t;
+
+// ベンダリクエストで返すワード数: count, min, max, sum(下位, 上位), hist
+#define PROF_EXPORT_WORDS (5 + PROF_HIST_BINS)
+
+void prof_init(void);
+void prof_reset(void);
+uint32_t prof_hist_bin(uint32_t cycles);
+void prof_record(prof_probe_t probe, uint32_t cycles);
+const prof_stats_t *prof_get(prof_probe_t probe);
+const char *prof_name(prof_probe_t probe);
+uint32_t prof_export(prof_probe_t probe, uint32_t *dst);
+void prof_log(void);
+
+static inline uint32_t prof_begin(void) {
+#if PROF_ENABLE
+  return DWT->CYCCNT;
+#else
+  return 0;
+#endif
+}
+
+static inline void prof_end(prof_probe_t probe, uint32_t start) {
+#if PROF_ENABLE
+  prof_record(probe, DWT->CYCCNT - start);
+#else
+  (void)probe;
+  (void)start;
+#endif
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// メインループで回す周期タスクの最大数
+#define SCHED_MAX_TASKS 8
+
+typedef void (*sched_task_fn)(void);
+
+bool sched_add(sched_task_fn fn, uint32_t period_us);
+void sched_run(void);
@@ -1,4 +1,19 @@
 #pragma once
 
-void tim2_init(void);
-void tim3_init(void);
+#include <stdbool.h>
+#include <stdint.h>
+
+// SOF周期の移動平均を取るフレーム数（2のべき乗）
+#define TIM2_SOF_AVG_SHIFT 6
+#define TIM2_SOF_AVG_FRAMES (1 << TIM2_SOF_AVG_SHIFT)
+
+void tim5_init(void);
+uint64_t time_now_us(void);
+
+void tim2_sof_init(void);
+uint32_t tim2_sof_capture(void);
+uint32_t tim2_sof_stamp(void);
+uint32_t tim2_sof_period(void);
+uint32_t tim2_sof_period_sum(void);
+uint32_t tim2_sof_overcapture_count(void);
+uint32_t tim2_now(void);
@@ -1,4 +1,16 @@
 #pragma once
 
+#include <stdint.h>
+
+// 送信リングのサイズ（バイト）。2のべき乗かつ 65536 以下であること
+#ifndef USART_TX_RING_SIZE
+#define USART_TX_RING_SIZE 2048
+#endif
+
+// 1回の printf_usart2 で整形できる最大長
+#define USART_TX_LINE_MAX 128
+
 void usart2_init(void);
 void printf_usart2(const char *fmt, ...);
+void usart2_write(const char *data, uint32_t len);
+uint32_t usart2_get_drop_count(void);
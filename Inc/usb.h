@@ -1,20 +1,22 @@
 #pragma once
 
+#include "usb_reg.h"
 #include <stdbool.h>
 #include <stdint.h>
 
-#define USB_DEVICE                                                             \
-  ((USB_OTG_DeviceTypeDef *)((uint32_t)USB_OTG_FS_PERIPH_BASE +                \
-                             USB_OTG_DEVICE_BASE))
+// デバイス・エンドポイント・FIFO は USB_OTG_FS からのオフセットで求める
+// （ホストのシミュレータは USB_OTG_FS を RAM に置き換える）
+#define USB_OTG_FS_AT(offset) ((uint8_t *)USB_OTG_FS + (offset))
+#define USB_DEVICE ((USB_OTG_DeviceTypeDef *)USB_OTG_FS_AT(USB_OTG_DEVICE_BASE))
 #define USB_INEP                                                               \
-  ((USB_OTG_INEndpointTypeDef *)((uint32_t)USB_OTG_FS_PERIPH_BASE +            \
-                                 USB_OTG_IN_ENDPOINT_BASE))
+  ((USB_OTG_INEndpointTypeDef *)USB_OTG_FS_AT(USB_OTG_IN_ENDPOINT_BASE))
 #define USB_OUTEP                                                              \
-  ((USB_OTG_OUTEndpointTypeDef *)((uint32_t)USB_OTG_FS_PERIPH_BASE +           \
-                                  USB_OTG_OUT_ENDPOINT_BASE))
+  ((USB_OTG_OUTEndpointTypeDef *)USB_OTG_FS_AT(USB_OTG_OUT_ENDPOINT_BASE))
+// FIFO は読み書きのたびに1ワード進むポート。usb_reg_read / usb_reg_write で
+// 触り, volatile なのでアクセスがまとめられたり省かれたりしない
 #define USB_FIFO(ep)                                                           \
-  ((uint32_t *)(USB_OTG_FS_PERIPH_BASE + USB_OTG_FIFO_BASE +                   \
-                ((ep) * USB_OTG_FIFO_SIZE)))
+  ((volatile uint32_t *)USB_OTG_FS_AT(USB_OTG_FIFO_BASE +                      \
+                                      (ep) * USB_OTG_FIFO_SIZE))
 
 typedef struct {
   uint8_t bmRequestType;
@@ -33,6 +35,17 @@ typedef enum {
   USB_CTRL_STATE_STATUS_OUT
 } USB_ControlState_t;
 
+// IN エンドポイントの無効化（EPDISD）を待つ回数。数 PHY クロックで済むので,
+// 応答しないコアで割り込みやロック中に固まらないよう早めに諦める
+#define USB_EPDIS_SPINS 256
+
+// 制御OUTデータステージで受け取れる最大バイト数
+#define USB_CONTROL_OUT_MAX 64
+
+// データステージ完了時に呼ばれる。false を返すとSTALLする
+typedef bool (*usb_control_out_cb)(const USB_SetupPacket *setup,
+                                   const uint8_t *data, uint16_t length);
+
 typedef struct {
   USB_ControlState_t state;
   USB_SetupPacket setup;
@@ -42,8 +55,30 @@ typedef struct {
   bool zlp_required; // Zero Length Packet必要フラグ
   uint8_t pending_address;
   bool address_pending;
+  usb_control_out_cb out_complete; // DATA_OUT 完了時の処理
 } USB_ControlState;
 
+// OTG_FS_IRQHandler の集計
+typedef struct {
+  uint32_t entries;     // 割り込みに入った回数
+  uint32_t passes;      // GINTSTS を読み直して処理した回数の合計
+  uint32_t rx_entries;  // 取り出した GRXSTSP エントリ数
+  uint32_t max_passes;  // 1回の割り込みでの最大パス数
+  uint32_t budget_hits; // 予算を使い切って抜けた回数
+  uint32_t single_pop;  // 1回の割り込みで1エントリずつ取り出していた場合の
+                        // 割り込み回数（パスごとに max(rx, 1) を足したもの）
+} USB_IrqStats;
+
+extern volatile USB_IrqStats usb_irq_stats;
+
 void usb_init(void);
 void usb_control_stall(void);
 void usb_control_send_data(uint8_t *data, uint16_t length);
+void usb_control_receive_data(USB_SetupPacket *setup,
+                              usb_control_out_cb out_complete);
+void usb_flush_tx_fifo(uint8_t fifo_num);
+bool usb_in_ep_disable(uint8_t ep);
+void usb_ep_lock(void);
+void usb_ep_unlock(void);
+void usb_bottom_half(void);
+void usb_log_irq_stats(void);
@@ -1,11 +1,10 @@
 #pragma once
 
+#include "audio_ring.h"
 #include "usb.h"
 #include <stdbool.h>
 #include <stdint.h>
 
-#define CALLBACK_TIME_HISTORY_SIZE 128
-
 // UAC2.0 Request Codes
 #define UAC2_REQUEST_CUR 0x01
 #define UAC2_REQUEST_RANGE 0x02
@@ -37,11 +36,55 @@
 #define UAC2_INTERFACE_CONTROL 0x00
 #define UAC2_INTERFACE_STREAMING 0x01
 
+// Audio Endpoint Addresses
+#define UAC2_EP_AUDIO_OUT 0x01
+
 // Sample Rate related
 #define UAC2_SAMPLE_RATE_48000 48000
 #define UAC2_SAMPLE_RATE_44100 44100
+#define UAC2_SAMPLE_RATE_88200 88200
+#define UAC2_SAMPLE_RATE_96000 96000
+#define UAC2_SAMPLE_RATE_MAX UAC2_SAMPLE_RATE_96000
+
+// Audio Streaming alternate settings
+#define UAC2_AS_ALT_ZERO_BANDWIDTH 0
+#define UAC2_AS_ALT_PCM16 1         // 16bit, 2-byte subslot
+#define UAC2_AS_ALT_PCM24_IN_32 2   // 24bit, 4-byte subslot (MSB-justified)
+#define UAC2_AS_ALT_PCM24_PACKED 3  // 24bit, 3-byte subslot
+#define UAC2_AS_ALT_MAX UAC2_AS_ALT_PCM24_PACKED
+
+// Packet size for a rate: ceil(rate / 1000) frames plus one extra frame the
+// host may send in asynchronous mode, 2 channels of `subslot` bytes each
+#define AUDIO_PACKET_SIZE(rate, subslot)                                       \
+  ((((rate) + 999) / 1000 + 1) * 2 * (subslot))
+#define AUDIO_EP_MAX_PACKET_SIZE AUDIO_PACKET_SIZE(UAC2_SAMPLE_RATE_MAX, 4)
+
+// Explicit feedback (10.14 format, frames per 1ms USB frame)
+#define UAC2_FEEDBACK_PERIOD_SHIFT 6 // Measure over 2^6 = 64 SOFs
+#define UAC2_FEEDBACK_HISTORY_SIZE 32
+
+// Nominal feedback for a sample rate
+static inline uint32_t uac2_feedback_nominal(uint32_t rate) {
+  return (rate << 14) / 1000;
+}
 
-#define AUDIO_BUFFER_SIZE 192
+// Feedback from the frames I2S consumed over 2^UAC2_FEEDBACK_PERIOD_SHIFT
+// SOFs, steered by how far the ring fill is below its target and clamped
+// to +/- 1/64 of nominal (~1.5%)
+static inline uint32_t uac2_feedback_calc(uint32_t rate, uint32_t consumed,
+                                          int32_t fill_error) {
+  int32_t nominal = (int32_t)uac2_feedback_nominal(rate);
+  int32_t limit = nominal >> 6;
+  int32_t value = (int32_t)(consumed << (14 - UAC2_FEEDBACK_PERIOD_SHIFT));
+
+  value += fill_error * 16;
+  if (value > nominal + limit) {
+    value = nominal + limit;
+  } else if (value < nominal - limit) {
+    value = nominal - limit;
+  }
+  return (uint32_t)value;
+}
 
 // UAC2.0 Clock Source State
 typedef struct {
@@ -50,16 +93,113 @@ typedef struct {
   bool clock_locked;    // Clock lock status
 } UAC2_ClockSourceState;
 
+// Audio Streaming format of the selected alternate setting
+typedef struct {
+  uint8_t alt_setting;  // UAC2_AS_ALT_*
+  uint8_t subslot_size; // Bytes per sample on the bus
+  uint8_t bit_depth;    // Bits per sample sent to I2S (16 or 24)
+} UAC2_StreamFormat;
+
+// Playback lifecycle, advanced by the I2S period callback
+typedef enum {
+  UAC2_STREAM_IDLE,     // Silence, I2S DMA interrupts paused, DAC in standby
+  UAC2_STREAM_PRIMING,  // Silence until the ring reaches the prime target
+  UAC2_STREAM_RUNNING,  // Playing from the ring
+  UAC2_STREAM_DRAINING, // Stopped: silence both DMA halves, then idle
+} UAC2_StreamState;
+
+// Upper bounds, in us, including the DMA half already queued ahead
+typedef struct {
+  uint32_t starts;           // Streams started (alt 1-3)
+  uint32_t stops;            // Streams stopped (alt 0)
+  uint32_t start_latency_us; // Alt setting to first sample at the output
+  uint32_t stop_latency_us;  // Alt 0 to silence at the output
+} UAC2_StreamLatency;
+
+// Jitter buffer: the ring fill the stream primes to and the feedback
+// steers towards. Set at run time with vendor request 0x05; in adaptive
+// mode the target shrinks while playback stays clean and grows after
+// an underrun.
+#define UAC2_LATENCY_US_MIN 1000
+#define UAC2_LATENCY_US_MAX 20000
+#ifndef UAC2_LATENCY_US
+#define UAC2_LATENCY_US 5000
+#endif
+#ifndef UAC2_LATENCY_ADAPTIVE
+#define UAC2_LATENCY_ADAPTIVE 0
+#endif
+#define UAC2_LATENCY_GROW_US 2000     // Added after a second with underruns
+#define UAC2_LATENCY_SHRINK_US 250    // Removed after a clean interval
+#define UAC2_LATENCY_CLEAN_SECONDS 10 // Length of that clean interval
+
+typedef struct {
+  uint32_t target_us;      // Current jitter buffer target
+  uint32_t target_frames;  // Target at the current sample rate
+  uint32_t latency_frames; // Ring fill plus the DMA period queued ahead
+  uint32_t adaptive;       // Nonzero when the target follows underruns
+  uint32_t grows;          // Adaptive target increases
+  uint32_t shrinks;        // Adaptive target decreases
+} UAC2_Latency;
+
+// Drain 16-bit iso OUT packets from the RX FIFO into the playback ring
+// with a DMA2 memory-to-memory transfer instead of CPU word loads
+#ifndef AUDIO_RX_DMA
+#define AUDIO_RX_DMA 0
+#endif
+
+// Isochronous OUT packet accounting, keyed off the SOF frame number
+typedef struct {
+  uint32_t received;          // EP1 OUT packets completed
+  uint32_t missed;            // Frames that ended without an EP1 packet
+  uint32_t incomplete;        // Incomplete iso OUT interrupts (re-scheduled)
+  uint32_t frames;            // Frames since the first packet of the stream
+  uint16_t last_rx_frame;     // Frame number of the last received packet
+  uint16_t last_missed_frame; // Frame number of the last missed packet
+  uint32_t dma_packets;       // Packets drained by DMA2 (AUDIO_RX_DMA)
+  uint32_t dma_errors;        // DMA2 transfer errors (drained by the CPU)
+} UAC2_IsoStats;
+
+// SOF timing statistics, in TIM2 ticks (SYSCLK) latched by the SOF pulse,
+// published every UAC2_FRAME_STATS_WINDOW frames
+#define UAC2_FRAME_STATS_WINDOW 1024
+
+typedef struct {
+  uint32_t window;       // Windows completed so far
+  uint32_t interval_min; // Shortest SOF-to-SOF interval
+  uint32_t interval_max; // Longest SOF-to-SOF interval
+  uint32_t jitter_avg;   // Mean |interval - 1 ms|
+  uint32_t offset_min;   // Shortest SOF to EP1 OUT completion
+  uint32_t offset_max;   // Longest SOF to EP1 OUT completion
+  uint32_t offset_avg;   // Mean SOF to EP1 OUT completion
+  uint32_t missed;       // Missed frames within the window
+} UAC2_FrameStats;
+
 // Global state
 extern UAC2_ClockSourceState uac2_clock_source_state;
+extern UAC2_StreamFormat uac2_stream_format;
+extern audio_ring_t audio_playback_ring;
+extern volatile uint32_t uac2_feedback_value;
+extern uint32_t uac2_feedback_history[UAC2_FEEDBACK_HISTORY_SIZE];
+extern volatile UAC2_IsoStats uac2_iso_stats;
+extern UAC2_FrameStats uac2_frame_stats;
+extern volatile UAC2_StreamState uac2_stream_state;
+extern volatile UAC2_StreamLatency uac2_stream_latency;
 
 // Function declarations
 void uac2_init(void);
-void uac2_process_audio_request(USB_SetupPacket *setup);
-void uac2_handle_clock_source_request(USB_SetupPacket *setup,
-                                      uint8_t control_selector);
-void uac2_handle_clock_selector_request(USB_SetupPacket *setup,
-                                        uint8_t control_selector);
 void uac2_prepare_next_reception(void);
 void uac2_handle_audio_data_received(void);
 void uac2_read_audio_from_fifo(uint32_t byte_count);
+void uac2_stream_start(void);
+void uac2_stream_reprime(void);
+void uac2_stream_stop(void);
+void uac2_handle_sof(void);
+void uac2_handle_incomplete_iso_out(void);
+void uac2_log_stream_stats(void);
+void uac2_stream_task(void);
+bool uac2_set_latency(uint32_t target_us, bool adaptive);
+void uac2_get_latency(UAC2_Latency *latency);
+void uac2_latency_task(void);
+bool uac2_set_sample_rate(uint32_t rate);
+bool uac2_set_alt_setting(uint8_t alt_setting);
+uint16_t uac2_get_max_packet_size(void);
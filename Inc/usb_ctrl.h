@@ -0,0 +1,60 @@
+#pragma once
+
+#include "usb.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// 制御リクエストのディスパッチテーブル
+// キーは bmRequestType, bRequest, wValue 上位バイト（ディスクリプタ種別や
+// コントロールセレクタ）, インデックス（エンティティID / インターフェース /
+// エンドポイント）の4バイト。各テーブルはキー昇順に並べること
+#define USB_CTRL_KEY(type, request, value_hi, index)                           \
+  (((uint32_t)(type) << 24) | ((uint32_t)(request) << 16) |                    \
+   ((uint32_t)(value_hi) << 8) | (uint32_t)(index))
+
+// ワイルドカード（0のバイトは比較しない）。usb_ctrl_masks の順に探す
+#define USB_CTRL_MATCH_EXACT 0xFFFFFFFF
+#define USB_CTRL_MATCH_ANY_VALUE 0xFFFF00FF   // wValue 上位を問わない
+#define USB_CTRL_MATCH_REQUEST 0xFFFF0000     // type と bRequest のみ
+#define USB_CTRL_MATCH_ANY_REQUEST 0xFF0000FF // type とインデックスのみ
+#define USB_CTRL_MASK_COUNT 4
+
+// テーブルを登録できる最大数（モジュールごとに1つ）
+#define USB_CTRL_MAX_TABLES 4
+
+typedef void (*usb_ctrl_handler_t)(USB_SetupPacket *setup);
+
+typedef struct {
+  uint32_t key;                 // USB_CTRL_KEY(...) & mask
+  uint32_t mask;                // USB_CTRL_MATCH_*
+  usb_ctrl_handler_t handler;   // NULL なら response をそのまま返す
+  const void *response;         // 事前に用意した応答（ワード境界に置く）
+  uint16_t response_len;
+} usb_ctrl_entry_t;
+
+typedef struct {
+  const usb_ctrl_entry_t *entries;
+  uint16_t count;
+} usb_ctrl_table_t;
+
+#define USB_CTRL_HANDLER(type, request, value_hi, index, mask, fn)             \
+  {USB_CTRL_KEY(type, request, value_hi, index) & (mask), (mask), (fn), NULL, 0}
+
+#define USB_CTRL_RESPONSE(type, request, value_hi, index, mask, data, len)     \
+  {USB_CTRL_KEY(type, request, value_hi, index) & (mask), (mask), NULL,        \
+   (data), (len)}
+
+#define USB_CTRL_TABLE(entries)                                                \
+  {(entries), sizeof(entries) / sizeof((entries)[0])}
+
+extern const uint32_t usb_ctrl_masks[USB_CTRL_MASK_COUNT];
+
+// usb_init が登録するテーブル（usb.c の標準・ベンダー, usb_audio.c の UAC2）
+extern const usb_ctrl_table_t usb_std_table;
+extern const usb_ctrl_table_t uac2_request_table;
+
+bool usb_ctrl_register(const usb_ctrl_table_t *table);
+void usb_ctrl_reset(void);
+uint32_t usb_ctrl_key(const USB_SetupPacket *setup);
+const usb_ctrl_entry_t *usb_ctrl_lookup(const USB_SetupPacket *setup);
+bool usb_ctrl_dispatch(USB_SetupPacket *setup);
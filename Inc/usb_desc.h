@@ -156,6 +156,20 @@ typedef struct __attribute__((packed)) {
   uint16_t wLockDelay;        // Lock delay value
 } UAC2_ASEndpointDescriptor;
 
+// Audio Streaming operational alternate setting (interface + format + EPs)
+typedef struct __attribute__((packed)) {
+  USB_InterfaceDescriptor as_interface;
+  UAC2_ASGeneralDescriptor as_general;
+  UAC2_FormatTypeDescriptor format_type;
+
+  // Audio Streaming Endpoint
+  USB_EndpointDescriptor as_endpoint;
+  UAC2_ASEndpointDescriptor as_ep_desc;
+
+  // Explicit Feedback Endpoint
+  USB_EndpointDescriptor as_fb_endpoint;
+} UAC2_ASAlternateSetting;
+
 // Complete UAC 2.0 Configuration Descriptor
 typedef struct __attribute__((packed)) {
   // Configuration Descriptor
@@ -183,14 +197,9 @@ typedef struct __attribute__((packed)) {
   // Audio Streaming Interface (Interface 1, Alt 0 - Zero bandwidth)
   USB_InterfaceDescriptor as_interface_alt0;
 
-  // Audio Streaming Interface (Interface 1, Alt 1 - Operational)
-  USB_InterfaceDescriptor as_interface_alt1;
-  UAC2_ASGeneralDescriptor as_general;
-  UAC2_FormatTypeDescriptor format_type;
-
-  // Audio Streaming Endpoint
-  USB_EndpointDescriptor as_endpoint;
-  UAC2_ASEndpointDescriptor as_ep_desc;
+  // Audio Streaming Interface (Interface 1, Alt 1..3 - Operational)
+  //   Alt 1: 16bit, Alt 2: 24bit in 32bit subslot, Alt 3: 24bit packed
+  UAC2_ASAlternateSetting as_alt[3];
 
 } UAC2_ConfigurationDescriptor;
 
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+// スロット数。2のべき乗であること
+#ifndef USB_EVQ_SLOTS
+#define USB_EVQ_SLOTS 8
+#endif
+
+// 1スロットに保持できるパケットの最大バイト数（EP0の最大パケットサイズ）
+#define USB_EVQ_DATA_MAX 64
+
+_Static_assert((USB_EVQ_SLOTS & (USB_EVQ_SLOTS - 1)) == 0,
+               "USB_EVQ_SLOTS must be a power of two");
+
+// トップハーフ（OTG_FS_IRQHandler）からボトムハーフ（PendSV）へ渡すイベント
+typedef enum {
+  USB_EVT_RESET = 0,    // バスリセット
+  USB_EVT_SETUP,        // SETUPパケット受信（data に8バイト）
+  USB_EVT_OUT_DATA,     // EP0 OUTデータ受信（data に len バイト）
+  USB_EVT_OUT_COMPLETE, // GRXSTSP の OUT転送完了
+  USB_EVT_EP0_IN_XFRC,  // EP0 IN 転送完了
+  USB_EVT_EP0_OUT_XFRC, // EP0 OUT 転送完了
+} usb_event_type_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t epnum;
+  uint16_t len;
+  uint32_t data[USB_EVQ_DATA_MAX / 4]; // FIFOからワード単位で直接読み込む
+} usb_event_t;
+
+// ロックフリーSPSCキュー。スロットは静的に確保し、コピーせずに受け渡す
+typedef struct {
+  usb_event_t slot[USB_EVQ_SLOTS];
+  volatile uint32_t head;           // トップハーフのみ更新
+  volatile uint32_t tail;           // ボトムハーフのみ更新
+  volatile uint32_t overflow_count; // 満杯で捨てたイベント数
+} usb_evq_t;
+
+void usb_evq_init(usb_evq_t *q);
+usb_event_t *usb_evq_alloc(usb_evq_t *q);
+void usb_evq_commit(usb_evq_t *q);
+usb_event_t *usb_evq_peek(usb_evq_t *q);
+void usb_evq_release(usb_evq_t *q);
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "usb_reg.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// FIFO ポートとバッファの間のコピー。usb_read_packet / usb_write_packet の
+// 中身で, ホストのベンチマークからも同じコードを使う。
+// FIFO ポートは usb_reg_read / usb_reg_write で1ワードずつ触る
+// ワード境界のバッファは4ワードずつまとめて, それ以外はバイトで組み立てる
+
+// bcnt バイトを読む。dest が NULL なら読み捨てる
+static inline void usb_fifo_read(volatile uint32_t *fifo, uint8_t *dest,
+                                 uint32_t bcnt) {
+  uint32_t nwords = bcnt / 4;
+  uint32_t tail = bcnt & 3;
+  uint32_t data;
+
+  if (dest == NULL) {
+    // 読み捨て
+    for (uint32_t i = 0; i < nwords + (tail ? 1 : 0); i++) {
+      (void)usb_reg_read(fifo);
+    }
+    return;
+  }
+
+  if (((uintptr_t)dest & 3) == 0) {
+    // ワード境界: 4ワードずつまとめてコピー
+    uint32_t *dst = (uint32_t *)dest;
+    uint32_t i = 0;
+    for (; i + 4 <= nwords; i += 4) {
+      dst[i] = usb_reg_read(fifo);
+      dst[i + 1] = usb_reg_read(fifo);
+      dst[i + 2] = usb_reg_read(fifo);
+      dst[i + 3] = usb_reg_read(fifo);
+    }
+    for (; i < nwords; i++) {
+      dst[i] = usb_reg_read(fifo);
+    }
+  } else {
+    for (uint32_t i = 0; i < nwords; i++) {
+      data = usb_reg_read(fifo);
+      dest[i * 4] = (uint8_t)data;
+      dest[i * 4 + 1] = (uint8_t)(data >> 8);
+      dest[i * 4 + 2] = (uint8_t)(data >> 16);
+      dest[i * 4 + 3] = (uint8_t)(data >> 24);
+    }
+  }
+
+  // 端数バイト（最後のワードの下位から）
+  if (tail) {
+    data = usb_reg_read(fifo);
+    dest += nwords * 4;
+    for (uint32_t j = 0; j < tail; j++) {
+      dest[j] = (uint8_t)(data >> (j * 8));
+    }
+  }
+}
+
+// len バイトを書く
+static inline void usb_fifo_write(volatile uint32_t *fifo, const uint8_t *src,
+                                  uint32_t len) {
+  uint32_t nwords = len / 4;
+  uint32_t tail = len & 3;
+  uint32_t data;
+
+  if (((uintptr_t)src & 3) == 0) {
+    // ワード境界（フラッシュ上の応答・ディスクリプタ）: 4ワードずつ
+    const uint32_t *s = (const uint32_t *)src;
+    uint32_t i = 0;
+    for (; i + 4 <= nwords; i += 4) {
+      usb_reg_write(fifo, s[i]);
+      usb_reg_write(fifo, s[i + 1]);
+      usb_reg_write(fifo, s[i + 2]);
+      usb_reg_write(fifo, s[i + 3]);
+    }
+    for (; i < nwords; i++) {
+      usb_reg_write(fifo, s[i]);
+    }
+  } else {
+    for (uint32_t i = 0; i < nwords; i++) {
+      usb_reg_write(fifo, (uint32_t)src[i * 4] |
+                              ((uint32_t)src[i * 4 + 1] << 8) |
+                              ((uint32_t)src[i * 4 + 2] << 16) |
+                              ((uint32_t)src[i * 4 + 3] << 24));
+    }
+  }
+
+  // 端数バイトは最後のワードの下位に詰める
+  if (tail) {
+    src += nwords * 4;
+    data = 0;
+    for (uint32_t j = 0; j < tail; j++) {
+      data |= (uint32_t)src[j] << (j * 8);
+    }
+    usb_reg_write(fifo, data);
+  }
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+// 読み書きに副作用のある OTG FS レジスタはこの2つを通して触る
+//   GRXSTSP, FIFO ポート: 読むたびに1エントリ / 1ワード取り出す
+//   GINTSTS, DIEPINT, DOEPINT: 1を書いたビットだけが消える
+//   GRSTCTL: コアがリセットやフラッシュを終えるとビットが落ちる
+// ファームウェアではそのままのアクセスになる。USB_SIM のホストビルドでは
+// test/sim のレジスタモデルがアドレスを見て同じ動きをする
+#if USB_SIM
+uint32_t usb_reg_read(volatile uint32_t *reg);
+void usb_reg_write(volatile uint32_t *reg, uint32_t value);
+#else
+static inline uint32_t usb_reg_read(volatile uint32_t *reg) { return *reg; }
+
+static inline void usb_reg_write(volatile uint32_t *reg, uint32_t value) {
+  *reg = value;
+}
+#endif
@@ -0,0 +1,192 @@
+#include "audio_conceal.h"
+
+// リングからの読み出しに欠落の補間と溢れの間引きを被せる（コンシューマ側）
+//   不足: 直前の履歴を繰り返し（つなぎ目はクロスフェード）, 無音へフェード
+//   復帰: 補間信号から実データへクロスフェード
+//   溢れ: 一番静かなフレームの位置で数フレーム飛ばし, クロスフェードでつなぐ
+// サンプルは左詰めの32bit（16bitは<<16）に直して扱う
+
+#define Q15_ONE 32768
+
+volatile audio_conceal_stats_t audio_conceal_stats = {0};
+
+// 古い順。history[AUDIO_CONCEAL_HISTORY - 1] が最後に出したフレーム
+static int32_t history[AUDIO_CONCEAL_HISTORY][2];
+static uint32_t conceal_pos = 0; // 補間を始めてからのフレーム数（0: 実データ）
+static uint32_t drop_buf[AUDIO_CONCEAL_DROP * 2];
+
+static void frame_get(const uint32_t *buf, uint32_t frame, uint32_t frame_words,
+                      int32_t s[2]) {
+  if (frame_words == 1) {
+    uint32_t w = buf[frame];
+    s[0] = (int32_t)(w << 16);
+    s[1] = (int32_t)(w & 0xFFFF0000);
+  } else {
+    // 24bit はハーフワード入れ替え済み
+    uint32_t l = buf[frame * 2];
+    uint32_t r = buf[frame * 2 + 1];
+    s[0] = (int32_t)((l << 16) | (l >> 16));
+    s[1] = (int32_t)((r << 16) | (r >> 16));
+  }
+}
+
+static void frame_put(uint32_t *buf, uint32_t frame, uint32_t frame_words,
+                      const int32_t s[2]) {
+  uint32_t l = (uint32_t)s[0];
+  uint32_t r = (uint32_t)s[1];
+
+  if (frame_words == 1) {
+    buf[frame] = (l >> 16) | (r & 0xFFFF0000);
+  } else {
+    buf[frame * 2] = (l << 16) | (l >> 16);
+    buf[frame * 2 + 1] = (r << 16) | (r >> 16);
+  }
+}
+
+// a から b へ t (Q15) だけ寄せる
+static inline int32_t mix(int32_t a, int32_t b, int32_t t) {
+  return (int32_t)(((int64_t)a * (Q15_ONE - t) + (int64_t)b * t) >> 15);
+}
+
+static void history_push(const uint32_t *buf, uint32_t frames,
+                         uint32_t frame_words) {
+  uint32_t keep = 0;
+
+  if (frames < AUDIO_CONCEAL_HISTORY) {
+    keep = AUDIO_CONCEAL_HISTORY - frames;
+    for (uint32_t i = 0; i < keep; i++) {
+      history[i][0] = history[i + frames][0];
+      history[i][1] = history[i + frames][1];
+    }
+  }
+  for (uint32_t i = keep; i < AUDIO_CONCEAL_HISTORY; i++) {
+    frame_get(buf, frames - AUDIO_CONCEAL_HISTORY + i, frame_words,
+              history[i]);
+  }
+}
+
+// 補間信号の k フレーム目。履歴を繰り返し, 先頭は最後のフレームから
+// 鏡像で折り返した信号とクロスフェードして段差を作らない
+static void conceal_frame(uint32_t k, int32_t s[2]) {
+  if (k >= AUDIO_CONCEAL_FADE) {
+    s[0] = 0;
+    s[1] = 0;
+    return;
+  }
+
+  uint32_t p = k % AUDIO_CONCEAL_HISTORY;
+  int32_t gain = Q15_ONE - (int32_t)(k * Q15_ONE / AUDIO_CONCEAL_FADE);
+
+  for (uint32_t ch = 0; ch < 2; ch++) {
+    int32_t v = history[p][ch];
+    if (p < AUDIO_CONCEAL_XFADE) {
+      int32_t mirror = history[AUDIO_CONCEAL_HISTORY - 1 - p][ch];
+      v = mix(mirror, v, (int32_t)(p * Q15_ONE / AUDIO_CONCEAL_XFADE));
+    }
+    s[ch] = mix(0, v, gain);
+  }
+}
+
+// frames 中の一番静かな位置から drop フレーム飛ばす。飛ばした分は
+// drop_buf（リングから余分に読んだ続き）で末尾を埋める。
+// クロスフェードが周期内で終わるよう, 探すのは frames - XFADE まで
+// （frames >= AUDIO_CONCEAL_XFADE であること）
+static void conceal_splice(uint32_t *dst, uint32_t frames, uint32_t drop,
+                           uint32_t frame_words) {
+  uint32_t m = 0;
+  uint32_t best = UINT32_MAX;
+  int32_t cur[2];
+  int32_t next[2];
+
+  for (uint32_t i = 0; i <= frames - AUDIO_CONCEAL_XFADE; i++) {
+    frame_get(dst, i, frame_words, cur);
+    uint32_t e = (uint32_t)((cur[0] < 0 ? -(cur[0] >> 16) : cur[0] >> 16) +
+                            (cur[1] < 0 ? -(cur[1] >> 16) : cur[1] >> 16));
+    if (e < best) {
+      best = e;
+      m = i;
+    }
+  }
+
+  // 前から詰めるので読み出し位置 i + drop はまだ書き換えていない
+  for (uint32_t i = m; i < frames; i++) {
+    uint32_t j = i + drop;
+    if (j < frames) {
+      frame_get(dst, j, frame_words, next);
+    } else {
+      frame_get(drop_buf, j - frames, frame_words, next);
+    }
+    if (i - m < AUDIO_CONCEAL_XFADE) {
+      int32_t t = (int32_t)((i - m + 1) * Q15_ONE / (AUDIO_CONCEAL_XFADE + 1));
+      frame_get(dst, i, frame_words, cur);
+      next[0] = mix(cur[0], next[0], t);
+      next[1] = mix(cur[1], next[1], t);
+    }
+    frame_put(dst, i, frame_words, next);
+  }
+}
+
+// ストリーム開始時に呼ぶ（コンシューマが止まっている時）
+void audio_conceal_reset(void) {
+  for (uint32_t i = 0; i < AUDIO_CONCEAL_HISTORY; i++) {
+    history[i][0] = 0;
+    history[i][1] = 0;
+  }
+  conceal_pos = 0;
+}
+
+// 常に frames フレームを dst に書く。リングに high_water を超えて
+// 溜まっていれば間引く（クロスフェードに足りない短い周期では間引かない）
+uint32_t audio_conceal_read(audio_ring_t *ring, uint32_t *dst, uint32_t frames,
+                            uint32_t high_water) {
+  uint32_t frame_words = ring->frame_words;
+  uint32_t fill = audio_ring_fill(ring);
+  uint32_t n = audio_ring_read(ring, dst, frames);
+  int32_t cur[2];
+  int32_t s[2];
+
+  if (n == frames && frames >= AUDIO_CONCEAL_XFADE &&
+      fill > frames + high_water) {
+    uint32_t drop = fill - frames - high_water;
+    if (drop > AUDIO_CONCEAL_DROP) {
+      drop = AUDIO_CONCEAL_DROP;
+    }
+    drop = audio_ring_read(ring, drop_buf, drop);
+    conceal_splice(dst, frames, drop, frame_words);
+    audio_conceal_stats.drops++;
+    audio_conceal_stats.dropped_frames += drop;
+  }
+
+  if (n > 0 && conceal_pos > 0) {
+    // 補間信号から実データへ戻す
+    for (uint32_t i = 0; i < n && i < AUDIO_CONCEAL_XFADE; i++) {
+      int32_t t = (int32_t)((i + 1) * Q15_ONE / (AUDIO_CONCEAL_XFADE + 1));
+      conceal_frame(conceal_pos + i, s);
+      frame_get(dst, i, frame_words, cur);
+      cur[0] = mix(s[0], cur[0], t);
+      cur[1] = mix(s[1], cur[1], t);
+      frame_put(dst, i, frame_words, cur);
+    }
+    conceal_pos = 0;
+  }
+  if (n > 0) {
+    history_push(dst, n, frame_words);
+  }
+
+  if (n < frames) {
+    if (conceal_pos == 0) {
+      audio_conceal_stats.underruns++;
+    }
+    for (uint32_t i = n; i < frames; i++) {
+      conceal_frame(conceal_pos, s);
+      frame_put(dst, i, frame_words, s);
+      if (conceal_pos < AUDIO_CONCEAL_FADE) {
+        if (++conceal_pos == AUDIO_CONCEAL_FADE) {
+          audio_conceal_stats.fades++;
+        }
+      }
+    }
+    audio_conceal_stats.concealed_frames += frames - n;
+  }
+  return frames;
+}
@@ -0,0 +1,89 @@
+#include "audio_ring.h"
+#include <stm32f411xe.h>
+
+#define AUDIO_RING_MASK (AUDIO_RING_WORDS - 1)
+
+void audio_ring_init(audio_ring_t *ring) {
+  ring->head = 0;
+  ring->tail = 0;
+  ring->frame_words = 1;
+  ring->overrun_count = 0;
+  ring->underrun_count = 0;
+}
+
+// フレーム形式の変更。プロデューサとコンシューマが止まっている時に呼ぶこと
+void audio_ring_set_frame_words(audio_ring_t *ring, uint32_t frame_words) {
+  ring->tail = ring->head;
+  ring->frame_words = frame_words;
+}
+
+uint32_t audio_ring_capacity(const audio_ring_t *ring) {
+  return AUDIO_RING_WORDS / ring->frame_words;
+}
+
+uint32_t audio_ring_fill(const audio_ring_t *ring) {
+  return (ring->head - ring->tail) / ring->frame_words;
+}
+
+uint32_t audio_ring_space(const audio_ring_t *ring) {
+  return (AUDIO_RING_WORDS - (ring->head - ring->tail)) / ring->frame_words;
+}
+
+// 書き込み範囲を確保する（プロデューサ側）。確保したフレーム数を返す
+uint32_t audio_ring_write_begin(audio_ring_t *ring, uint32_t frames) {
+  uint32_t space =
+      (AUDIO_RING_WORDS - (ring->head - ring->tail)) / ring->frame_words;
+
+  if (frames > space) {
+    // 入り切らない分は新しいデータ側を捨てる
+    ring->overrun_count++;
+    frames = space;
+  }
+  return frames;
+}
+
+// audio_ring_put で書いたフレームを公開する
+void audio_ring_write_end(audio_ring_t *ring, uint32_t frames) {
+  // データを書き終えてから head を公開する
+  __DMB();
+  ring->head += frames * ring->frame_words;
+}
+
+uint32_t audio_ring_write(audio_ring_t *ring, const uint32_t *src,
+                          uint32_t frames) {
+  uint32_t head = ring->head;
+
+  frames = audio_ring_write_begin(ring, frames);
+
+  uint32_t words = frames * ring->frame_words;
+  for (uint32_t i = 0; i < words; i++) {
+    ring->buf[(head + i) & AUDIO_RING_MASK] = src[i];
+  }
+
+  audio_ring_write_end(ring, frames);
+  return frames;
+}
+
+uint32_t audio_ring_read(audio_ring_t *ring, uint32_t *dst, uint32_t frames) {
+  uint32_t tail = ring->tail;
+  uint32_t fill = (ring->head - tail) / ring->frame_words;
+
+  if (frames > fill) {
+    ring->underrun_count++;
+    frames = fill;
+  }
+
+  // head を読んでからデータを読む
+  __DMB();
+  uint32_t words = frames * ring->frame_words;
+  for (uint32_t i = 0; i < words; i++) {
+    dst[i] = ring->buf[(tail + i) & AUDIO_RING_MASK];
+  }
+
+  __DMB();
+  ring->tail = tail + words;
+  return frames;
+}
+
+// 溜まっているフレームを全て捨てる（コンシューマ側から呼ぶこと）
+void audio_ring_flush(audio_ring_t *ring) { ring->tail = ring->head; }
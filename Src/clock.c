@@ -22,13 +22,22 @@ void clock_init(void) {
 
   RCC->CFGR |= RCC_CFGR_PPRE1_DIV2;
 
+  clock_set_plli2s(344, 2);
+  SystemCoreClockUpdate();
+}
+
+// PLLI2S再設定（入力はHSE/8 = 1MHz）。I2Sを止めてから呼ぶこと
+void clock_set_plli2s(uint32_t n, uint32_t r) {
+  RCC->CR &= ~RCC_CR_PLLI2SON;
+  while (RCC->CR & RCC_CR_PLLI2SRDY)
+    ;
+
   RCC->PLLI2SCFGR &= ~(RCC_PLLI2SCFGR_PLLI2SM | RCC_PLLI2SCFGR_PLLI2SN |
                        RCC_PLLI2SCFGR_PLLI2SR);
   RCC->PLLI2SCFGR |= (8 << RCC_PLLI2SCFGR_PLLI2SM_Pos) |
-                     (258 << RCC_PLLI2SCFGR_PLLI2SN_Pos) |
-                     (3 << RCC_PLLI2SCFGR_PLLI2SR_Pos);
+                     (n << RCC_PLLI2SCFGR_PLLI2SN_Pos) |
+                     (r << RCC_PLLI2SCFGR_PLLI2SR_Pos);
   RCC->CR |= RCC_CR_PLLI2SON;
   while (!(RCC->CR & RCC_CR_PLLI2SRDY))
     ;
-  SystemCoreClockUpdate();
 }
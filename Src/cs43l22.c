@@ -23,3 +23,8 @@ void cs43l22_init(void) {
 
   LOG_DEBUG("%s", "CS43L22 initialized\r\n");
 }
+
+// Power Ctl 1: 0x9E で動作, 0x01 でスタンバイ（MCLK は止めずに切り替える）
+void cs43l22_set_power(bool on) {
+  i2c1_write_reg(CS43L22_ADDR, 0x02, on ? 0x9e : 0x01);
+}
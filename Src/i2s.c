@@ -1,31 +1,260 @@
 #include "i2s.h"
+#include "audio_ring.h"
+#include "clock.h"
 #include "log.h"
+#include "prof.h"
 #include "usart.h"
 #include "usb_audio.h"
 #include <stdbool.h>
+#include <stddef.h>
 #include <stm32f411xe.h>
 
-extern int16_t audio_rx_samples_0[AUDIO_BUFFER_SIZE / 2];
-extern int16_t audio_rx_samples_1[AUDIO_BUFFER_SIZE / 2];
+// 1周期の最大ワード数（96kHz, 24bit で I2S_PERIOD_US_MAX 分）
+#define I2S_PERIOD_MAX_WORDS (96 * I2S_PERIOD_US_MAX / 1000 * 2)
+
+// PLLI2S(1MHz入力) と I2SPR の設定
+// MCK出力時 Fs = N / R [MHz] / (256 * (2 * DIV + ODD))
+typedef struct {
+  uint32_t rate;
+  uint16_t plli2s_n;
+  uint8_t plli2s_r;
+  uint8_t i2sdiv;
+  uint8_t odd;
+} i2s_rate_config_t;
+
+// 誤差はいずれも ±200ppm 以内
+static const i2s_rate_config_t i2s_rate_table[] = {
+    {44100, 271, 2, 6, 0}, // 44108.1 Hz (+183 ppm)
+    {48000, 344, 2, 7, 0}, // 47991.1 Hz (-186 ppm)
+    {88200, 271, 2, 3, 0}, // 88216.1 Hz (+183 ppm)
+    {96000, 344, 2, 3, 1}, // 95982.1 Hz (-186 ppm)
+};
+
+// 2周期分の循環バッファ。HT で前半, TC で後半を補充する
+// メモリ側は4ワードバーストなので 1KB 境界を跨がないよう16バイト境界に置く
+static uint32_t i2s_dma_buf[2 * I2S_PERIOD_MAX_WORDS]
+    __attribute__((aligned(16)));
+static const i2s_rate_config_t *i2s_rate = NULL;
+static uint32_t i2s_period_us = I2S_PERIOD_US;
+static uint32_t i2s_period_frames = 48;
+static uint32_t i2s_frame_words = 1; // 16bit: 1, 24bit: 2
+// 現在のバッファ先頭までに送り出した累計フレーム数。
+// 周期・形式・レートを変えるときは停止位置までを繰り入れる
+static volatile uint32_t i2s_frames_done = 0;
+// 停止前の HTIE / TCIE。一時停止中なら i2s3_start でも止めたままにする
+static uint32_t i2s_irq_enables = DMA_SxCR_HTIE | DMA_SxCR_TCIE;
+
+static uint32_t i2s3_ring_source(uint32_t *dst, uint32_t frames) {
+  return audio_ring_read(&audio_playback_ring, dst, frames);
+}
+
+static i2s_source_t i2s_source = i2s3_ring_source;
+
+static const i2s_rate_config_t *i2s3_find_rate(uint32_t rate) {
+  for (uint32_t i = 0; i < sizeof(i2s_rate_table) / sizeof(i2s_rate_table[0]);
+       i++) {
+    if (i2s_rate_table[i].rate == rate) {
+      return &i2s_rate_table[i];
+    }
+  }
+  return NULL;
+}
+
+static void i2s3_refill(uint32_t *dst) {
+  uint32_t n = i2s_source(dst, i2s_period_frames);
+
+  // 足りない分は無音で埋める
+  for (uint32_t i = n * i2s_frame_words;
+       i < i2s_period_frames * i2s_frame_words; i++) {
+    dst[i] = 0;
+  }
+}
+
+static void i2s3_stop(void) {
+  uint32_t cr = DMA1_Stream5->CR;
+
+  // EN を落とすと TCIF5 が立つ。割り込みを先に止めておかないと
+  // DMA 割り込みが下の待ちに割り込み, 1バッファ分を数えて補充してしまう
+  i2s_irq_enables = cr & (DMA_SxCR_HTIE | DMA_SxCR_TCIE);
+  DMA1_Stream5->CR = cr & ~(DMA_SxCR_HTIE | DMA_SxCR_TCIE);
+  DMA1_Stream5->CR = cr & ~(DMA_SxCR_HTIE | DMA_SxCR_TCIE | DMA_SxCR_EN);
+  while (DMA1_Stream5->CR & DMA_SxCR_EN)
+    ;
+  // 旧設定の NDTR と周期で停止位置までを数え、次の i2s3_start に繋ぐ。
+  // 停止で立った TCIF5 は周回ではないので数えない
+  i2s_frames_done += 2 * i2s_period_frames -
+                     DMA1_Stream5->NDTR / (i2s_frame_words * 2);
+  DMA1->HIFCR = DMA_HIFCR_CTCIF5 | DMA_HIFCR_CHTIF5 | DMA_HIFCR_CTEIF5 |
+                DMA_HIFCR_CDMEIF5 | DMA_HIFCR_CFEIF5;
+
+  // 送信中のデータを出し切ってから止める
+  while (!(SPI3->SR & SPI_SR_TXE))
+    ;
+  while (SPI3->SR & SPI_SR_BSY)
+    ;
+  SPI3->I2SCFGR &= ~SPI_I2SCFGR_I2SE;
+}
+
+static void i2s3_start(const i2s_rate_config_t *cfg) {
+  i2s_rate = cfg;
+  // 4ワードバーストで割り切れるよう偶数フレームに丸める
+  i2s_period_frames =
+      ((cfg->rate / 100 * i2s_period_us + 5000) / 10000 + 1) & ~1UL;
+
+  for (uint32_t i = 0; i < 2 * I2S_PERIOD_MAX_WORDS; i++) {
+    i2s_dma_buf[i] = 0;
+  }
+
+  SPI3->I2SPR = (cfg->i2sdiv << SPI_I2SPR_I2SDIV_Pos) |
+                (cfg->odd ? SPI_I2SPR_ODD : 0) | SPI_I2SPR_MCKOE; // MCK出力
+
+  // 16bit: CHLEN=16bit, 24bit: DATLEN=24bit, CHLEN=32bit
+  SPI3->I2SCFGR &= ~(SPI_I2SCFGR_DATLEN | SPI_I2SCFGR_CHLEN);
+  if (i2s_frame_words == 2) {
+    SPI3->I2SCFGR |= SPI_I2SCFGR_DATLEN_0 | SPI_I2SCFGR_CHLEN;
+  }
+
+  DMA1_Stream5->M0AR = (uint32_t)i2s_dma_buf;
+  // NDTRはペリフェラル側（ハーフワード）の転送数, 2周期分
+  DMA1_Stream5->NDTR = 2 * i2s_period_frames * i2s_frame_words * 2;
+  DMA1_Stream5->CR |= i2s_irq_enables | DMA_SxCR_EN;
+  SPI3->I2SCFGR |= SPI_I2SCFGR_I2SE;
+}
 
 void i2s3_init(void) {
   RCC->AHB1ENR |= RCC_AHB1ENR_DMA1EN;
-  DMA1_Stream5->CR |= (0 << DMA_SxCR_CHSEL_Pos) | DMA_SxCR_MSIZE_0 |
+  // メモリ側32bit, ペリフェラル側16bit（FIFOでハーフワードに分割, 下位が先）
+  // 循環モードで半分ごとに HT / TC 割り込み
+  DMA1_Stream5->CR |= (0 << DMA_SxCR_CHSEL_Pos) | DMA_SxCR_MSIZE_1 |
                       DMA_SxCR_PSIZE_0 | DMA_SxCR_MINC | DMA_SxCR_DIR_0 |
-                      DMA_SxCR_DBM;
+                      DMA_SxCR_CIRC | DMA_SxCR_MBURST_0 | DMA_SxCR_HTIE |
+                      DMA_SxCR_TCIE;
+  // メモリ側は4ワードバーストでFIFOを満杯まで埋める
+  DMA1_Stream5->FCR = DMA_SxFCR_DMDIS | DMA_SxFCR_FTH;
   DMA1_Stream5->PAR = (uint32_t)&SPI3->DR;
-  DMA1_Stream5->M0AR = (uint32_t)audio_rx_samples_0;
-  DMA1_Stream5->M1AR = (uint32_t)audio_rx_samples_1;
-  DMA1_Stream5->NDTR = AUDIO_BUFFER_SIZE / 2;
+  NVIC_SetPriority(DMA1_Stream5_IRQn, 1);
+  NVIC_EnableIRQ(DMA1_Stream5_IRQn);
 
   RCC->APB1ENR |= RCC_APB1ENR_SPI3EN;
   SPI3->CR2 |= SPI_CR2_TXDMAEN;
   SPI3->I2SCFGR |= SPI_I2SCFGR_I2SMOD | SPI_I2SCFGR_I2SCFG_1;
-  SPI3->I2SPR &= ~(SPI_I2SPR_I2SDIV);
-  SPI3->I2SPR = (3 << SPI_I2SPR_I2SDIV_Pos) | // 分周比3
-                SPI_I2SPR_ODD |               // 奇数補正
-                SPI_I2SPR_MCKOE;              // MCK出力
-  SPI3->I2SCFGR |= SPI_I2SCFGR_I2SE;
 
-  DMA1_Stream5->CR |= DMA_SxCR_EN;
+  i2s3_start(i2s3_find_rate(UAC2_SAMPLE_RATE_48000));
+}
+
+bool i2s3_is_rate_supported(uint32_t rate) { return i2s3_find_rate(rate); }
+
+// サンプルレート変更。I2SとDMAを止め、PLLI2Sと分周比を設定し直して再開する
+bool i2s3_set_sample_rate(uint32_t rate) {
+  const i2s_rate_config_t *cfg = i2s3_find_rate(rate);
+  if (cfg == NULL) {
+    return false;
+  }
+
+  i2s3_stop();
+  clock_set_plli2s(cfg->plli2s_n, cfg->plli2s_r);
+
+  // 旧レートのサンプルは捨てる（DMAが止まっているのでコンシューマ側で安全）
+  audio_ring_flush(&audio_playback_ring);
+
+  i2s3_start(cfg);
+  LOG_INFO("I2S sample rate: %d Hz (N=%d, R=%d, DIV=%d, ODD=%d)\r\n", rate,
+           cfg->plli2s_n, cfg->plli2s_r, cfg->i2sdiv, cfg->odd);
+  return true;
+}
+
+// サンプル形式変更（16 or 24bit）。I2Sを止めてDATLEN/CHLENとDMAサイズを変える
+bool i2s3_set_format(uint32_t bits) {
+  uint32_t frame_words;
+
+  if (bits == 16) {
+    frame_words = 1;
+  } else if (bits == 24) {
+    frame_words = 2;
+  } else {
+    return false;
+  }
+
+  i2s3_stop();
+  i2s_frame_words = frame_words;
+  audio_ring_set_frame_words(&audio_playback_ring, frame_words);
+  i2s3_start(i2s_rate);
+  LOG_INFO("I2S format: %d bit\r\n", bits);
+  return true;
+}
+
+// DMA 1周期の長さを変える。I2S を止めて循環バッファを組み直す
+bool i2s3_set_period(uint32_t period_us) {
+  if (period_us < I2S_PERIOD_US_MIN || period_us > I2S_PERIOD_US_MAX) {
+    return false;
+  }
+
+  i2s3_stop();
+  i2s_period_us = period_us;
+  i2s3_start(i2s_rate);
+  LOG_INFO("I2S period: %d us (%d frames)\r\n", period_us, i2s_period_frames);
+  return true;
+}
+
+uint32_t i2s3_period_frames(void) { return i2s_period_frames; }
+
+// 各周期を埋めるサンプル源を切り替える（NULL で再生リングに戻す）
+void i2s3_set_source(i2s_source_t source) {
+  i2s_source = source != NULL ? source : i2s3_ring_source;
+}
+
+// 割り込みを止めて循環バッファの内容（無音にしておくこと）を流し続ける。
+// MCK と DMA は動いたままなので再開は割り込みを戻すだけで済む。
+// 停止中は i2s3_frames_played が進まないので、再開後に測り直すこと
+void i2s3_pause(void) {
+  DMA1_Stream5->CR &= ~(DMA_SxCR_HTIE | DMA_SxCR_TCIE);
+}
+
+void i2s3_resume(void) {
+  // 停止中に立ったフラグで補充が走らないよう先に消す
+  DMA1->HIFCR = DMA_HIFCR_CHTIF5 | DMA_HIFCR_CTCIF5;
+  DMA1_Stream5->CR |= DMA_SxCR_HTIE | DMA_SxCR_TCIE;
+}
+
+// DMAがSPI3へ送り出した累計フレーム数（NDTRから1フレーム単位で求める）
+uint32_t i2s3_frames_played(void) {
+  uint32_t frames;
+  uint32_t ndtr;
+  bool tc_pending;
+
+  do {
+    frames = i2s_frames_done;
+    ndtr = DMA1_Stream5->NDTR;
+    tc_pending = DMA1->HISR & DMA_HISR_TCIF5;
+  } while (frames != i2s_frames_done);
+
+  // NDTRはハーフワード数なのでフレーム数に直す
+  uint32_t buffer_frames = 2 * i2s_period_frames;
+  uint32_t remaining = ndtr / (i2s_frame_words * 2);
+
+  // TCが立っているのに割り込みが未処理（優先度の高い割り込みから呼ばれた）
+  if (tc_pending && remaining > i2s_period_frames) {
+    frames += buffer_frames;
+  }
+  return frames + (buffer_frames - remaining);
+}
+
+void DMA1_Stream5_IRQHandler(void) {
+  uint32_t prof_start = prof_begin();
+
+  uint32_t hisr = DMA1->HISR;
+
+  if (hisr & DMA_HISR_HTIF5) {
+    DMA1->HIFCR = DMA_HIFCR_CHTIF5;
+    // 後半を送り出しているので前半を補充する
+    i2s3_refill(i2s_dma_buf);
+  }
+  if (hisr & DMA_HISR_TCIF5) {
+    DMA1->HIFCR = DMA_HIFCR_CTCIF5;
+    i2s_frames_done += 2 * i2s_period_frames;
+    // 先頭に戻って前半を送り出しているので後半を補充する
+    i2s3_refill(&i2s_dma_buf[i2s_period_frames * i2s_frame_words]);
+  }
+
+  prof_end(PROF_I2S_DMA_IRQ, prof_start);
 }
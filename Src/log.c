@@ -1,5 +1,7 @@
 #include "log.h"
+#include "tim.h"
 #include "usart.h"
+#include <stdarg.h>
 
 // 現在のログレベル（デフォルト: INFO）
 log_level_t current_log_level = LOG_INFO;
@@ -10,3 +12,37 @@ void log_set_level(log_level_t level) {
 }
 
 log_level_t log_get_level(void) { return current_log_level; }
+
+// バイナリレコードを1つ組み立てて送信リングに入れる
+void log_binary_write(log_tag_t tag, const char *fmt, uint32_t nargs, ...) {
+  uint8_t rec[8 + LOG_RECORD_MAX_ARGS * 4];
+  uint32_t id = (uint32_t)fmt; // .log_fmt はアドレス0から配置される
+  uint32_t ts = (uint32_t)time_now_us();
+  uint32_t len = 8;
+  va_list args;
+
+  if (nargs > LOG_RECORD_MAX_ARGS) {
+    nargs = LOG_RECORD_MAX_ARGS;
+  }
+
+  rec[0] = LOG_RECORD_SYNC;
+  rec[1] = (tag << 4) | nargs;
+  rec[2] = id & 0xFF;
+  rec[3] = (id >> 8) & 0xFF;
+  rec[4] = ts & 0xFF;
+  rec[5] = (ts >> 8) & 0xFF;
+  rec[6] = (ts >> 16) & 0xFF;
+  rec[7] = (ts >> 24) & 0xFF;
+
+  va_start(args, nargs);
+  for (uint32_t i = 0; i < nargs; i++) {
+    uint32_t v = va_arg(args, uint32_t);
+    rec[len++] = v & 0xFF;
+    rec[len++] = (v >> 8) & 0xFF;
+    rec[len++] = (v >> 16) & 0xFF;
+    rec[len++] = (v >> 24) & 0xFF;
+  }
+  va_end(args);
+
+  usart2_write((const char *)rec, len);
+}
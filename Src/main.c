@@ -4,23 +4,26 @@
 #include "i2c.h"
 #include "i2s.h"
 #include "log.h"
+#include "prof.h"
+#include "sched.h"
 #include "tim.h"
 #include "usart.h"
 #include "usb.h"
 #include "usb_audio.h"
 #include <stm32f411xe.h>
 
-extern uint64_t global_time_us;
-extern uint64_t callback_time_history[CALLBACK_TIME_HISTORY_SIZE];
+// 動作確認用LED (PD15) の点滅
+static void led_blink_task(void) { GPIOD->ODR ^= 1 << GPIO_ODR_OD15_Pos; }
 
 int main(void) {
   clock_init();
+  prof_init();
   gpio_init();
   usart2_init();
   // log_set_level(LOG_DEBUG);
   log_set_level(LOG_INFO);
-  tim2_init();
-  tim3_init();
+  tim5_init();
+  tim2_sof_init();
   i2c1_init();
   cs43l22_init();
   i2s3_init();
@@ -31,12 +34,14 @@ int main(void) {
   printf_usart2("Log level: %d\r\n", log_get_level());
   printf_usart2("--------------------------------\r\n");
 
+  sched_add(led_blink_task, 500000);
+  sched_add(uac2_stream_task, 1000);
+  sched_add(uac2_latency_task, 1000000);
+  sched_add(prof_log, 1000000);
+  sched_add(uac2_log_stream_stats, 1000000);
+  sched_add(usb_log_irq_stats, 1000000);
+
   while (1) {
-    if (global_time_us % 1000000 == 0) {
-      for (uint32_t i = 0; i < CALLBACK_TIME_HISTORY_SIZE; i++) {
-        LOG_INFO("Callback time history[%d]: %d\r\n", i,
-                 callback_time_history[i]);
-      }
-    }
+    sched_run();
   }
 }
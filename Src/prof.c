@@ -0,0 +1,108 @@
+#include "prof.h"
+#include "log.h"
+#include "usart.h"
+#include <stddef.h>
+
+static prof_stats_t prof_stats[PROF_PROBE_COUNT];
+// prof_reset はボトムハーフから呼ばれ、記録中の割り込みより優先度が低い。
+// 統計は記録する側が次の prof_record でクリアする
+static volatile uint8_t prof_reset_pending[PROF_PROBE_COUNT];
+
+static const char *const prof_names[PROF_PROBE_COUNT] = {
+    [PROF_OTG_FS_IRQ] = "otg_fs_irq",
+    [PROF_USB_RXFLVL] = "usb_rxflvl",
+    [PROF_AUDIO_UNPACK] = "audio_unpack",
+    [PROF_I2S_DMA_IRQ] = "i2s_dma_irq",
+    [PROF_USB_BOTTOM_HALF] = "usb_bottom_half",
+    [PROF_AUDIO_RX_DMA] = "audio_rx_dma",
+};
+
+// DWT のサイクルカウンタを有効にする
+void prof_init(void) {
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+  prof_reset();
+}
+
+static void prof_clear(prof_stats_t *s) {
+  s->count = 0;
+  s->min = UINT32_MAX;
+  s->max = 0;
+  s->sum = 0;
+  for (uint32_t i = 0; i < PROF_HIST_BINS; i++) {
+    s->hist[i] = 0;
+  }
+}
+
+void prof_reset(void) {
+  for (uint32_t p = 0; p < PROF_PROBE_COUNT; p++) {
+    prof_reset_pending[p] = 1;
+  }
+}
+
+uint32_t prof_hist_bin(uint32_t cycles) {
+  uint32_t bin = cycles ? 32 - __CLZ(cycles) : 0;
+  return bin < PROF_HIST_BINS ? bin : PROF_HIST_BINS - 1;
+}
+
+// 各プローブは1つの割り込みからしか記録しないのでロックは不要
+void prof_record(prof_probe_t probe, uint32_t cycles) {
+  prof_stats_t *s = &prof_stats[probe];
+
+  if (prof_reset_pending[probe]) {
+    prof_clear(s);
+    prof_reset_pending[probe] = 0;
+  }
+  s->count++;
+  s->sum += cycles;
+  if (cycles < s->min) {
+    s->min = cycles;
+  }
+  if (cycles > s->max) {
+    s->max = cycles;
+  }
+  s->hist[prof_hist_bin(cycles)]++;
+}
+
+const prof_stats_t *prof_get(prof_probe_t probe) {
+  return probe < PROF_PROBE_COUNT ? &prof_stats[probe] : NULL;
+}
+
+const char *prof_name(prof_probe_t probe) {
+  return probe < PROF_PROBE_COUNT ? prof_names[probe] : "?";
+}
+
+// PROF_EXPORT_WORDS 個のワードを dst に書き出す。書いたバイト数を返す
+// リセット後まだ記録のないプローブはすべて 0 になる
+uint32_t prof_export(prof_probe_t probe, uint32_t *dst) {
+  static const prof_stats_t empty = {0};
+  const prof_stats_t *s = prof_get(probe);
+  if (s == NULL) {
+    return 0;
+  }
+  if (prof_reset_pending[probe]) {
+    s = &empty;
+  }
+
+  dst[0] = s->count;
+  dst[1] = s->count ? s->min : 0;
+  dst[2] = s->max;
+  dst[3] = (uint32_t)s->sum;
+  dst[4] = (uint32_t)(s->sum >> 32);
+  for (uint32_t i = 0; i < PROF_HIST_BINS; i++) {
+    dst[5 + i] = s->hist[i];
+  }
+  return PROF_EXPORT_WORDS * 4;
+}
+
+void prof_log(void) {
+  for (uint32_t p = 0; p < PROF_PROBE_COUNT; p++) {
+    const prof_stats_t *s = &prof_stats[p];
+    if (s->count == 0 || prof_reset_pending[p]) {
+      continue;
+    }
+    LOG_INFO("prof %s: n=%d min=%d max=%d mean=%d cycles\r\n", prof_names[p],
+             s->count, s->min, s->max, (uint32_t)(s->sum / s->count));
+  }
+}
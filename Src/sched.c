@@ -0,0 +1,44 @@
+#include "sched.h"
+#include "tim.h"
+#include <stddef.h>
+
+typedef struct {
+  sched_task_fn fn;
+  uint32_t period_us;
+  uint64_t next_us;
+} sched_task_t;
+
+static sched_task_t sched_tasks[SCHED_MAX_TASKS];
+static uint32_t sched_task_count = 0;
+
+// 周期タスクを登録する。最初の実行は1周期後
+bool sched_add(sched_task_fn fn, uint32_t period_us) {
+  if (fn == NULL || period_us == 0 || sched_task_count >= SCHED_MAX_TASKS) {
+    return false;
+  }
+
+  sched_task_t *task = &sched_tasks[sched_task_count++];
+  task->fn = fn;
+  task->period_us = period_us;
+  task->next_us = time_now_us() + period_us;
+  return true;
+}
+
+// 期限の来たタスクを実行する（メインループから呼ぶ）
+void sched_run(void) {
+  for (uint32_t i = 0; i < sched_task_count; i++) {
+    sched_task_t *task = &sched_tasks[i];
+    uint64_t now = time_now_us();
+
+    if (now < task->next_us) {
+      continue;
+    }
+
+    // 位相を保って次回時刻を進める。大きく遅れた場合は追いつかせずに飛ばす
+    task->next_us += task->period_us;
+    if (task->next_us <= now) {
+      task->next_us = now + task->period_us;
+    }
+    task->fn();
+  }
+}
@@ -1,38 +1,138 @@
 #include "tim.h"
 #include <stm32f411xe.h>
 
-uint64_t global_time_us = 0;
+// TIM2 は SYSCLK と同じ 96MHz でフリーランし、OTG FS の SOF パルス（ITR1）で
+// CCR1 にラッチする。割り込み遅延に関係なくSOFの時刻が取れる
+static uint32_t sof_stamp = 0;
+static uint32_t sof_period = 0;
+static bool sof_stamp_valid = false;
+static uint32_t sof_history[TIM2_SOF_AVG_FRAMES];
+static uint32_t sof_history_index = 0;
+static uint32_t sof_history_count = 0;
+static uint32_t sof_period_sum = 0;
+static uint32_t sof_overcapture = 0;
 
-void tim2_init(void) {
+// TIM5 (32bit) を 1MHz でフリーランさせ、オーバーフロー回数で上位32bitを作る
+static volatile uint32_t tim5_overflow = 0;
+
+void tim5_init(void) {
+  RCC->APB1ENR |= RCC_APB1ENR_TIM5EN;
+  TIM5->PSC = 96 - 1; // タイマクロック 96MHz → 1MHz
+  TIM5->ARR = 0xFFFFFFFF;
+  TIM5->CR1 |= TIM_CR1_URS; // UGで更新割り込みを出さない
+  TIM5->EGR = TIM_EGR_UG;   // PSCを即時反映
+  TIM5->SR = 0;
+  TIM5->DIER |= TIM_DIER_UIE;
+  NVIC_SetPriority(TIM5_IRQn, 0);
+  NVIC_EnableIRQ(TIM5_IRQn);
+  TIM5->CR1 |= TIM_CR1_CEN;
+}
+
+// 起動からの経過時間[us]。どのコンテキストから呼んでもよい
+uint64_t time_now_us(void) {
+  uint32_t hi;
+  uint32_t cnt;
+  uint32_t sr;
+
+  // 読んでいる間にオーバーフロー割り込みが入ったら読み直す
+  do {
+    hi = tim5_overflow;
+    cnt = TIM5->CNT;
+    sr = TIM5->SR;
+  } while (hi != tim5_overflow);
+
+  // 割り込みが未処理のオーバーフロー（割り込み禁止中や同優先度から呼ばれた）
+  // CNTが小さければラップ後に読んだ値なので上位を1つ進める
+  if ((sr & TIM_SR_UIF) && cnt < 0x80000000) {
+    hi++;
+  }
+  return ((uint64_t)hi << 32) | cnt;
+}
+
+void TIM5_IRQHandler(void) {
+  if (TIM5->SR & TIM_SR_UIF) {
+    TIM5->SR &= ~TIM_SR_UIF;
+    tim5_overflow++;
+  }
+}
+
+void tim2_sof_init(void) {
   RCC->APB1ENR |= RCC_APB1ENR_TIM2EN;
-  TIM2->PSC = 9600;
-  TIM2->ARR = 5000;
-  TIM2->DIER |= TIM_DIER_UIE;
-  NVIC_SetPriority(TIM2_IRQn, 2);
-  NVIC_EnableIRQ(TIM2_IRQn);
+  TIM2->PSC = 0; // タイマクロック 96MHz (APB1 48MHz x2) = SYSCLK
+  TIM2->ARR = 0xFFFFFFFF;
+  TIM2->OR = (TIM2->OR & ~TIM_OR_ITR1_RMP) | TIM_OR_ITR1_RMP_1; // ITR1 = SOF
+  TIM2->SMCR = (TIM2->SMCR & ~TIM_SMCR_TS) | TIM_SMCR_TS_0;    // TRGI = ITR1
+  TIM2->CCMR1 = (TIM2->CCMR1 & ~TIM_CCMR1_CC1S) | TIM_CCMR1_CC1S; // IC1 = TRC
+  TIM2->CCER |= TIM_CCER_CC1E;
+  TIM2->EGR = TIM_EGR_UG;
+  TIM2->SR = 0;
   TIM2->CR1 |= TIM_CR1_CEN;
-}
 
-void tim3_init(void) {
-  RCC->APB1ENR |= RCC_APB1ENR_TIM3EN;
-  TIM3->PSC = 96;
-  TIM3->ARR = 50;
-  TIM3->DIER |= TIM_DIER_UIE;
-  NVIC_SetPriority(TIM3_IRQn, 2);
-  NVIC_EnableIRQ(TIM3_IRQn);
-  TIM3->CR1 |= TIM_CR1_CEN;
+  sof_stamp_valid = false;
+  sof_history_index = 0;
+  sof_history_count = 0;
+  sof_period_sum = 0;
+  for (uint32_t i = 0; i < TIM2_SOF_AVG_FRAMES; i++) {
+    sof_history[i] = 0;
+  }
 }
 
-void TIM2_IRQHandler(void) {
-  if (TIM2->SR & TIM_SR_UIF) {
-    TIM2->SR &= ~TIM_SR_UIF;
-    GPIOD->ODR ^= 1 << GPIO_ODR_OD15_Pos;
+// SOF割り込みから毎フレーム呼ぶ。新しいSOF周期[tick]を返す（無効なら0）
+uint32_t tim2_sof_capture(void) {
+  uint32_t sr = TIM2->SR;
+  uint32_t stamp;
+  uint32_t period;
+
+  if (!(sr & TIM_SR_CC1IF)) {
+    return 0; // まだラッチされていない
+  }
+  stamp = TIM2->CCR1; // CCR1 を読むと CC1IF はクリアされる
+
+  if (sr & TIM_SR_CC1OF) {
+    // 読み損ねたSOFがある（間隔が2フレーム以上）ので平均に入れない
+    TIM2->SR = (uint16_t)~TIM_SR_CC1OF;
+    sof_overcapture++;
+    sof_stamp = stamp;
+    return 0;
+  }
+  if (!sof_stamp_valid) {
+    sof_stamp_valid = true;
+    sof_stamp = stamp;
+    return 0;
+  }
+
+  period = stamp - sof_stamp;
+  sof_stamp = stamp;
+  sof_period = period;
+
+  sof_period_sum += period - sof_history[sof_history_index];
+  sof_history[sof_history_index] = period;
+  sof_history_index = (sof_history_index + 1) & (TIM2_SOF_AVG_FRAMES - 1);
+  if (sof_history_count < TIM2_SOF_AVG_FRAMES) {
+    sof_history_count++;
   }
+  return period;
 }
 
-void TIM3_IRQHandler(void) {
-  if (TIM3->SR & TIM_SR_UIF) {
-    TIM3->SR &= ~TIM_SR_UIF;
-    global_time_us += 50;
+// 直近のSOFをラッチした時の TIM2 カウント
+uint32_t tim2_sof_stamp(void) { return sof_stamp; }
+
+// 直近のSOF周期[tick]
+uint32_t tim2_sof_period(void) { return sof_period; }
+
+// 直近 TIM2_SOF_AVG_FRAMES フレームの周期の和（= 平均 << TIM2_SOF_AVG_SHIFT）
+uint32_t tim2_sof_period_sum(void) {
+  if (sof_history_count == 0) {
+    return 0;
   }
+  if (sof_history_count < TIM2_SOF_AVG_FRAMES) {
+    // 埋まるまでは平均を同じスケールに直す
+    return (uint32_t)(((uint64_t)sof_period_sum << TIM2_SOF_AVG_SHIFT) /
+                      sof_history_count);
+  }
+  return sof_period_sum;
 }
+
+uint32_t tim2_sof_overcapture_count(void) { return sof_overcapture; }
+
+uint32_t tim2_now(void) { return TIM2->CNT; }
@@ -1,27 +1,148 @@
+#include "usart.h"
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stm32f411xe.h>
 
-#define USART_TX_BUF_SIZE 256
-char usart_tx_buf[USART_TX_BUF_SIZE];
+_Static_assert((USART_TX_RING_SIZE & (USART_TX_RING_SIZE - 1)) == 0 &&
+                   USART_TX_RING_SIZE <= 0x10000,
+               "USART_TX_RING_SIZE must be a power of two <= 65536");
+
+#define USART_TX_MASK (USART_TX_RING_SIZE - 1)
+
+// 複数プロデューサ（メインループと各割り込み）→ DMA1 Stream6 のリング
+// インデックスは16bitで単調増加させ、USART_TX_MASK でマスクする
+//   tx_state:  下位16bit = 予約位置, 上位16bit = 書き込み中のプロデューサ数
+//   tx_commit: DMAに渡してよい位置（最後に書き終えたプロデューサが進める）
+//   tx_tail:   DMAが送り終えた位置（DMA完了割り込みのみ更新）
+static char tx_buf[USART_TX_RING_SIZE];
+static _Atomic uint32_t tx_state = 0;
+static _Atomic uint32_t tx_commit = 0;
+static volatile uint32_t tx_tail = 0;
+static volatile uint32_t tx_dma_len = 0;
+static atomic_flag tx_dma_busy = ATOMIC_FLAG_INIT;
+static _Atomic uint32_t tx_drop_count = 0;
+
+#define TX_INDEX(state) ((state) & 0xFFFF)
+#define TX_WRITERS(state) ((state) >> 16)
+
+// DMAが止まっていれば tail から commit まで（折り返しまで）を送り出す
+static void usart2_tx_kick(void) {
+  if (atomic_flag_test_and_set(&tx_dma_busy)) {
+    return; // 送信中。完了割り込みが続きを送る
+  }
+
+  uint32_t tail = tx_tail;
+  uint32_t len = (atomic_load(&tx_commit) - tail) & 0xFFFF;
+  uint32_t contiguous = USART_TX_RING_SIZE - (tail & USART_TX_MASK);
+
+  if (len == 0) {
+    atomic_flag_clear(&tx_dma_busy);
+    return;
+  }
+  if (len > contiguous) {
+    len = contiguous;
+  }
+
+  tx_dma_len = len;
+  DMA1->HIFCR = DMA_HIFCR_CTCIF6 | DMA_HIFCR_CHTIF6 | DMA_HIFCR_CTEIF6 |
+                DMA_HIFCR_CDMEIF6 | DMA_HIFCR_CFEIF6;
+  DMA1_Stream6->M0AR = (uint32_t)&tx_buf[tail & USART_TX_MASK];
+  DMA1_Stream6->NDTR = len;
+  DMA1_Stream6->CR |= DMA_SxCR_EN;
+}
+
+// commit を target まで進める。後から来た小さい値で巻き戻さない
+static void usart2_tx_publish(uint32_t target) {
+  uint32_t commit = atomic_load(&tx_commit);
+
+  while ((int16_t)(target - commit) > 0) {
+    if (atomic_compare_exchange_weak(&tx_commit, &commit, target & 0xFFFF)) {
+      break;
+    }
+  }
+}
 
 void usart2_init(void) {
   RCC->APB1ENR |= RCC_APB1ENR_USART2EN;
+  RCC->AHB1ENR |= RCC_AHB1ENR_DMA1EN;
   USART2->BRR = SystemCoreClock / 2 / 115200;
+  USART2->CR3 |= USART_CR3_DMAT;
   USART2->CR1 |= USART_CR1_UE | USART_CR1_TE;
+
+  // DMA1 Stream6 Channel4 = USART2_TX, バイト転送
+  DMA1_Stream6->CR = (4 << DMA_SxCR_CHSEL_Pos) | DMA_SxCR_MINC |
+                     DMA_SxCR_DIR_0 | DMA_SxCR_TCIE;
+  DMA1_Stream6->PAR = (uint32_t)&USART2->DR;
+  NVIC_SetPriority(DMA1_Stream6_IRQn, 3);
+  NVIC_EnableIRQ(DMA1_Stream6_IRQn);
+}
+
+// どのコンテキストからでも呼べる。ブロックせず、入り切らなければ捨てる
+void usart2_write(const char *data, uint32_t len) {
+  uint32_t state = atomic_load(&tx_state);
+  uint32_t start;
+
+  if (len == 0) {
+    return;
+  }
+
+  // 予約: 位置を進めて書き込み中のプロデューサ数を増やす
+  do {
+    start = TX_INDEX(state);
+    uint32_t used = (start - tx_tail) & 0xFFFF;
+    if (len > USART_TX_RING_SIZE - used) {
+      atomic_fetch_add(&tx_drop_count, 1);
+      return;
+    }
+  } while (!atomic_compare_exchange_weak(
+      &tx_state, &state,
+      ((TX_WRITERS(state) + 1) << 16) | ((start + len) & 0xFFFF)));
+
+  for (uint32_t i = 0; i < len; i++) {
+    tx_buf[(start + i) & USART_TX_MASK] = data[i];
+  }
+
+  // 完了: 最後に抜けるプロデューサが予約済みの位置まで公開する
+  state = atomic_load(&tx_state);
+  while (!atomic_compare_exchange_weak(&tx_state, &state,
+                                       state - (1 << 16))) {
+  }
+  if (TX_WRITERS(state) == 1) {
+    usart2_tx_publish(TX_INDEX(state));
+  }
+
+  usart2_tx_kick();
 }
 
 void printf_usart2(const char *fmt, ...) {
+  char line[USART_TX_LINE_MAX];
   va_list args;
-  uint16_t len;
+  int len;
+
   va_start(args, fmt);
-  len = vsnprintf(usart_tx_buf, USART_TX_BUF_SIZE, fmt, args);
+  len = vsnprintf(line, sizeof(line), fmt, args);
   va_end(args);
-  for (uint16_t i = 0; i < len; i++) {
-    while (!(USART2->SR & USART_SR_TXE))
-      ;
-    USART2->DR = usart_tx_buf[i];
+
+  if (len < 0) {
+    return;
+  }
+  if (len >= (int)sizeof(line)) {
+    len = sizeof(line) - 1; // 切り詰めて送る
+  }
+  usart2_write(line, len);
+}
+
+// リングが一杯で捨てたメッセージ数
+uint32_t usart2_get_drop_count(void) { return atomic_load(&tx_drop_count); }
+
+void DMA1_Stream6_IRQHandler(void) {
+  if (DMA1->HISR & DMA_HISR_TCIF6) {
+    DMA1->HIFCR = DMA_HIFCR_CTCIF6;
+    tx_tail = (tx_tail + tx_dma_len) & 0xFFFF;
+    atomic_flag_clear(&tx_dma_busy);
+    usart2_tx_kick();
   }
 }
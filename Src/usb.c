@@ -1,8 +1,17 @@
+// 制御転送ごとに DEBUG が十数行出て UART と割り込みの時間を食うので,
+// usb.c は Debug ビルドでも INFO までにする
+#define LOG_MODULE_LEVEL LOG_LEVEL_INFO
+
 #include "usb.h"
+#include "audio_conceal.h"
 #include "log.h"
+#include "prof.h"
 #include "usart.h"
 #include "usb_audio.h"
+#include "usb_ctrl.h"
 #include "usb_desc.h"
+#include "usb_evq.h"
+#include "usb_fifo.h"
 #include <stddef.h>
 #include <stdint.h>
 #include <stm32f411xe.h>
@@ -15,6 +24,49 @@
 #define PKTSTS_OUT_HALT 0x05          // OUT転送でSTALL受信
 #define PKTSTS_SETUP_RECEIVED 0x06    // SETUPデータパケット受信
 
+// FIFO RAM割り当て（ワード単位）。共有FIFO RAMは 1.25KB = 320ワード
+#define USB_FIFO_RAM_WORDS 320
+#define USB_BYTES_TO_WORDS(bytes) (((bytes) + 3) / 4)
+
+// IN エンドポイントごとの TX FIFO: X(エンドポイント番号, 最大パケットサイズ)
+// EP0 を先頭に番号順で並べる。IN エンドポイントを足すときはここに追加する
+//   EP0: 制御（64バイト）
+//   EP1: フィードバック（10.14形式, 3バイト）
+#define USB_IN_EP_FIFOS(X) X(0, 64) X(1, 3)
+
+// OUT エンドポイント数（EP0 を含む）
+#define USB_OUT_EP_COUNT 2
+
+// TX FIFO は最大パケット分, ただし最小16ワード
+#define USB_TX_FIFO_WORDS(mps)                                                 \
+  (USB_BYTES_TO_WORDS(mps) < 16 ? 16 : USB_BYTES_TO_WORDS(mps))
+
+// RX FIFO は全 OUT エンドポイントで共有（RM0383 22.11.3）
+//   SETUP: 制御エンドポイント1つにつき 5ワード + 8ワード
+//   データ: 最大パケット（96kHz, 32bitスロットの iso）+ ステータス1ワード
+//   転送完了: OUT エンドポイント1つにつき 2ワード, グローバル OUT NAK 1ワード
+// フルスピードの iso OUT は1フレーム1パケットなので、1パケット分あれば
+// 次の SOF までに取り出せる
+#define USB_RX_FIFO_WORDS                                                      \
+  ((5 * 1 + 8) + (USB_BYTES_TO_WORDS(AUDIO_EP_MAX_PACKET_SIZE) + 1) +          \
+   (2 * USB_OUT_EP_COUNT) + 1)
+
+#define USB_TX_FIFO_SUM(ep, mps) +USB_TX_FIFO_WORDS(mps)
+#define USB_FIFO_USED_WORDS (USB_RX_FIFO_WORDS USB_IN_EP_FIFOS(USB_TX_FIFO_SUM))
+
+_Static_assert(USB_FIFO_USED_WORDS <= USB_FIFO_RAM_WORDS,
+               "USB FIFO layout exceeds the 1.25KB FIFO RAM");
+_Static_assert(USB_RX_FIFO_WORDS >= 16, "RX FIFO must be at least 16 words");
+
+typedef struct {
+  uint8_t ep;
+  uint16_t words;
+} usb_tx_fifo_t;
+
+#define USB_TX_FIFO_ENTRY(ep, mps) {(ep), USB_TX_FIFO_WORDS(mps)},
+static const usb_tx_fifo_t usb_tx_fifos[] = {
+    USB_IN_EP_FIFOS(USB_TX_FIFO_ENTRY)};
+
 extern const USB_DeviceDescriptor device_descriptor;
 extern const UAC2_ConfigurationDescriptor configuration_descriptor;
 extern const USB_DeviceQualifierDescriptor device_qualifier_descriptor;
@@ -24,38 +76,68 @@ extern const uint8_t string_product_descriptor[];
 
 // 関数宣言（変更なし）
 static void usb_read_packet(uint8_t *dest, uint32_t bcnt);
-static void usb_handle_setup(uint32_t epnum);
 static void usb_handle_rxflvl(void);
 static void usb_process_setup(USB_SetupPacket *setup);
 static void usb_send_contorl_packet(void);
 static void usb_write_packet(uint8_t epnum, uint8_t *src, uint16_t len);
-static void usb_get_device_descriptor(uint8_t **desc_data,
-                                      uint16_t *desc_length);
-static void usb_get_configuration_descriptor(uint8_t **desc_data,
-                                             uint16_t *desc_length);
-static void usb_process_get_descriptor(USB_SetupPacket *setup);
-static void usb_process_standard_request(USB_SetupPacket *setup);
 static void usb_process_set_address(USB_SetupPacket *setup);
 static void usb_prepare_ep0_out_status(void);
-static void usb_process_audio_request(USB_SetupPacket *setup);
 static void usb_cofig_audio_endpoint(void);
+static void usb_register_requests(void);
+static void usb_handle_ep0_in_complete(void);
+static void usb_handle_ep0_out_complete(void);
 // static void debug_descriptor_content(void);
 // static void debug_raw_descriptors(void);
 
+// 1回の割り込みで GINTSTS を処理し直す最大回数と, 1パスで取り出す
+// GRXSTSP エントリの最大数
+#define USB_IRQ_PASS_BUDGET 4
+#define USB_IRQ_RX_BUDGET 8
+
+volatile USB_IrqStats usb_irq_stats = {0};
+
+// トップハーフからボトムハーフへのイベントキュー
+static usb_evq_t usb_event_queue;
+
+// 制御OUTデータステージの受信バッファ
+static uint8_t usb_control_out_buf[USB_CONTROL_OUT_MAX]
+    __attribute__((aligned(4)));
+static uint16_t usb_control_out_last_len = 0;
+
+// RX FIFO を先頭に置き, その後ろへ TX FIFO を usb_tx_fifos の順に詰める
+static void usb_fifo_init(void) {
+  uint32_t offset = USB_RX_FIFO_WORDS;
+
+  USB_OTG_FS->GRXFSIZ = USB_RX_FIFO_WORDS;
+  for (uint32_t i = 0; i < sizeof(usb_tx_fifos) / sizeof(usb_tx_fifos[0]);
+       i++) {
+    uint32_t fifo = ((uint32_t)usb_tx_fifos[i].words << USB_OTG_TX0FD_Pos) |
+                    offset;
+    if (usb_tx_fifos[i].ep == 0) {
+      USB_OTG_FS->DIEPTXF0_HNPTXFSIZ = fifo;
+    } else {
+      USB_OTG_FS->DIEPTXF[usb_tx_fifos[i].ep - 1] = fifo;
+    }
+    offset += usb_tx_fifos[i].words;
+  }
+}
+
 static void usb_core_reset(void) {
-  USB_OTG_FS->GRSTCTL |= USB_OTG_GRSTCTL_CSRST;
-  while (USB_OTG_FS->GRSTCTL & USB_OTG_GRSTCTL_CSRST)
+  usb_reg_write(&USB_OTG_FS->GRSTCTL,
+                USB_OTG_FS->GRSTCTL | USB_OTG_GRSTCTL_CSRST);
+  while (usb_reg_read(&USB_OTG_FS->GRSTCTL) & USB_OTG_GRSTCTL_CSRST)
     ;
 }
 
 void usb_init(void) {
   RCC->AHB2ENR |= RCC_AHB2ENR_OTGFSEN;
   usb_core_reset();
-  USB_OTG_FS->GCCFG |= USB_OTG_GCCFG_PWRDWN | USB_OTG_GCCFG_VBUSBSEN;
+  // SOFOUTEN: SOFパルスを TIM2 ITR1 へ出す
+  USB_OTG_FS->GCCFG |= USB_OTG_GCCFG_PWRDWN | USB_OTG_GCCFG_VBUSBSEN |
+                       USB_OTG_GCCFG_SOFOUTEN;
   USB_OTG_FS->GUSBCFG |= USB_OTG_GUSBCFG_FDMOD;
 
-  USB_OTG_FS->GRXFSIZ = 256;
-  USB_OTG_FS->DIEPTXF0_HNPTXFSIZ = (64 << USB_OTG_HPTXFSIZ_PTXFD_Pos) | 256;
+  usb_fifo_init();
   // デバイススピード設定
   USB_DEVICE->DCFG |= USB_OTG_DCFG_DSPD; // Full Speed (11)
 
@@ -66,15 +148,22 @@ void usb_init(void) {
   usb_cofig_audio_endpoint();
 
   USB_OTG_FS->GINTMSK |= USB_OTG_GINTMSK_USBRST | USB_OTG_GINTMSK_RXFLVLM |
-                         USB_OTG_GINTMSK_IEPINT | USB_OTG_GINTMSK_OEPINT;
+                         USB_OTG_GINTMSK_IEPINT | USB_OTG_GINTMSK_OEPINT |
+                         USB_OTG_GINTMSK_SOFM |
+                         USB_OTG_GINTMSK_PXFRM_IISOOXFRM;
   USB_OTG_FS->GAHBCFG |= USB_OTG_GAHBCFG_GINT;
   USB_DEVICE->DIEPMSK |= USB_OTG_DIEPMSK_XFRCM;
   USB_DEVICE->DOEPMSK |= USB_OTG_DOEPMSK_XFRCM;
+  usb_evq_init(&usb_event_queue);
+  // ボトムハーフは最低優先度で、他の割り込みを一切遅らせない
+  NVIC_SetPriority(PendSV_IRQn, 15);
   NVIC_SetPriority(OTG_FS_IRQn, 0);
   NVIC_EnableIRQ(OTG_FS_IRQn);
 
   USB_DEVICE->DCTL &= ~USB_OTG_DCTL_SDIS;
 
+  usb_ctrl_reset();
+  usb_register_requests();
   uac2_init();
 }
 
@@ -88,141 +177,47 @@ USB_ControlState usb_control_state = {
 };
 
 static void usb_cofig_audio_endpoint(void) {
-  USB_OUTEP[1].DOEPCTL = USB_OTG_DOEPCTL_USBAEP | USB_OTG_DOEPCTL_EPTYP_0 |
-                         (192 << USB_OTG_DOEPCTL_MPSIZ_Pos);
-  USB_OTG_FS->DIEPTXF[0] = (192 << USB_OTG_DTXFSTS_INEPTFSAV_Pos) | 256;
-}
-
-static void usb_get_device_descriptor(uint8_t **desc_data,
-                                      uint16_t *desc_length) {
-  if (desc_data == NULL || desc_length == NULL) {
-    LOG_ERROR("NULL pointer in usb_get_device_descriptor\r\n");
-    return;
-  }
-
-  *desc_data = (uint8_t *)&device_descriptor;
-  *desc_length = sizeof(USB_DeviceDescriptor); // 固定サイズを使用
-
-  LOG_INFO("Device descriptor: addr=0x%08X, size=%d\r\n", (uint32_t)*desc_data,
-           *desc_length);
-}
-
-static void usb_get_configuration_descriptor(uint8_t **desc_data,
-                                             uint16_t *desc_length) {
-  if (desc_data == NULL || desc_length == NULL) {
-    LOG_ERROR("NULL pointer in usb_get_configuration_descriptor\r\n");
-    return;
-  }
-
-  *desc_data = (uint8_t *)&configuration_descriptor;
-  *desc_length = sizeof(UAC2_ConfigurationDescriptor);
-
-  LOG_INFO("Config descriptor: addr=0x%08X, size=%d\r\n", (uint32_t)*desc_data,
-           *desc_length);
-}
-
-static void usb_get_device_qualifier_descriptor(uint8_t **desc_data,
-                                                uint16_t *desc_length) {
-  if (desc_data == NULL || desc_length == NULL) {
-    LOG_ERROR("NULL pointer in usb_get_device_qualifier_descriptor\r\n");
-    return;
-  }
-
-  *desc_data = (uint8_t *)&device_qualifier_descriptor;
-  *desc_length = sizeof(USB_DeviceQualifierDescriptor); // 固定サイズを使用
+  USB_OUTEP[1].DOEPCTL =
+      USB_OTG_DOEPCTL_USBAEP | USB_OTG_DOEPCTL_EPTYP_0 |
+      (AUDIO_EP_MAX_PACKET_SIZE << USB_OTG_DOEPCTL_MPSIZ_Pos);
 }
 
-static void usb_get_string_descriptor(uint8_t **desc_data,
-                                      uint16_t *desc_length,
-                                      const uint8_t *string_descriptor) {
-  *desc_data = (uint8_t *)string_descriptor;
-  *desc_length = sizeof(string_descriptor);
+void usb_flush_tx_fifo(uint8_t fifo_num) {
+  usb_reg_write(&USB_OTG_FS->GRSTCTL,
+                USB_OTG_GRSTCTL_TXFFLSH |
+                    ((uint32_t)fifo_num << USB_OTG_GRSTCTL_TXFNUM_Pos));
+  while (usb_reg_read(&USB_OTG_FS->GRSTCTL) & USB_OTG_GRSTCTL_TXFFLSH)
+    ;
 }
 
-static void usb_process_get_descriptor(USB_SetupPacket *setup) {
-  LOG_INFO("GET_DESCRIPTOR: Type=0x%02X, Index=0x%02X, Length=%d\r\n",
-           (setup->wValue >> 8) & 0xFF, setup->wValue & 0xFF, setup->wLength);
-
-  uint8_t desc_type = (setup->wValue >> 8) & 0xff;
-  uint8_t desc_index = setup->wValue & 0xff;
-  uint16_t desc_length = 0; // 実際のディスクリプタサイズ
-  uint8_t *desc_data = NULL;
-
-  switch (desc_type) {
-  case 0x01:
-    // DEVICE_DESCRIPTOR
-    LOG_INFO("Requesting device descriptor\r\n");
-    usb_get_device_descriptor(&desc_data, &desc_length);
-    break;
-
-  case 0x02:
-    // CONFIGURATION_DESCRIPTOR
-    LOG_INFO("Requesting configuration descriptor\r\n");
-    usb_get_configuration_descriptor(&desc_data, &desc_length);
-    break;
-
-  case 0x03: // STRING_DESCRIPTOR
-    LOG_INFO("Requesting string descriptor %d\r\n", desc_index);
-    switch (desc_index) {
-    case 0:
-      desc_data = (uint8_t *)string_lang_descriptor;
-      desc_length = string_lang_descriptor[0];
-      LOG_INFO("String 0: bLength=%d\r\n", string_lang_descriptor[0]);
-      break;
-
-    case 1:
-      desc_data = (uint8_t *)string_manufacturer_descriptor;
-      desc_length = string_manufacturer_descriptor[0];
-      LOG_INFO("String 1: bLength=%d\r\n", string_manufacturer_descriptor[0]);
-      break;
-
-    case 2:
-      desc_data = (uint8_t *)string_product_descriptor;
-      desc_length = string_product_descriptor[0]; // bLengthフィールドから取得
-
-      // デバッグ：実際の長さを確認
-      LOG_INFO("String 2: descriptor says length=%d, setup requests=%d\r\n",
-               desc_length, setup->wLength);
-
-      // 要求されたサイズが記述子サイズより大きい場合は記述子サイズに制限
-      if (setup->wLength > desc_length) {
-        LOG_WARN("Requested size (%d) > descriptor size (%d), limiting\r\n",
-                 setup->wLength, desc_length);
+// EP1 はトップハーフ（XFRC/SOF/IISOOXFR）が EONUM を書き換えて再アームする。
+// ボトムハーフから DOEPCTL/DIEPCTL を読み書きする間は OTG 割り込みを止める
+// 送信中なら IN エンドポイントを止め（TX FIFO 番号はエンドポイント番号と
+// 同じ）, FIFO を空にする。USB_EPDIS_SPINS 回待っても止まらなければ false
+bool usb_in_ep_disable(uint8_t ep) {
+  if (USB_INEP[ep].DIEPCTL & USB_OTG_DIEPCTL_EPENA) {
+    uint32_t spins = USB_EPDIS_SPINS;
+
+    USB_INEP[ep].DIEPCTL |= USB_OTG_DIEPCTL_SNAK | USB_OTG_DIEPCTL_EPDIS;
+    while (!(usb_reg_read(&USB_INEP[ep].DIEPINT) & USB_OTG_DIEPINT_EPDISD)) {
+      if (--spins == 0) {
+        return false;
       }
-      break;
-
-    default:
-      LOG_WARN("Invalid string descriptor index: %d\r\n", desc_index);
-      usb_control_stall();
-      return;
     }
-    break;
-
-  case 0x06:
-    // DEVICE_QUALIFIER_DESCRIPTOR
-    LOG_INFO("Requesting device qualifier descriptor\r\n");
-    usb_get_device_qualifier_descriptor(&desc_data, &desc_length);
-    break;
-
-  default:
-    LOG_WARN("UNKNOWN DESCRIPTOR TYPE: 0x%02X\r\n", desc_type);
-    usb_control_stall();
-    return;
+    usb_reg_write(&USB_INEP[ep].DIEPINT, USB_OTG_DIEPINT_EPDISD);
   }
+  usb_flush_tx_fifo(ep);
+  return true;
+}
 
-  if (desc_data != NULL && desc_length > 0) {
-    // 要求されたサイズと実際のサイズの小さい方を送信
-    uint16_t send_length =
-        (setup->wLength < desc_length) ? setup->wLength : desc_length;
-    LOG_INFO("Sending %d bytes of descriptor (requested: %d, actual: %d)\r\n",
-             send_length, setup->wLength, desc_length);
-    usb_control_send_data(desc_data, send_length);
-  } else {
-    LOG_ERROR("ERROR: No descriptor data to send\r\n");
-    usb_control_stall();
-  }
+void usb_ep_lock(void) {
+  NVIC_DisableIRQ(OTG_FS_IRQn);
+  __DSB();
+  __ISB();
 }
 
+void usb_ep_unlock(void) { NVIC_EnableIRQ(OTG_FS_IRQn); }
+
 void usb_control_stall(void) {
   LOG_INFO("Control STALL\r\n");
   USB_INEP[0].DIEPCTL |= USB_OTG_DIEPCTL_STALL;
@@ -239,7 +234,7 @@ void usb_control_send_data(uint8_t *data, uint16_t length) {
 
   if (length == 0) {
     // ZLP送信の場合（SET_ADDRESSなど）
-    LOG_INFO("Sending ZLP (Zero Length Packet)\r\n");
+    LOG_DEBUG("Sending ZLP (Zero Length Packet)\r\n");
     usb_write_packet(0, NULL, 0);
   } else if (data == NULL) {
     // データがあるのにポインタがNULLの場合はエラー
@@ -247,12 +242,79 @@ void usb_control_send_data(uint8_t *data, uint16_t length) {
     usb_control_stall();
     return;
   } else {
-    LOG_INFO("Control send data: length=%d, buffer=0x%08X\r\n", length,
+    LOG_DEBUG("Control send data: length=%d, buffer=0x%08X\r\n", length,
              (uint32_t)data);
     usb_send_contorl_packet();
   }
 }
 
+// EP0 OUTを最大パケット1つ分受信できるようにする
+static void usb_prepare_ep0_out_data(void) {
+  USB_OUTEP[0].DOEPTSIZ = (1 << USB_OTG_DOEPTSIZ_PKTCNT_Pos) | 64;
+  USB_OUTEP[0].DOEPCTL |= USB_OTG_DOEPCTL_EPENA | USB_OTG_DOEPCTL_CNAK;
+}
+
+// 制御OUTのデータステージを受信し、完了したら out_complete を呼んでから
+// ステータスIN（ZLP）を返す。out_complete が NULL なら読み捨てて ACK する
+void usb_control_receive_data(USB_SetupPacket *setup,
+                              usb_control_out_cb out_complete) {
+  usb_control_state.setup = *setup;
+  usb_control_state.data_buffer = usb_control_out_buf;
+  usb_control_state.data_length = setup->wLength;
+  usb_control_state.data_sent = 0;
+  usb_control_state.out_complete = out_complete;
+
+  if (setup->wLength > USB_CONTROL_OUT_MAX) {
+    LOG_WARN("Control OUT too long: %d bytes\r\n", setup->wLength);
+    usb_control_stall();
+    return;
+  }
+  if (setup->wLength == 0) {
+    if (out_complete == NULL || out_complete(setup, usb_control_out_buf, 0)) {
+      usb_control_send_data(NULL, 0);
+    } else {
+      usb_control_stall();
+    }
+    return;
+  }
+
+  usb_control_state.state = USB_CTRL_STATE_DATA_OUT;
+  usb_prepare_ep0_out_data();
+}
+
+// DATA_OUT 中に受信したパケットをバッファへ詰める
+static void usb_control_out_data(const uint8_t *data, uint16_t len) {
+  uint16_t remaining =
+      usb_control_state.data_length - usb_control_state.data_sent;
+  uint16_t n = len < remaining ? len : remaining;
+
+  for (uint16_t i = 0; i < n; i++) {
+    usb_control_out_buf[usb_control_state.data_sent + i] = data[i];
+  }
+  usb_control_state.data_sent += n;
+  usb_control_out_last_len = len;
+}
+
+// EP0 OUT 転送完了: 全部受け取ったか短いパケットならデータステージ終了
+static void usb_control_out_xfer_complete(void) {
+  if (usb_control_state.data_sent < usb_control_state.data_length &&
+      usb_control_out_last_len == 64) {
+    usb_prepare_ep0_out_data();
+    return;
+  }
+
+  usb_control_out_cb out_complete = usb_control_state.out_complete;
+  usb_control_state.out_complete = NULL;
+
+  if (out_complete == NULL ||
+      out_complete(&usb_control_state.setup, usb_control_out_buf,
+                   usb_control_state.data_sent)) {
+    usb_control_send_data(NULL, 0);
+  } else {
+    usb_control_stall();
+  }
+}
+
 static void usb_send_contorl_packet(void) {
   uint16_t packet_size;
   uint16_t remaining =
@@ -297,7 +359,8 @@ static void usb_process_set_configuration(USB_SetupPacket *setup) {
 
   if (configuration_value == 1) {
     USB_OUTEP[1].DOEPCTL =
-        USB_OTG_DOEPCTL_EPTYP_0 | (192 << USB_OTG_DOEPCTL_MPSIZ_Pos);
+        USB_OTG_DOEPCTL_EPTYP_0 |
+        (uac2_get_max_packet_size() << USB_OTG_DOEPCTL_MPSIZ_Pos);
     LOG_INFO("Audio streaming endpoint enabled\r\n");
     current_configuration = 1;
     usb_control_send_data(NULL, 0);
@@ -332,21 +395,42 @@ static void usb_process_set_interface(USB_SetupPacket *setup) {
     // Audio Streaming Interface - ここでエンドポイント制御
     if (alternate_setting == 0) {
       // Alt 0: ゼロ帯域幅（エンドポイント無効化）
+      usb_ep_lock();
       USB_OUTEP[1].DOEPCTL &= ~USB_OTG_DOEPCTL_EPENA;
       USB_OUTEP[1].DOEPCTL &= ~USB_OTG_DOEPCTL_USBAEP;
+      uac2_stream_stop();
+      if (!usb_in_ep_disable(1)) {
+        LOG_WARN("EP1 IN did not disable\r\n");
+      }
+      USB_INEP[1].DIEPCTL &= ~USB_OTG_DIEPCTL_USBAEP;
+      usb_ep_unlock();
       LOG_INFO("Interface 1 Alt 0: Zero bandwidth - endpoint disabled\r\n");
       usb_control_send_data(NULL, 0);
-    } else if (alternate_setting == 1) {
-      // Alt 1: 動作モード（エンドポイント有効化）
+    } else if (alternate_setting <= UAC2_AS_ALT_MAX) {
+      // Alt 1-3: 動作モード（フォーマット選択, エンドポイント有効化）
+      // 形式の切り替え中に RXFLVL が新旧混ざった形式で展開しないよう,
+      // OTG 割り込みを止めてから変える
+      usb_ep_lock();
+      uac2_set_alt_setting(alternate_setting);
       USB_OUTEP[1].DOEPCTL |= USB_OTG_DOEPCTL_USBAEP;
       USB_OUTEP[1].DOEPCTL |= USB_OTG_DOEPCTL_EPTYP_0; // Isochronous
-      USB_OUTEP[1].DOEPCTL |= (192 << USB_OTG_DOEPCTL_MPSIZ_Pos);
+      USB_OUTEP[1].DOEPCTL &= ~USB_OTG_DOEPCTL_MPSIZ;
+      USB_OUTEP[1].DOEPCTL |=
+          (uac2_get_max_packet_size() << USB_OTG_DOEPCTL_MPSIZ_Pos);
       USB_OUTEP[1].DOEPCTL |= USB_OTG_DOEPCTL_EPENA | USB_OTG_DOEPCTL_CNAK;
 
+      // EP1 IN: フィードバック（Isochronous, TX FIFO 1）
+      USB_INEP[1].DIEPCTL = USB_OTG_DIEPCTL_USBAEP | USB_OTG_DIEPCTL_EPTYP_0 |
+                            (1 << USB_OTG_DIEPCTL_TXFNUM_Pos) |
+                            (3 << USB_OTG_DIEPCTL_MPSIZ_Pos);
+      uac2_stream_start();
+
       // 受信準備
       uac2_prepare_next_reception();
+      usb_ep_unlock();
 
-      LOG_INFO("Interface 1 Alt 1: Operational - endpoint enabled\r\n");
+      LOG_INFO("Interface 1 Alt %d: Operational - endpoint enabled\r\n",
+               alternate_setting);
       usb_control_send_data(NULL, 0);
     } else {
       LOG_ERROR("Invalid alternate setting for interface 1: 0x%02X\r\n",
@@ -359,134 +443,159 @@ static void usb_process_set_interface(USB_SetupPacket *setup) {
   }
 }
 
-static void usb_process_get_status(USB_SetupPacket *setup) {
-  uint8_t status[2] = {0x00, 0x00};
-  LOG_INFO("GET_STATUS\r\n");
-  usb_control_send_data(status, sizeof(status));
-}
-
-static void usb_process_standard_request(USB_SetupPacket *setup) {
-  LOG_INFO("Standard request: bRequest=0x%02X\r\n", setup->bRequest);
-
-  switch (setup->bRequest) {
-  case 0x00:
-    // GET_STATUS
-    usb_process_get_status(setup);
-    break;
+// GET_DESCRIPTOR(STRING)。インデックスごとに長さが違うのでハンドラで返す
+static void usb_process_get_string_descriptor(USB_SetupPacket *setup) {
+  static const uint8_t *const strings[] = {
+      string_lang_descriptor,
+      string_manufacturer_descriptor,
+      string_product_descriptor,
+  };
+  uint8_t desc_index = setup->wValue & 0xff;
 
-  case 0x05:
-    // SET_ADDRESS
-    usb_process_set_address(setup);
-    break;
+  if (desc_index >= sizeof(strings) / sizeof(strings[0])) {
+    LOG_WARN("Invalid string descriptor index: %d\r\n", desc_index);
+    usb_control_stall();
+    return;
+  }
 
-  case 0x06:
-    // GET_DESCRIPTOR
-    usb_process_get_descriptor(setup);
-    break;
+  // 要求されたサイズと bLength の小さい方を送信
+  uint16_t desc_length = strings[desc_index][0];
+  usb_control_send_data((uint8_t *)strings[desc_index],
+                        setup->wLength < desc_length ? setup->wLength
+                                                     : desc_length);
+}
 
-  case 0x08: // GET_CONFIGURATION
-    LOG_INFO("GET_CONFIGURATION: returning %d\r\n", current_configuration);
-    static uint8_t config_response;
-    config_response = current_configuration;
-    usb_control_send_data(&config_response, 1);
-    break;
+static void usb_process_get_configuration(USB_SetupPacket *setup) {
+  static uint8_t config_response;
 
-  case 0x09:
-    // SET_CONFIGURATION
-    usb_process_set_configuration(setup);
-    break;
+  LOG_DEBUG("GET_CONFIGURATION: returning %d\r\n", current_configuration);
+  config_response = current_configuration;
+  usb_control_send_data(&config_response, 1);
+}
 
-  case 0x0b:
-    // SET_INTERFACE
-    usb_process_set_interface(setup);
-    break;
+// profile dump request (wValue: プローブ番号)
+static void usb_process_prof_dump(USB_SetupPacket *setup) {
+  static uint32_t prof_data[PROF_EXPORT_WORDS];
+  uint32_t prof_bytes = prof_export((prof_probe_t)setup->wValue, prof_data);
 
-  default:
-    LOG_WARN("Unsupported standard request: 0x%02X\r\n", setup->bRequest);
+  if (prof_bytes == 0) {
     usb_control_stall();
-    break;
+    return;
   }
+  usb_control_send_data((uint8_t *)prof_data, setup->wLength < prof_bytes
+                                                  ? setup->wLength
+                                                  : prof_bytes);
 }
 
-static void usb_process_audio_request(USB_SetupPacket *setup) {
-  LOG_INFO("Audio request: bRequest=0x%02X\r\n", setup->bRequest);
-  switch (setup->bRequest) {
-  case 0x01:
-    // SET_CUR
-    LOG_INFO("SET_CUR\r\n");
-    usb_control_send_data(NULL, 0);
-    break;
+static void usb_process_prof_reset(USB_SetupPacket *setup) {
+  LOG_INFO("profile reset request\r\n");
+  prof_reset();
+  usb_control_send_data(NULL, 0);
+}
 
-  case 0x81:
-    // GET_CUR
-    static uint8_t dummy_data[4] = {0x00, 0x00, 0x00, 0x00};
-    LOG_INFO("GET_CUR\r\n");
-    usb_control_send_data(dummy_data, setup->wLength > 4 ? 4 : setup->wLength);
-    break;
+// stream statistics request
+// (UAC2_IsoStats + UAC2_FrameStats + audio_conceal_stats_t)
+static void usb_process_stream_stats(USB_SetupPacket *setup) {
+  static struct {
+    UAC2_IsoStats iso;
+    UAC2_FrameStats frame;
+    audio_conceal_stats_t conceal;
+  } stream_stats;
+
+  stream_stats.iso = uac2_iso_stats;
+  stream_stats.frame = uac2_frame_stats;
+  stream_stats.conceal = audio_conceal_stats;
+  usb_control_send_data((uint8_t *)&stream_stats,
+                        setup->wLength < sizeof(stream_stats)
+                            ? setup->wLength
+                            : sizeof(stream_stats));
+}
 
-  default:
-    LOG_WARN("Unsupported audio request: 0x%02X\r\n", setup->bRequest);
+// jitter buffer target (wValue: 目標 [us], wIndex: 1 で適応モード)
+static void usb_process_set_latency(USB_SetupPacket *setup) {
+  if (uac2_set_latency(setup->wValue, setup->wIndex != 0)) {
+    usb_control_send_data(NULL, 0);
+  } else {
     usb_control_stall();
-    break;
   }
 }
 
-static void usb_process_vendor_request(USB_SetupPacket *setup) {
-  static uint8_t keep_alive_data[4] = {0xaa, 0xbb, 0xcc, 0xdd};
+// jitter buffer state request (UAC2_Latency)
+static void usb_process_get_latency(USB_SetupPacket *setup) {
+  static UAC2_Latency latency;
 
-  switch (setup->bRequest) {
-  case 0x01:
-    // keep alive request
-    LOG_INFO("keep alive request\r\n");
-    usb_control_send_data(keep_alive_data, 4);
-    break;
-
-  default:
-    LOG_WARN("Unsupported vendor request: 0x%02X\r\n", setup->bRequest);
-    usb_control_stall();
-    break;
-  }
+  uac2_get_latency(&latency);
+  usb_control_send_data((uint8_t *)&latency, setup->wLength < sizeof(latency)
+                                                 ? setup->wLength
+                                                 : sizeof(latency));
 }
 
+// 固定の応答はフラッシュ上にワード境界で置き、そのまま FIFO へ書く
+static const uint8_t usb_status_response[4] __attribute__((aligned(4))) = {
+    0x00, 0x00};
+static const uint8_t keep_alive_response[4] __attribute__((aligned(4))) = {
+    0xaa, 0xbb, 0xcc, 0xdd};
+
+// 標準リクエストとベンダーリクエスト（キー昇順）
+static const usb_ctrl_entry_t usb_std_requests[] = {
+    USB_CTRL_HANDLER(0x00, 0x05, 0, 0, USB_CTRL_MATCH_REQUEST,
+                     usb_process_set_address),
+    USB_CTRL_HANDLER(0x00, 0x09, 0, 0, USB_CTRL_MATCH_REQUEST,
+                     usb_process_set_configuration),
+    USB_CTRL_HANDLER(0x01, 0x0b, 0, 0, USB_CTRL_MATCH_REQUEST,
+                     usb_process_set_interface),
+    USB_CTRL_HANDLER(0x40, 0x03, 0, 0, USB_CTRL_MATCH_REQUEST,
+                     usb_process_prof_reset),
+    USB_CTRL_HANDLER(0x40, 0x05, 0, 0, USB_CTRL_MATCH_REQUEST,
+                     usb_process_set_latency),
+    USB_CTRL_RESPONSE(0x80, 0x00, 0, 0, USB_CTRL_MATCH_REQUEST,
+                      usb_status_response, 2),
+    USB_CTRL_RESPONSE(0x80, 0x06, 0x01, 0, USB_CTRL_MATCH_EXACT,
+                      &device_descriptor, sizeof(device_descriptor)),
+    USB_CTRL_RESPONSE(0x80, 0x06, 0x02, 0, USB_CTRL_MATCH_EXACT,
+                      &configuration_descriptor,
+                      sizeof(configuration_descriptor)),
+    USB_CTRL_HANDLER(0x80, 0x06, 0x03, 0, USB_CTRL_MATCH_EXACT,
+                     usb_process_get_string_descriptor),
+    USB_CTRL_RESPONSE(0x80, 0x06, 0x06, 0, USB_CTRL_MATCH_EXACT,
+                      &device_qualifier_descriptor,
+                      sizeof(device_qualifier_descriptor)),
+    USB_CTRL_HANDLER(0x80, 0x08, 0, 0, USB_CTRL_MATCH_REQUEST,
+                     usb_process_get_configuration),
+    USB_CTRL_RESPONSE(0x81, 0x00, 0, 0, USB_CTRL_MATCH_REQUEST,
+                      usb_status_response, 2),
+    USB_CTRL_RESPONSE(0x82, 0x00, 0, 0, USB_CTRL_MATCH_REQUEST,
+                      usb_status_response, 2),
+    USB_CTRL_RESPONSE(0xc0, 0x01, 0, 0, USB_CTRL_MATCH_REQUEST,
+                      keep_alive_response, 4),
+    USB_CTRL_HANDLER(0xc0, 0x02, 0, 0, USB_CTRL_MATCH_REQUEST,
+                     usb_process_prof_dump),
+    USB_CTRL_HANDLER(0xc0, 0x03, 0, 0, USB_CTRL_MATCH_REQUEST,
+                     usb_process_prof_reset),
+    USB_CTRL_HANDLER(0xc0, 0x04, 0, 0, USB_CTRL_MATCH_REQUEST,
+                     usb_process_stream_stats),
+    USB_CTRL_HANDLER(0xc0, 0x05, 0, 0, USB_CTRL_MATCH_REQUEST,
+                     usb_process_get_latency),
+};
+
+const usb_ctrl_table_t usb_std_table = USB_CTRL_TABLE(usb_std_requests);
+
+static void usb_register_requests(void) { usb_ctrl_register(&usb_std_table); }
+
 static void usb_process_setup(USB_SetupPacket *setup) {
   USB_SETUP("bmRequestType=0x%02X, bRequest=0x%02X\r\n", setup->bmRequestType,
             setup->bRequest);
-  USB_SETUP("Recipient: %s, Type: %s\r\n",
-            (setup->bmRequestType & 0x1F) == 0   ? "Device"
-            : (setup->bmRequestType & 0x1F) == 1 ? "Interface"
-            : (setup->bmRequestType & 0x1F) == 2 ? "Endpoint"
-                                                 : "Other",
-            (setup->bmRequestType & 0x60) == 0x00   ? "Standard"
-            : (setup->bmRequestType & 0x60) == 0x20 ? "Class"
-                                                    : "Other");
 
   usb_control_state.state = USB_CTRL_STATE_SETUP;
   usb_control_state.data_length = setup->wLength;
   usb_control_state.data_sent = 0;
 
-  switch (setup->bmRequestType & 0x60) {
-  case 0x00:
-    // standard request
-    usb_process_standard_request(setup);
-    break;
-
-  case 0x20:
-    // class request
-    LOG_INFO("Audio class request\r\n");
-    uac2_process_audio_request(setup);
-    break;
-
-  case 0x40:
-    // vendor request
-    LOG_INFO("Vendor class request\r\n");
-    usb_process_vendor_request(setup);
-    break;
-
-  default:
-    LOG_WARN("Unsupported request type: 0x%02X\r\n",
-             setup->bmRequestType & 0x60);
+  if (!usb_ctrl_dispatch(setup)) {
+    LOG_WARN("Unsupported request: type=0x%02X, req=0x%02X, wValue=0x%04X, "
+             "wIndex=0x%04X\r\n",
+             setup->bmRequestType, setup->bRequest, setup->wValue,
+             setup->wIndex);
     usb_control_stall();
-    break;
   }
 }
 
@@ -509,38 +618,90 @@ static void usb_process_set_address(USB_SetupPacket *setup) {
   }
 }
 
-// 残りの関数は変更なし
-static void usb_handle_setup(uint32_t epnum) {
-  USB_SetupPacket setup;
+// イベントを積んでボトムハーフ（PendSV）を起こす
+static usb_event_t *usb_post_event(uint8_t type, uint8_t epnum) {
+  usb_event_t *ev = usb_evq_alloc(&usb_event_queue);
+
+  if (ev == NULL) {
+    return NULL;
+  }
+  ev->type = type;
+  ev->epnum = epnum;
+  ev->len = 0;
+  usb_evq_commit(&usb_event_queue);
+  SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+  return ev;
+}
 
-  usb_read_packet((uint8_t *)&setup, 8);
+// RX FIFOのパケットをスロットへ直接読み込んでから積む
+static void usb_post_packet(uint8_t type, uint8_t epnum, uint32_t bcnt) {
+  usb_event_t *ev = usb_evq_alloc(&usb_event_queue);
 
-  if (epnum == 0) {
-    usb_process_setup(&setup);
+  if (ev == NULL || bcnt > USB_EVQ_DATA_MAX) {
+    usb_read_packet(NULL, bcnt); // FIFOからは必ず取り出す
+    return;
   }
+  usb_read_packet((uint8_t *)ev->data, bcnt);
+  ev->type = type;
+  ev->epnum = epnum;
+  ev->len = bcnt;
+  usb_evq_commit(&usb_event_queue);
+  SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
 }
 
-static void usb_read_packet(uint8_t *dest, uint32_t bcnt) {
-  uint32_t nwords = (bcnt + 3) / 4;
-  uint32_t data;
-  uint32_t *fifo = USB_FIFO(0);
-
-  for (uint32_t i = 0; i < nwords; i++) {
-    data = *fifo;
-    if (dest != NULL) {
-      for (uint8_t j = 0; j < 4 && (i * 4 + j) < bcnt;
-           j++) { // 境界チェック追加
-        dest[i * 4 + j] = (uint8_t)(data >> (j * 8));
+// ボトムハーフ: SETUP解析やEP0の制御転送など、時間のかかる処理を行う
+// PendSV_Handler から呼ばれる
+void usb_bottom_half(void) {
+  uint32_t prof_start = prof_begin();
+  usb_event_t *ev;
+
+  while ((ev = usb_evq_peek(&usb_event_queue)) != NULL) {
+    switch (ev->type) {
+    case USB_EVT_RESET:
+      LOG_INFO("USB reset\r\n");
+      usb_control_state.state = USB_CTRL_STATE_IDLE;
+      break;
+
+    case USB_EVT_SETUP:
+      if (ev->epnum == 0) {
+        usb_process_setup((USB_SetupPacket *)ev->data);
+      }
+      break;
+
+    case USB_EVT_OUT_DATA:
+      if (usb_control_state.state == USB_CTRL_STATE_DATA_OUT) {
+        usb_control_out_data((const uint8_t *)ev->data, ev->len);
+      }
+      break;
+
+    case USB_EVT_OUT_COMPLETE:
+      if (usb_control_state.state != USB_CTRL_STATE_DATA_OUT) {
+        usb_prepare_ep0_out_status();
       }
+      break;
+
+    case USB_EVT_EP0_IN_XFRC:
+      usb_handle_ep0_in_complete();
+      break;
+
+    case USB_EVT_EP0_OUT_XFRC:
+      usb_handle_ep0_out_complete();
+      break;
+
+    default:
+      break;
     }
+    usb_evq_release(&usb_event_queue);
   }
+
+  prof_end(PROF_USB_BOTTOM_HALF, prof_start);
 }
 
-static void usb_write_packet(uint8_t epnum, uint8_t *src, uint16_t len) {
-  uint32_t nwords = (len + 3) / 4;
-  uint32_t *fifo = USB_FIFO(epnum);
-  uint32_t data;
+static void usb_read_packet(uint8_t *dest, uint32_t bcnt) {
+  usb_fifo_read(USB_FIFO(0), dest, bcnt);
+}
 
+static void usb_write_packet(uint8_t epnum, uint8_t *src, uint16_t len) {
   LOG_DEBUG("Write packet: epnum=%d, len=%d\r\n", epnum, len);
 
   // DIEPTSIZ設定
@@ -549,23 +710,17 @@ static void usb_write_packet(uint8_t epnum, uint8_t *src, uint16_t len) {
   // 送信開始
   USB_INEP[epnum].DIEPCTL |= USB_OTG_DIEPCTL_EPENA | USB_OTG_DIEPCTL_CNAK;
 
-  // データをFIFOに書き込み
-  if (len > 0 && src != NULL) {
-    LOG_INFO("Writing data to FIFO:\r\n");
-    for (uint32_t i = 0; i < nwords; i++) {
-      data = 0;
-      for (uint8_t j = 0; j < 4; j++) {
-        if (i * 4 + j < len) {
-          data |= (uint32_t)(src[i * 4 + j]) << (j * 8);
-        }
-      }
-      *fifo = data;
-    }
+  if (len == 0 || src == NULL) {
+    return;
   }
+
+  // データをFIFOに書き込み
+  usb_fifo_write(USB_FIFO(epnum), src, len);
 }
 
 static void usb_handle_rxflvl(void) {
-  uint32_t grxstsp = USB_OTG_FS->GRXSTSP;
+  uint32_t prof_start = prof_begin();
+  uint32_t grxstsp = usb_reg_read(&USB_OTG_FS->GRXSTSP);
   uint32_t pktsts =
       (grxstsp & USB_OTG_GRXSTSP_PKTSTS) >> USB_OTG_GRXSTSP_PKTSTS_Pos;
   uint32_t bcnt = (grxstsp & USB_OTG_GRXSTSP_BCNT) >> USB_OTG_GRXSTSP_BCNT_Pos;
@@ -575,14 +730,14 @@ static void usb_handle_rxflvl(void) {
 
   switch (pktsts) {
   case PKTSTS_SETUP_RECEIVED: // SETUP受信
-    usb_handle_setup(epnum);
+    usb_post_packet(USB_EVT_SETUP, epnum, bcnt);
     break;
 
   case PKTSTS_OUT_DATA_RECEIVED: // OUT DATA受信
     USB_DATA("OUT DATA received\r\n");
     if (epnum == 0) {
       if (bcnt > 0) {
-        usb_read_packet(NULL, bcnt);
+        usb_post_packet(USB_EVT_OUT_DATA, epnum, bcnt);
       }
     } else if (epnum == 1) {
       uac2_read_audio_from_fifo(bcnt);
@@ -591,7 +746,9 @@ static void usb_handle_rxflvl(void) {
 
   case PKTSTS_OUT_COMPLETE: // OUT転送完了
     LOG_DEBUG("OUT transfer completed\r\n");
-    usb_prepare_ep0_out_status();
+    if (epnum == 0) {
+      usb_post_event(USB_EVT_OUT_COMPLETE, epnum);
+    }
     break;
 
   case PKTSTS_SETUP_COMPLETE: // SETUP転送完了
@@ -605,6 +762,8 @@ static void usb_handle_rxflvl(void) {
     }
     break;
   }
+
+  prof_end(PROF_USB_RXFLVL, prof_start);
 }
 
 static void usb_handle_ep0_in_complete(void) {
@@ -618,7 +777,9 @@ static void usb_handle_ep0_in_complete(void) {
 }
 
 static void usb_handle_ep0_out_complete(void) {
-  if (usb_control_state.state == USB_CTRL_STATE_STATUS_OUT) {
+  if (usb_control_state.state == USB_CTRL_STATE_DATA_OUT) {
+    usb_control_out_xfer_complete();
+  } else if (usb_control_state.state == USB_CTRL_STATE_STATUS_OUT) {
     usb_control_state.state = USB_CTRL_STATE_IDLE;
     LOG_DEBUG("EP0 out status complete - Control transfer done\r\n");
   }
@@ -638,11 +799,11 @@ static void usb_handle_iepint(void) {
       uint32_t diepint = USB_INEP[ep].DIEPINT;
 
       if (diepint & USB_OTG_DIEPINT_XFRC) {
-        USB_INEP[ep].DIEPINT = USB_OTG_DIEPINT_XFRC;
+        usb_reg_write(&USB_INEP[ep].DIEPINT, USB_OTG_DIEPINT_XFRC);
         LOG_DEBUG("EP%d IN transfer completed\r\n", ep);
 
         if (ep == 0) {
-          usb_handle_ep0_in_complete();
+          usb_post_event(USB_EVT_EP0_IN_XFRC, ep);
         }
       }
     }
@@ -658,17 +819,17 @@ static void usb_handle_oepint(void) {
       uint32_t doepint = USB_OUTEP[ep].DOEPINT;
 
       if (doepint & USB_OTG_DOEPINT_XFRC) {
-        USB_OUTEP[ep].DOEPINT = USB_OTG_DOEPINT_XFRC;
+        usb_reg_write(&USB_OUTEP[ep].DOEPINT, USB_OTG_DOEPINT_XFRC);
         LOG_DEBUG("EP%d out transfer completed\r\n", ep);
 
         if (ep == 0) {
-          usb_handle_ep0_out_complete();
+          usb_post_event(USB_EVT_EP0_OUT_XFRC, ep);
         } else if (ep == 1) {
           uac2_handle_audio_data_received();
         }
 
         if (doepint & USB_OTG_DOEPINT_STUP) {
-          USB_OUTEP[ep].DOEPINT = USB_OTG_DOEPINT_STUP;
+          usb_reg_write(&USB_OUTEP[ep].DOEPINT, USB_OTG_DOEPINT_STUP);
           LOG_INFO("EP%d out setup phase done\r\n", ep);
         }
       }
@@ -676,31 +837,99 @@ static void usb_handle_oepint(void) {
   }
 }
 
+void usb_log_irq_stats(void) {
+  static uint32_t last_entries = 0;
+  static uint32_t last_passes = 0;
+  static uint32_t last_rx = 0;
+  static uint32_t last_single_pop = 0;
+  uint32_t entries = usb_irq_stats.entries - last_entries;
+  uint32_t passes = usb_irq_stats.passes - last_passes;
+  uint32_t rx = usb_irq_stats.rx_entries - last_rx;
+  uint32_t single_pop = usb_irq_stats.single_pop - last_single_pop;
+
+  last_entries += entries;
+  last_passes += passes;
+  last_rx += rx;
+  last_single_pop += single_pop;
+  if (entries == 0) {
+    return;
+  }
+  // 前回からの差分（1秒周期で呼べば毎秒の値）
+  LOG_INFO("OTG IRQ: entries=%d (single-pop %d) rx=%d passes/entry=%d.%02d "
+           "max=%d budget=%d\r\n",
+           entries, single_pop, rx, passes / entries,
+           passes * 100 / entries % 100, usb_irq_stats.max_passes,
+           usb_irq_stats.budget_hits);
+}
+
+// 1回の割り込みで GINTSTS を読み直して処理するだけ処理する。
+// SETUP と iso パケットが続けて届いても割り込みの出入りは1回で済む。
+// 予算を使い切ったら抜ける（要因が残っていれば NVIC がすぐ再度呼ぶ）
 void OTG_FS_IRQHandler(void) {
-  uint32_t gintsts = USB_OTG_FS->GINTSTS & USB_OTG_FS->GINTMSK;
+  uint32_t prof_start = prof_begin();
+  uint32_t passes = 0;
+  uint32_t single_pop = 0;
+  uint32_t gintsts;
 
-  if (gintsts & USB_OTG_GINTSTS_USBRST) {
-    USB_OTG_FS->GINTSTS = USB_OTG_GINTSTS_USBRST;
-    LOG_INFO("USB reset\r\n");
-    USB_DEVICE->DAINTMSK = (0b11 << USB_OTG_DAINTMSK_IEPM_Pos) |
-                           (0b11 << USB_OTG_DAINTMSK_OEPM_Pos);
+  usb_irq_stats.entries++;
 
-    USB_DEVICE->DCFG &= ~USB_OTG_DCFG_DAD;
-    USB_INEP[0].DIEPCTL |= USB_OTG_DIEPCTL_USBAEP;
-    USB_OUTEP[0].DOEPCTL |= USB_OTG_DOEPCTL_USBAEP;
+  while ((gintsts = USB_OTG_FS->GINTSTS & USB_OTG_FS->GINTMSK) != 0) {
+    if (passes == USB_IRQ_PASS_BUDGET) {
+      usb_irq_stats.budget_hits++;
+      break;
+    }
+    passes++;
+    single_pop++;
 
-    usb_control_state.state = USB_CTRL_STATE_IDLE;
-  }
+    if (gintsts & USB_OTG_GINTSTS_USBRST) {
+      usb_reg_write(&USB_OTG_FS->GINTSTS, USB_OTG_GINTSTS_USBRST);
+      USB_DEVICE->DAINTMSK = (0b11 << USB_OTG_DAINTMSK_IEPM_Pos) |
+                             (0b11 << USB_OTG_DAINTMSK_OEPM_Pos);
 
-  if (gintsts & USB_OTG_GINTSTS_RXFLVL) {
-    usb_handle_rxflvl();
-  }
+      USB_DEVICE->DCFG &= ~USB_OTG_DCFG_DAD;
+      USB_INEP[0].DIEPCTL |= USB_OTG_DIEPCTL_USBAEP;
+      USB_OUTEP[0].DOEPCTL |= USB_OTG_DOEPCTL_USBAEP;
 
-  if (gintsts & USB_OTG_GINTSTS_IEPINT) {
-    usb_handle_iepint();
+      usb_post_event(USB_EVT_RESET, 0);
+    }
+
+    if (gintsts & USB_OTG_GINTSTS_SOF) {
+      usb_reg_write(&USB_OTG_FS->GINTSTS, USB_OTG_GINTSTS_SOF);
+      uac2_handle_sof();
+    }
+
+    if (gintsts & USB_OTG_GINTSTS_RXFLVL) {
+      // RX FIFO が空になるまで取り出す（DMA で取り出し中はマスクされる）
+      uint32_t rx = 0;
+      do {
+        usb_handle_rxflvl();
+        rx++;
+      } while (rx < USB_IRQ_RX_BUDGET &&
+               (USB_OTG_FS->GINTSTS & USB_OTG_FS->GINTMSK &
+                USB_OTG_GINTSTS_RXFLVL));
+      usb_irq_stats.rx_entries += rx;
+      single_pop += rx - 1;
+    }
+
+    if (gintsts & USB_OTG_GINTSTS_PXFR_INCOMPISOOUT) {
+      usb_reg_write(&USB_OTG_FS->GINTSTS, USB_OTG_GINTSTS_PXFR_INCOMPISOOUT);
+      uac2_handle_incomplete_iso_out();
+    }
+
+    if (gintsts & USB_OTG_GINTSTS_IEPINT) {
+      usb_handle_iepint();
+    }
+
+    if (gintsts & USB_OTG_GINTSTS_OEPINT) {
+      usb_handle_oepint();
+    }
   }
 
-  if (gintsts & USB_OTG_GINTSTS_OEPINT) {
-    usb_handle_oepint();
+  usb_irq_stats.passes += passes;
+  usb_irq_stats.single_pop += single_pop;
+  if (passes > usb_irq_stats.max_passes) {
+    usb_irq_stats.max_passes = passes;
   }
+
+  prof_end(PROF_OTG_FS_IRQ, prof_start);
 }
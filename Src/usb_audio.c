@@ -1,227 +1,761 @@
 #include "usb_audio.h"
+#include "audio_conceal.h"
+#include "audio_ring.h"
+#include "audio_unpack.h"
+#include "cs43l22.h"
+#include "i2s.h"
 #include "log.h"
+#include "prof.h"
 #include "stm32f411xe.h"
+#include "tim.h"
 #include "usart.h"
 #include "usb.h"
+#include "usb_ctrl.h"
 #include <math.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 
-extern uint64_t global_time_us;
-
 // Global clock source state
 UAC2_ClockSourceState uac2_clock_source_state = {.sample_rate =
                                                      UAC2_SAMPLE_RATE_48000,
                                                  .clock_valid = true,
                                                  .clock_locked = true};
-static uint8_t audio_rx_buf[AUDIO_BUFFER_SIZE];
-static uint32_t audio_buffer_index = 0;
-int16_t audio_rx_samples_0[AUDIO_BUFFER_SIZE / 2] = {0};
-int16_t audio_rx_samples_1[AUDIO_BUFFER_SIZE / 2];
-static uint32_t audio_samples_index = 0;
-uint64_t callback_time_history[CALLBACK_TIME_HISTORY_SIZE] = {0};
-static uint32_t callback_time_history_index = 0;
+audio_ring_t audio_playback_ring;
 
-void uac2_init(void) {
-  LOG_INFO("UAC2.0 Audio Class initialized\r\n");
-  uac2_clock_source_state.sample_rate = UAC2_SAMPLE_RATE_48000;
-  uac2_clock_source_state.clock_valid = true;
-  uac2_clock_source_state.clock_locked = true;
+// DOEPCTL bit 16 reads back the even/odd frame an iso endpoint is armed for
+#define DOEPCTL_EONUM (1UL << 16)
+
+volatile UAC2_IsoStats uac2_iso_stats = {0};
+static bool iso_counting = false; // Set once the host starts sending
+
+// SOF frame clock: the last published window and the one being collected
+UAC2_FrameStats uac2_frame_stats = {0};
+static UAC2_FrameStats frame_window;
+static uint32_t frame_window_count = 0;
+static uint64_t frame_jitter_sum = 0;
+static uint64_t frame_offset_sum = 0;
+static uint32_t frame_offset_count = 0;
+static uint32_t frame_window_missed_base = 0;
+static bool sof_seen = false;
+
+// Explicit feedback state
+volatile uint32_t uac2_feedback_value = 0;
+uint32_t uac2_feedback_history[UAC2_FEEDBACK_HISTORY_SIZE] = {0};
+static uint32_t feedback_history_index = 0;
+static uint32_t feedback_sof_count = 0;
+static uint32_t feedback_last_played = 0;
+static bool stream_active = false;
+
+// Playback lifecycle (see UAC2_StreamState)
+volatile UAC2_StreamState uac2_stream_state = UAC2_STREAM_IDLE;
+volatile UAC2_StreamLatency uac2_stream_latency = {0};
+static uint64_t stream_event_us = 0;    // Time of the last start or stop
+static uint32_t stream_silent_periods = 0;
+static volatile bool stream_repriming = false; // Priming after a rate change
+static volatile bool codec_powered = true;     // cs43l22_init() powers it up
+
+// Jitter buffer target (see UAC2_LATENCY_US)
+static volatile uint32_t latency_target_us = UAC2_LATENCY_US;
+static volatile bool latency_adaptive = UAC2_LATENCY_ADAPTIVE;
+static uint32_t latency_grows = 0;
+static uint32_t latency_shrinks = 0;
+static uint16_t audio_packet_size =
+    AUDIO_PACKET_SIZE(UAC2_SAMPLE_RATE_48000, 2);
+
+// Current streaming format (defaults to alt 1, 16bit)
+UAC2_StreamFormat uac2_stream_format = {.alt_setting = UAC2_AS_ALT_PCM16,
+                                        .subslot_size = 2,
+                                        .bit_depth = 16};
+
+// GET_RANGE response: one discrete subrange per supported rate
+#define UAC2_RANGE_SUBRANGE(rate)                                              \
+  (rate) & 0xFF, ((rate) >> 8) & 0xFF, ((rate) >> 16) & 0xFF,                 \
+      ((rate) >> 24) & 0xFF, (rate) & 0xFF, ((rate) >> 8) & 0xFF,              \
+      ((rate) >> 16) & 0xFF, ((rate) >> 24) & 0xFF, 0x00, 0x00, 0x00, 0x00
+static const uint8_t sample_rate_range[] __attribute__((aligned(4))) = {
+    0x04, 0x00, // wNumSubranges
+    UAC2_RANGE_SUBRANGE(UAC2_SAMPLE_RATE_44100),
+    UAC2_RANGE_SUBRANGE(UAC2_SAMPLE_RATE_48000),
+    UAC2_RANGE_SUBRANGE(UAC2_SAMPLE_RATE_88200),
+    UAC2_RANGE_SUBRANGE(UAC2_SAMPLE_RATE_96000),
+};
+
+uint16_t uac2_get_max_packet_size(void) { return audio_packet_size; }
+
+bool uac2_set_sample_rate(uint32_t rate) {
+  if (rate == uac2_clock_source_state.sample_rate) {
+    return true;
+  }
+  if (!i2s3_set_sample_rate(rate)) {
+    LOG_WARN("Unsupported sample rate: %d Hz\r\n", rate);
+    return false;
+  }
+
+  uac2_clock_source_state.sample_rate = rate;
+  audio_packet_size =
+      AUDIO_PACKET_SIZE(rate, uac2_stream_format.subslot_size);
+
+  // Resize EP1 OUT for the new rate. The OTG interrupt re-arms the same
+  // register, so keep it out while we read-modify-write.
+  usb_ep_lock();
+  USB_OUTEP[1].DOEPCTL = (USB_OUTEP[1].DOEPCTL & ~USB_OTG_DOEPCTL_MPSIZ) |
+                         (audio_packet_size << USB_OTG_DOEPCTL_MPSIZ_Pos);
+  if (stream_active) {
+    uac2_stream_reprime();
+  }
+  usb_ep_unlock();
+  return true;
 }
 
-void uac2_process_audio_request(USB_SetupPacket *setup) {
-  uint8_t recipient = setup->bmRequestType & 0x1F;
-  uint8_t entity_id = (setup->wIndex >> 8) & 0xFF;
-  uint8_t interface_id = setup->wIndex & 0xFF;
-  uint8_t control_selector = (setup->wValue >> 8) & 0xFF;
-
-  LOG_INFO(
-      "Audio Request: Recipient=0x%02X, Entity=0x%02X, Interface=0x%02X\r\n",
-      recipient, entity_id, interface_id);
-  LOG_DEBUG("Control Selector=0x%02X, Request=0x%02X\r\n", control_selector,
-            setup->bRequest);
-
-  // Recipient check
-  if (recipient == 0x01) { // Interface
-    if (interface_id == UAC2_INTERFACE_CONTROL) {
-      // Audio Control Interface requests
-      switch (entity_id) {
-      case UAC2_ENTITY_ID_CLOCK_SOURCE:
-        uac2_handle_clock_source_request(setup, control_selector);
-        break;
-      case UAC2_ENTITY_ID_CLOCK_SELECTOR:
-        uac2_handle_clock_selector_request(setup, control_selector);
-        break;
-      default:
-        LOG_WARN("Unsupported entity ID: 0x%02X\r\n", entity_id);
-        usb_control_stall();
-        break;
-      }
-    } else if (interface_id == UAC2_INTERFACE_STREAMING) {
-      // Audio Streaming Interface requests
-      LOG_DEBUG("Audio Streaming Interface request\r\n");
-      usb_control_send_data(NULL, 0); // ACK for now
-    } else {
-      LOG_WARN("Unknown interface ID: 0x%02X\r\n", interface_id);
-      usb_control_stall();
-    }
-  } else if (recipient == 0x02) { // Endpoint
-    LOG_DEBUG("Audio Endpoint request\r\n");
-    usb_control_send_data(NULL, 0); // ACK for now
+// Select the sample format for an operational alternate setting. The RXFLVL
+// unpack reads the format and the ring layout, so call this with the OTG
+// interrupt masked (usb_ep_lock).
+bool uac2_set_alt_setting(uint8_t alt_setting) {
+  uint8_t subslot;
+  uint8_t bits;
+
+  switch (alt_setting) {
+  case UAC2_AS_ALT_PCM16:
+    subslot = 2;
+    bits = 16;
+    break;
+  case UAC2_AS_ALT_PCM24_IN_32:
+    subslot = 4;
+    bits = 24;
+    break;
+  case UAC2_AS_ALT_PCM24_PACKED:
+    subslot = 3;
+    bits = 24;
+    break;
+  default:
+    return false;
+  }
+
+  if (bits != uac2_stream_format.bit_depth) {
+    i2s3_set_format(bits);
+  }
+
+  uac2_stream_format.alt_setting = alt_setting;
+  uac2_stream_format.subslot_size = subslot;
+  uac2_stream_format.bit_depth = bits;
+  audio_packet_size =
+      AUDIO_PACKET_SIZE(uac2_clock_source_state.sample_rate, subslot);
+
+  LOG_INFO("Stream format: alt %d, %d-byte subslot, %d bit\r\n", alt_setting,
+           subslot, bits);
+  return true;
+}
+
+// Requests with no state behind them yet: accept any OUT payload and
+// answer IN requests with an empty data stage.
+static void uac2_ack_request(USB_SetupPacket *setup) {
+  if (setup->bmRequestType & 0x80) {
+    usb_control_send_data(NULL, 0);
   } else {
-    LOG_WARN("Unsupported recipient: 0x%02X\r\n", recipient);
-    usb_control_stall();
-  }
-}
-
-void uac2_handle_clock_source_request(USB_SetupPacket *setup,
-                                      uint8_t control_selector) {
-  static uint8_t response_buffer[8];
-
-  LOG_DEBUG("Clock Source Request: Control=0x%02X, Request=0x%02X\r\n",
-            control_selector, setup->bRequest);
-
-  switch (control_selector) {
-  case UAC2_CS_SAM_FREQ_CONTROL:
-    if (setup->bRequest == UAC2_REQUEST_CUR) {
-      // GET_CUR: Return current sample rate
-      if (setup->bmRequestType & 0x80) {
-        LOG_INFO("GET_CUR Sample Rate: %d Hz\r\n",
-                 uac2_clock_source_state.sample_rate);
-        response_buffer[0] = (uac2_clock_source_state.sample_rate >> 0) & 0xFF;
-        response_buffer[1] = (uac2_clock_source_state.sample_rate >> 8) & 0xFF;
-        response_buffer[2] = (uac2_clock_source_state.sample_rate >> 16) & 0xFF;
-        response_buffer[3] = (uac2_clock_source_state.sample_rate >> 24) & 0xFF;
-        usb_control_send_data(response_buffer, 4);
-      } else {
-        // SET_CUR: Set sample rate
-        LOG_DEBUG("SET_CUR Sample Rate request\r\n");
-        usb_control_send_data(NULL, 0); // ACK
-      }
-    } else if (setup->bRequest == UAC2_REQUEST_RANGE) {
-      // GET_RANGE: Return supported sample rate range
-      if (setup->bmRequestType & 0x80) {
-        LOG_DEBUG("GET_RANGE Sample Rate\r\n");
-        static uint8_t sample_rate_range[14] = {
-            0x01, 0x00,             // wNumSubranges
-            0x80, 0xbb, 0x00, 0x00, // dMIN
-            0x80, 0xbb, 0x00, 0x00, // dMAX
-            0x01, 0x00, 0x00, 0x00  // dRES
-        };
-        usb_control_send_data(sample_rate_range, 14);
-      } else {
-        usb_control_stall();
-      }
-    } else {
-      usb_control_stall();
+    usb_control_receive_data(setup, NULL);
+  }
+}
+
+// SET_CUR payloads, called after the control OUT data stage
+static bool uac2_set_cur_sample_rate(const USB_SetupPacket *setup,
+                                     const uint8_t *data, uint16_t length) {
+  if (length < 4) {
+    return false;
+  }
+
+  uint32_t rate = (uint32_t)data[0] | ((uint32_t)data[1] << 8) |
+                  ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+  LOG_INFO("SET_CUR Sample Rate: %d Hz\r\n", rate);
+  return uac2_set_sample_rate(rate);
+}
+
+static bool uac2_set_cur_clock_selector(const USB_SetupPacket *setup,
+                                        const uint8_t *data, uint16_t length) {
+  // Only one clock source (pin 1) is connected
+  return length >= 1 && data[0] == 1;
+}
+
+static void uac2_receive_sample_rate(USB_SetupPacket *setup) {
+  usb_control_receive_data(setup, uac2_set_cur_sample_rate);
+}
+
+static void uac2_receive_clock_selector(USB_SetupPacket *setup) {
+  usb_control_receive_data(setup, uac2_set_cur_clock_selector);
+}
+
+static void uac2_get_cur_sample_rate(USB_SetupPacket *setup) {
+  static uint32_t rate;
+
+  LOG_DEBUG("GET_CUR Sample Rate: %d Hz\r\n",
+            uac2_clock_source_state.sample_rate);
+  rate = uac2_clock_source_state.sample_rate; // Little-endian on the wire
+  usb_control_send_data((uint8_t *)&rate, setup->wLength < 4 ? setup->wLength
+                                                             : 4);
+}
+
+static void uac2_get_cur_clock_valid(USB_SetupPacket *setup) {
+  static uint8_t valid;
+
+  valid = uac2_clock_source_state.clock_valid ? 1 : 0;
+  usb_control_send_data(&valid, 1);
+}
+
+// GET_CUR on the clock selector: pin 1 (the only clock source)
+static const uint8_t clock_selector_response[4] __attribute__((aligned(4))) = {
+    0x01};
+
+// Audio class requests, sorted by key. Entity requests carry the entity ID
+// in the index byte, interface and endpoint requests the interface number
+// or endpoint address.
+static const usb_ctrl_entry_t uac2_requests[] = {
+    // Streaming interface and endpoint: no controls behind them yet
+    USB_CTRL_HANDLER(0x21, 0, 0, UAC2_INTERFACE_STREAMING,
+                     USB_CTRL_MATCH_ANY_REQUEST, uac2_ack_request),
+    USB_CTRL_HANDLER(0x21, UAC2_REQUEST_CUR, 0, UAC2_ENTITY_ID_CLOCK_SELECTOR,
+                     USB_CTRL_MATCH_ANY_VALUE, uac2_receive_clock_selector),
+    USB_CTRL_HANDLER(0x21, UAC2_REQUEST_CUR, UAC2_CS_SAM_FREQ_CONTROL,
+                     UAC2_ENTITY_ID_CLOCK_SOURCE, USB_CTRL_MATCH_EXACT,
+                     uac2_receive_sample_rate),
+    USB_CTRL_HANDLER(0x22, 0, 0, UAC2_EP_AUDIO_OUT, USB_CTRL_MATCH_ANY_REQUEST,
+                     uac2_ack_request),
+    USB_CTRL_HANDLER(0xa1, 0, 0, UAC2_INTERFACE_STREAMING,
+                     USB_CTRL_MATCH_ANY_REQUEST, uac2_ack_request),
+    USB_CTRL_RESPONSE(0xa1, UAC2_REQUEST_CUR, 0, UAC2_ENTITY_ID_CLOCK_SELECTOR,
+                      USB_CTRL_MATCH_ANY_VALUE, clock_selector_response, 1),
+    USB_CTRL_HANDLER(0xa1, UAC2_REQUEST_CUR, UAC2_CS_SAM_FREQ_CONTROL,
+                     UAC2_ENTITY_ID_CLOCK_SOURCE, USB_CTRL_MATCH_EXACT,
+                     uac2_get_cur_sample_rate),
+    USB_CTRL_HANDLER(0xa1, UAC2_REQUEST_CUR, UAC2_CS_CLOCK_VALID_CONTROL,
+                     UAC2_ENTITY_ID_CLOCK_SOURCE, USB_CTRL_MATCH_EXACT,
+                     uac2_get_cur_clock_valid),
+    USB_CTRL_RESPONSE(0xa1, UAC2_REQUEST_RANGE, UAC2_CS_SAM_FREQ_CONTROL,
+                      UAC2_ENTITY_ID_CLOCK_SOURCE, USB_CTRL_MATCH_EXACT,
+                      sample_rate_range, sizeof(sample_rate_range)),
+    USB_CTRL_HANDLER(0xa2, 0, 0, UAC2_EP_AUDIO_OUT, USB_CTRL_MATCH_ANY_REQUEST,
+                     uac2_ack_request),
+};
+
+const usb_ctrl_table_t uac2_request_table = USB_CTRL_TABLE(uac2_requests);
+
+// Target ring fill in frames at the current rate, leaving room above it
+// for one packet and one DMA period
+static uint32_t uac2_target_frames(void) {
+  uint32_t rate = uac2_clock_source_state.sample_rate;
+  uint32_t frames = rate / 100 * latency_target_us / 10000;
+  uint32_t limit = audio_ring_capacity(&audio_playback_ring) -
+                   (rate / 1000 + 1) - i2s3_period_frames();
+
+  return frames < limit ? frames : limit;
+}
+
+// Ring fill above which the consumer starts dropping frames, so the
+// producer never has to cut a packet short
+static uint32_t uac2_high_water_frames(void) {
+  return audio_ring_capacity(&audio_playback_ring) -
+         2 * (uac2_clock_source_state.sample_rate / 1000 + 1) -
+         i2s3_period_frames();
+}
+
+// Length of one I2S DMA period in us
+static uint32_t uac2_period_us(void) {
+  return i2s3_period_frames() * 1000000 / uac2_clock_source_state.sample_rate;
+}
+
+// I2S period source: only hands out ring data while running, so a stopped
+// or priming stream always plays silence and never loops stale samples
+static uint32_t uac2_stream_source(uint32_t *dst, uint32_t frames) {
+  switch (uac2_stream_state) {
+  case UAC2_STREAM_PRIMING:
+    if (!codec_powered ||
+        audio_ring_fill(&audio_playback_ring) < uac2_target_frames()) {
+      return 0;
     }
-    break;
+    uac2_stream_state = UAC2_STREAM_RUNNING;
+    if (!stream_repriming) {
+      uac2_stream_latency.start_latency_us =
+          (uint32_t)(time_now_us() - stream_event_us) + uac2_period_us();
+    }
+    stream_repriming = false;
+    audio_conceal_reset();
+    // fall through
+  case UAC2_STREAM_RUNNING:
+    // Underruns are concealed and overruns thinned, never cut hard
+    return audio_conceal_read(&audio_playback_ring, dst, frames,
+                              uac2_high_water_frames());
 
-  case UAC2_CS_CLOCK_VALID_CONTROL:
-    if (setup->bRequest == UAC2_REQUEST_CUR) {
-      if (setup->bmRequestType & 0x80) {
-        // GET_CUR: Return clock validity
-        LOG_INFO("GET_CUR Clock Valid: %s\r\n",
-                 uac2_clock_source_state.clock_valid ? "Valid" : "Invalid");
-        response_buffer[0] = uac2_clock_source_state.clock_valid ? 1 : 0;
-        usb_control_send_data(response_buffer, 1);
-      } else {
-        // SET_CUR not typically supported for clock validity
-        usb_control_stall();
-      }
+  case UAC2_STREAM_DRAINING:
+    audio_ring_flush(&audio_playback_ring);
+    if (++stream_silent_periods == 1) {
+      uac2_stream_latency.stop_latency_us =
+          (uint32_t)(time_now_us() - stream_event_us) + uac2_period_us();
     } else {
-      usb_control_stall();
+      // Both halves of the DMA buffer now hold silence
+      uac2_stream_state = UAC2_STREAM_IDLE;
     }
-    break;
+    return 0;
 
   default:
-    LOG_WARN("Unsupported Clock Source control: 0x%02X\r\n", control_selector);
-    usb_control_stall();
-    break;
+    i2s3_pause();
+    return 0;
   }
 }
 
-void uac2_handle_clock_selector_request(USB_SetupPacket *setup,
-                                        uint8_t control_selector) {
-  static uint8_t response_buffer[4];
+#if AUDIO_RX_DMA
+// Frames of the DMA drain in flight, published on transfer complete
+static uint32_t rx_dma_frames = 0;
 
-  LOG_DEBUG("Clock Selector Request: Control=0x%02X, Request=0x%02X\r\n",
-            control_selector, setup->bRequest);
+#define DMA2_STREAM0_FLAGS                                                     \
+  (DMA_LIFCR_CTCIF0 | DMA_LIFCR_CHTIF0 | DMA_LIFCR_CTEIF0 |                    \
+   DMA_LIFCR_CDMEIF0 | DMA_LIFCR_CFEIF0)
 
-  // For simple implementation, we only have one clock source
-  if (setup->bRequest == UAC2_REQUEST_CUR) {
-    if (setup->bmRequestType & 0x80) {
-      // GET_CUR: Return selected clock source
-      response_buffer[0] = UAC2_ENTITY_ID_CLOCK_SOURCE; // Clock source 1
-      usb_control_send_data(response_buffer, 1);
-    } else {
-      // SET_CUR: Select clock source
-      LOG_DEBUG("SET_CUR Clock Selector\r\n");
-      usb_control_send_data(NULL, 0); // ACK
-    }
-  } else {
-    usb_control_stall();
-  }
+// DMA2 Stream0: memory-to-memory from the fixed RX FIFO port (no PINC)
+// into the ring, 32-bit on both sides
+static void uac2_rx_dma_init(void) {
+  RCC->AHB1ENR |= RCC_AHB1ENR_DMA2EN;
+  DMA2_Stream0->CR = DMA_SxCR_DIR_1 | DMA_SxCR_MINC | DMA_SxCR_PSIZE_1 |
+                     DMA_SxCR_MSIZE_1 | DMA_SxCR_PL | DMA_SxCR_TCIE |
+                     DMA_SxCR_TEIE;
+  // Memory-to-memory requires the FIFO (direct mode is not allowed)
+  DMA2_Stream0->FCR = DMA_SxFCR_DMDIS | DMA_SxFCR_FTH;
+  DMA2_Stream0->PAR = (uint32_t)USB_FIFO(0);
+  NVIC_SetPriority(DMA2_Stream0_IRQn, 0);
+  NVIC_EnableIRQ(DMA2_Stream0_IRQn);
 }
 
-static void process_audio_sample(uint8_t *data, uint32_t len) {
-  callback_time_history[callback_time_history_index] = global_time_us;
-  callback_time_history_index =
-      (callback_time_history_index + 1) & (CALLBACK_TIME_HISTORY_SIZE - 1);
+// Hand the packet to DMA2 when it maps 1:1 onto a contiguous run of ring
+// words (16-bit, nothing dropped, no wrap). RXFLVL stays masked until the
+// transfer completes so the next GRXSTSP entry is not popped underneath it.
+static bool uac2_rx_dma_start(uint32_t words, uint32_t frames) {
+  uint32_t head = audio_playback_ring.head & (AUDIO_RING_WORDS - 1);
 
-  uint32_t sample_cnt = len / 4;
-  uint8_t buf_select = (DMA1_Stream5->CR & DMA_SxCR_CT) ? 0 : 1;
+  if (uac2_stream_format.subslot_size != 2 || frames == 0 ||
+      frames != words || head + words > AUDIO_RING_WORDS) {
+    return false;
+  }
 
-  for (uint32_t i = 0; i < sample_cnt; i++) {
-    int16_t x_l = (data[i * 4 + 1] << 8) | data[i * 4];
-    int16_t x_r = (data[i * 4 + 3] << 8) | data[i * 4 + 2];
-    // LOG_DEBUG("sample l: %d\r\n", x_l);
+  USB_OTG_FS->GINTMSK &= ~USB_OTG_GINTMSK_RXFLVLM;
+  rx_dma_frames = frames;
+  DMA2->LIFCR = DMA2_STREAM0_FLAGS;
+  DMA2_Stream0->M0AR = (uint32_t)&audio_playback_ring.buf[head];
+  DMA2_Stream0->NDTR = words;
+  DMA2_Stream0->CR |= DMA_SxCR_EN;
+  uac2_iso_stats.dma_packets++;
+  return true;
+}
 
-    if (buf_select == 0) {
-      audio_rx_samples_0[i * 2] = x_l;
-      audio_rx_samples_0[i * 2 + 1] = x_r;
-    } else {
-      audio_rx_samples_1[i * 2] = x_l;
-      audio_rx_samples_1[i * 2 + 1] = x_r;
+// The CPU cost of a DMA-drained packet is the PROF_AUDIO_UNPACK sample
+// (uac2_rx_dma_start) plus this one; compare with the CPU-copy samples.
+void DMA2_Stream0_IRQHandler(void) {
+  uint32_t prof_start = prof_begin();
+  uint32_t lisr = DMA2->LISR;
+  uint32_t frames = rx_dma_frames;
+
+  DMA2->LIFCR = DMA2_STREAM0_FLAGS;
+  if (lisr & DMA_LISR_TEIF0) {
+    // Pop whatever the DMA left behind and drop the packet
+    for (uint32_t i = DMA2_Stream0->NDTR; i > 0; i--) {
+      (void)usb_reg_read(USB_FIFO(0));
     }
+    uac2_iso_stats.dma_errors++;
+    frames = 0;
   }
+
+  rx_dma_frames = 0;
+  audio_ring_write_end(&audio_playback_ring, frames);
+  USB_OTG_FS->GINTMSK |= USB_OTG_GINTMSK_RXFLVLM;
+  prof_end(PROF_AUDIO_RX_DMA, prof_start);
 }
+#endif
+
+void uac2_init(void) {
+  LOG_INFO("UAC2.0 Audio Class initialized\r\n");
+  uac2_clock_source_state.sample_rate = UAC2_SAMPLE_RATE_48000;
+  uac2_clock_source_state.clock_valid = true;
+  uac2_clock_source_state.clock_locked = true;
+  uac2_stream_format.alt_setting = UAC2_AS_ALT_PCM16;
+  uac2_stream_format.subslot_size = 2;
+  uac2_stream_format.bit_depth = 16;
+  audio_packet_size = AUDIO_PACKET_SIZE(UAC2_SAMPLE_RATE_48000, 2);
+  audio_ring_init(&audio_playback_ring);
+  usb_ctrl_register(&uac2_request_table);
+  uac2_stream_state = UAC2_STREAM_IDLE;
+  i2s3_set_source(uac2_stream_source);
+#if AUDIO_RX_DMA
+  uac2_rx_dma_init();
+#endif
+}
+
+static uint32_t uac2_current_frame(void) {
+  return (USB_DEVICE->DSTS & USB_OTG_DSTS_FNSOF) >> USB_OTG_DSTS_FNSOF_Pos;
+}
+
+// Arm EP1 OUT for the frame after the current one. An iso OUT endpoint only
+// accepts data in the frame parity it was armed for.
+static void uac2_arm_out_endpoint(void) {
+  uint32_t frame = uac2_current_frame();
 
-void uac2_prepare_next_reception(void) {
   USB_OUTEP[1].DOEPTSIZ =
-      (1 << USB_OTG_DOEPTSIZ_PKTCNT_Pos) | AUDIO_BUFFER_SIZE;
-  USB_OUTEP[1].DOEPCTL |= USB_OTG_DOEPCTL_EPENA | USB_OTG_DOEPCTL_CNAK;
+      (1 << USB_OTG_DOEPTSIZ_PKTCNT_Pos) | audio_packet_size;
+  USB_OUTEP[1].DOEPCTL |= ((frame & 1) ? USB_OTG_DOEPCTL_SD0PID_SEVNFRM
+                                       : USB_OTG_DOEPCTL_SODDFRM) |
+                          USB_OTG_DOEPCTL_EPENA | USB_OTG_DOEPCTL_CNAK;
+}
 
-  // LOG_INFO("Audio reception started\r\n");
+void uac2_prepare_next_reception(void) {
+  iso_counting = false;
+  uac2_arm_out_endpoint();
+}
+
+static void uac2_frame_window_reset(void) {
+  frame_window.interval_min = UINT32_MAX;
+  frame_window.interval_max = 0;
+  frame_window.offset_min = UINT32_MAX;
+  frame_window.offset_max = 0;
+  frame_window_count = 0;
+  frame_jitter_sum = 0;
+  frame_offset_sum = 0;
+  frame_offset_count = 0;
+  frame_window_missed_base = uac2_iso_stats.missed;
+}
+
+static void uac2_frame_window_publish(void) {
+  uac2_frame_stats.window++;
+  uac2_frame_stats.interval_min = frame_window.interval_min;
+  uac2_frame_stats.interval_max = frame_window.interval_max;
+  uac2_frame_stats.jitter_avg = frame_jitter_sum / frame_window_count;
+  uac2_frame_stats.offset_min =
+      frame_offset_count ? frame_window.offset_min : 0;
+  uac2_frame_stats.offset_max = frame_window.offset_max;
+  uac2_frame_stats.offset_avg =
+      frame_offset_count ? frame_offset_sum / frame_offset_count : 0;
+  uac2_frame_stats.missed = uac2_iso_stats.missed - frame_window_missed_base;
+  uac2_frame_window_reset();
+}
+
+// Fold the hardware-captured SOF interval into the current window
+static void uac2_sof_timestamp(void) {
+  uint32_t interval = tim2_sof_capture();
+  uint32_t nominal = SystemCoreClock / 1000;
+
+  if (!sof_seen) {
+    sof_seen = true;
+    uac2_frame_window_reset();
+  }
+  if (interval == 0) {
+    return; // First SOF or a lost capture
+  }
+
+  if (interval < frame_window.interval_min) {
+    frame_window.interval_min = interval;
+  }
+  if (interval > frame_window.interval_max) {
+    frame_window.interval_max = interval;
+  }
+  frame_jitter_sum +=
+      interval > nominal ? interval - nominal : nominal - interval;
+
+  if (++frame_window_count == UAC2_FRAME_STATS_WINDOW) {
+    uac2_frame_window_publish();
+  }
 }
 
 void uac2_handle_audio_data_received(void) {
-  uint32_t received_bytes =
-      AUDIO_BUFFER_SIZE - (USB_OUTEP[1].DOEPTSIZ & USB_OTG_DOEPTSIZ_XFRSIZ);
+  uint32_t offset = tim2_now() - tim2_sof_stamp();
 
-  // LOG_DEBUG("Audio data received: %d bytes\r\n", received_bytes);
+  // Samples were already committed to the ring on RXFLVL; just re-arm
+  uac2_arm_out_endpoint();
 
-  process_audio_sample(audio_rx_buf, received_bytes);
+  if (offset < frame_window.offset_min) {
+    frame_window.offset_min = offset;
+  }
+  if (offset > frame_window.offset_max) {
+    frame_window.offset_max = offset;
+  }
+  frame_offset_sum += offset;
+  frame_offset_count++;
 
-  USB_OUTEP[1].DOEPTSIZ =
-      (1 << USB_OTG_DOEPTSIZ_PKTCNT_Pos) | AUDIO_BUFFER_SIZE;
-  USB_OUTEP[1].DOEPCTL |= USB_OTG_DOEPCTL_EPENA | USB_OTG_DOEPCTL_CNAK;
+  uac2_iso_stats.received++;
+  uac2_iso_stats.last_rx_frame = uac2_current_frame();
+  if (!iso_counting) {
+    iso_counting = true;
+    uac2_iso_stats.frames = 0;
+    uac2_iso_stats.received = 1;
+    uac2_iso_stats.missed = 0;
+  }
+}
+
+// The frame the endpoint was armed for ended without data. The endpoint is
+// still enabled for that (now past) parity, so point it at the next frame
+// instead of leaving it stuck until the next SET_INTERFACE.
+void uac2_handle_incomplete_iso_out(void) {
+  uint32_t doepctl = USB_OUTEP[1].DOEPCTL;
+  uint32_t frame = uac2_current_frame();
+
+  if (!stream_active || !(doepctl & USB_OTG_DOEPCTL_EPENA)) {
+    return;
+  }
+
+  if (((doepctl & DOEPCTL_EONUM) != 0) == ((frame & 1) != 0)) {
+    USB_OUTEP[1].DOEPCTL |= (frame & 1) ? USB_OTG_DOEPCTL_SD0PID_SEVNFRM
+                                        : USB_OTG_DOEPCTL_SODDFRM;
+    uac2_iso_stats.incomplete++;
+  }
+}
+
+// Called on every SOF while streaming. A packet for frame N may still be
+// pending behind this SOF in the same interrupt, so judge one frame late.
+static void uac2_account_frame(uint32_t frame) {
+  if (!iso_counting) {
+    return;
+  }
+
+  uint32_t frames = ++uac2_iso_stats.frames;
+  if (frames < 2) {
+    return;
+  }
+
+  uint32_t expected = frames - 1;
+  uint32_t seen = uac2_iso_stats.received + uac2_iso_stats.missed;
+  if (expected > seen) {
+    uac2_iso_stats.missed += expected - seen;
+    uac2_iso_stats.last_missed_frame = (frame - 2) & 0x3FFF;
+  }
+}
+
+void uac2_log_stream_stats(void) {
+  uint32_t ticks_per_us = SystemCoreClock / 1000000;
+
+  if (!stream_active) {
+    return;
+  }
+  LOG_INFO("iso OUT: frames=%d received=%d missed=%d (last %d) "
+           "incomplete=%d\r\n",
+           uac2_iso_stats.frames, uac2_iso_stats.received,
+           uac2_iso_stats.missed, uac2_iso_stats.last_missed_frame,
+           uac2_iso_stats.incomplete);
+  LOG_INFO("SOF: interval %d..%d us, jitter %d ns, offset %d..%d us "
+           "(avg %d us)\r\n",
+           uac2_frame_stats.interval_min / ticks_per_us,
+           uac2_frame_stats.interval_max / ticks_per_us,
+           uac2_frame_stats.jitter_avg * 1000 / ticks_per_us,
+           uac2_frame_stats.offset_min / ticks_per_us,
+           uac2_frame_stats.offset_max / ticks_per_us,
+           uac2_frame_stats.offset_avg / ticks_per_us);
+  LOG_INFO("conceal: underruns=%d (%d frames, %d faded) drops=%d "
+           "(%d frames)\r\n",
+           audio_conceal_stats.underruns, audio_conceal_stats.concealed_frames,
+           audio_conceal_stats.fades, audio_conceal_stats.drops,
+           audio_conceal_stats.dropped_frames);
 }
 
 void uac2_read_audio_from_fifo(uint32_t byte_count) {
+  uint32_t prof_start = prof_begin();
   uint32_t word_count = (byte_count + 3) / 4;
-  uint32_t *fifo = USB_FIFO(0); // RXFIFO is always FIFO(0)
+  volatile uint32_t *fifo = USB_FIFO(0); // RXFIFO is always FIFO(0)
+  uint32_t frame_bytes = uac2_stream_format.subslot_size * 2;
+  uint32_t frames = audio_ring_write_begin(&audio_playback_ring,
+                                           byte_count / frame_bytes);
+
+#if AUDIO_RX_DMA
+  if (uac2_rx_dma_start(word_count, frames)) {
+    prof_end(PROF_AUDIO_UNPACK, prof_start);
+    return;
+  }
+#endif
+
+  switch (uac2_stream_format.subslot_size) {
+  case 4:
+    audio_unpack_pcm24_in_32(&audio_playback_ring, fifo, word_count, frames);
+    break;
+  case 3:
+    audio_unpack_pcm24_packed(&audio_playback_ring, fifo, word_count, frames);
+    break;
+  default:
+    audio_unpack_pcm16(&audio_playback_ring, fifo, word_count, frames);
+    break;
+  }
+
+  audio_ring_write_end(&audio_playback_ring, frames);
+  prof_end(PROF_AUDIO_UNPACK, prof_start);
+}
+
+static uint32_t uac2_nominal_feedback(void) {
+  return uac2_feedback_nominal(uac2_clock_source_state.sample_rate);
+}
+
+void uac2_stream_start(void) {
+  uac2_feedback_value = uac2_nominal_feedback();
+  feedback_sof_count = 0;
+  stream_active = true;
+
+  stream_event_us = time_now_us();
+  stream_repriming = false;
+  uac2_stream_state = UAC2_STREAM_PRIMING;
+  uac2_stream_latency.starts++;
+  i2s3_resume();
+  // The played count stood still while paused; take the baseline from here
+  feedback_last_played = i2s3_frames_played();
+}
+
+// A rate change flushed the ring mid-stream: prime again at the new rate
+// without counting a new start or disturbing the latency statistics
+void uac2_stream_reprime(void) {
+  uac2_feedback_value = uac2_nominal_feedback();
+  feedback_sof_count = 0;
+  feedback_last_played = i2s3_frames_played();
+  stream_repriming = true;
+  uac2_stream_state = UAC2_STREAM_PRIMING;
+}
 
-  audio_buffer_index = 0;
+void uac2_stream_stop(void) {
+  stream_active = false;
 
-  for (uint32_t i = 0; i < word_count; i++) {
-    uint32_t data = *fifo;
-    if (audio_buffer_index + 3 < sizeof(audio_rx_buf)) {
-      audio_rx_buf[audio_buffer_index++] = (uint8_t)(data >> 0) & 0xff;
-      audio_rx_buf[audio_buffer_index++] = (uint8_t)(data >> 8) & 0xff;
-      audio_rx_buf[audio_buffer_index++] = (uint8_t)(data >> 16) & 0xff;
-      audio_rx_buf[audio_buffer_index++] = (uint8_t)(data >> 24) & 0xff;
+  if (uac2_stream_state != UAC2_STREAM_IDLE) {
+    stream_event_us = time_now_us();
+    stream_silent_periods = 0;
+    uac2_stream_state = UAC2_STREAM_DRAINING;
+    uac2_stream_latency.stops++;
+  }
+}
+
+// Main loop: the DAC is powered over I2C, which cannot run in the I2S or
+// USB interrupts. Standby once idle; wake it up as soon as a stream starts
+// (priming holds the output silent until it is powered).
+void uac2_stream_task(void) {
+  bool want = uac2_stream_state != UAC2_STREAM_IDLE;
+
+  if (want == codec_powered) {
+    return;
+  }
+  cs43l22_set_power(want);
+  codec_powered = want;
+  if (want) {
+    LOG_INFO("DAC on\r\n");
+  } else {
+    LOG_INFO("DAC standby (start %d us, stop %d us)\r\n",
+             uac2_stream_latency.start_latency_us,
+             uac2_stream_latency.stop_latency_us);
+  }
+}
+
+static void uac2_update_feedback(void) {
+  uint32_t played = i2s3_frames_played();
+  uint32_t consumed = played - feedback_last_played;
+  feedback_last_played = played;
+
+  // Steer the ring towards the jitter buffer target so the measured rate
+  // cannot drift it
+  int32_t fill_error = (int32_t)uac2_target_frames() -
+                       (int32_t)audio_ring_fill(&audio_playback_ring);
+  uint32_t value = uac2_feedback_calc(uac2_clock_source_state.sample_rate,
+                                      consumed, fill_error);
+
+  uac2_feedback_value = value;
+  uac2_feedback_history[feedback_history_index] = value;
+  feedback_history_index =
+      (feedback_history_index + 1) & (UAC2_FEEDBACK_HISTORY_SIZE - 1);
+}
+
+bool uac2_set_latency(uint32_t target_us, bool adaptive) {
+  if (target_us < UAC2_LATENCY_US_MIN || target_us > UAC2_LATENCY_US_MAX) {
+    return false;
+  }
+  latency_target_us = target_us;
+  latency_adaptive = adaptive;
+  LOG_INFO("Latency target: %d us%s\r\n", target_us,
+           adaptive ? " (adaptive)" : "");
+  return true;
+}
+
+void uac2_get_latency(UAC2_Latency *latency) {
+  latency->target_us = latency_target_us;
+  latency->target_frames = uac2_target_frames();
+  latency->latency_frames =
+      audio_ring_fill(&audio_playback_ring) + i2s3_period_frames();
+  latency->adaptive = latency_adaptive;
+  latency->grows = latency_grows;
+  latency->shrinks = latency_shrinks;
+}
+
+// Main loop, once a second: adapt the target to the underrun history
+void uac2_latency_task(void) {
+  static uint32_t last_underruns = 0;
+  static uint32_t clean_seconds = 0;
+  uint32_t underruns = audio_playback_ring.underrun_count;
+  bool glitched = underruns != last_underruns;
+
+  last_underruns = underruns;
+  if (uac2_stream_state == UAC2_STREAM_PRIMING && stream_repriming) {
+    return; // Hold the clean-run count across a rate change
+  }
+  if (!latency_adaptive || uac2_stream_state != UAC2_STREAM_RUNNING) {
+    clean_seconds = 0;
+    return;
+  }
+
+  if (glitched) {
+    clean_seconds = 0;
+    if (latency_target_us < UAC2_LATENCY_US_MAX) {
+      latency_target_us =
+          latency_target_us + UAC2_LATENCY_GROW_US < UAC2_LATENCY_US_MAX
+              ? latency_target_us + UAC2_LATENCY_GROW_US
+              : UAC2_LATENCY_US_MAX;
+      latency_grows++;
+      LOG_INFO("Latency target up: %d us\r\n", latency_target_us);
+    }
+  } else if (++clean_seconds >= UAC2_LATENCY_CLEAN_SECONDS) {
+    clean_seconds = 0;
+    if (latency_target_us > UAC2_LATENCY_US_MIN) {
+      latency_target_us =
+          latency_target_us - UAC2_LATENCY_SHRINK_US > UAC2_LATENCY_US_MIN
+              ? latency_target_us - UAC2_LATENCY_SHRINK_US
+              : UAC2_LATENCY_US_MIN;
+      latency_shrinks++;
+    }
+  }
+}
+
+// Called from SOF for frame N: the host's IN token for frame N follows this
+// SOF, so the packet has to be armed for N's parity, not N+1's.
+static void uac2_send_feedback(void) {
+  uint32_t frame = uac2_current_frame();
+  uint32_t diepctl = USB_INEP[1].DIEPCTL;
+
+  if (diepctl & USB_OTG_DIEPCTL_EPENA) {
+    if (((diepctl & USB_OTG_DIEPCTL_EONUM_DPID) != 0) == ((frame & 1) != 0)) {
+      // Already armed for this frame
+      return;
+    }
+
+    // Host did not poll last frame: drop the stale value and requeue.
+    // If the core does not answer, try again on the next SOF.
+    if (!usb_in_ep_disable(1)) {
+      return;
     }
   }
+
+  USB_INEP[1].DIEPTSIZ = (1 << USB_OTG_DIEPTSIZ_MULCNT_Pos) |
+                         (1 << USB_OTG_DIEPTSIZ_PKTCNT_Pos) | 3;
+  USB_INEP[1].DIEPCTL |= ((frame & 1) ? USB_OTG_DIEPCTL_SODDFRM
+                                      : USB_OTG_DIEPCTL_SD0PID_SEVNFRM) |
+                         USB_OTG_DIEPCTL_EPENA | USB_OTG_DIEPCTL_CNAK;
+  usb_reg_write(USB_FIFO(1), uac2_feedback_value);
+}
+
+void uac2_handle_sof(void) {
+  uac2_sof_timestamp();
+
+  if (!stream_active) {
+    return;
+  }
+
+  uac2_account_frame(uac2_current_frame());
+
+  if (++feedback_sof_count == (1 << UAC2_FEEDBACK_PERIOD_SHIFT)) {
+    feedback_sof_count = 0;
+    uac2_update_feedback();
+  }
+
+  uac2_send_feedback();
 }
@@ -0,0 +1,112 @@
+#include "usb_ctrl.h"
+#include "log.h"
+#include "usart.h"
+#include <stddef.h>
+
+static const usb_ctrl_table_t *usb_ctrl_tables[USB_CTRL_MAX_TABLES];
+static uint32_t usb_ctrl_table_count = 0;
+
+const uint32_t usb_ctrl_masks[USB_CTRL_MASK_COUNT] = {
+    USB_CTRL_MATCH_EXACT,
+    USB_CTRL_MATCH_ANY_VALUE,
+    USB_CTRL_MATCH_REQUEST,
+    USB_CTRL_MATCH_ANY_REQUEST,
+};
+
+// インデックスバイト: インターフェース宛てはエンティティID（無ければ
+// インターフェース番号）, エンドポイント宛てはエンドポイントアドレス
+static uint8_t usb_ctrl_index(const USB_SetupPacket *setup) {
+  switch (setup->bmRequestType & 0x1F) {
+  case 0x01:
+    return (setup->wIndex >> 8) ? (setup->wIndex >> 8) : (setup->wIndex & 0xFF);
+  case 0x02:
+    return setup->wIndex & 0xFF;
+  default:
+    return 0; // デバイス宛ての wIndex（言語IDなど）はキーに含めない
+  }
+}
+
+// テーブルを登録する。キー順に並んでいなければ登録しない
+bool usb_ctrl_register(const usb_ctrl_table_t *table) {
+  if (usb_ctrl_table_count >= USB_CTRL_MAX_TABLES) {
+    LOG_ERROR("usb_ctrl: too many tables\r\n");
+    return false;
+  }
+  for (uint16_t i = 1; i < table->count; i++) {
+    if (table->entries[i].key < table->entries[i - 1].key) {
+      LOG_ERROR("usb_ctrl: table not sorted at entry %d\r\n", i);
+      return false;
+    }
+  }
+  usb_ctrl_tables[usb_ctrl_table_count++] = table;
+  return true;
+}
+
+void usb_ctrl_reset(void) { usb_ctrl_table_count = 0; }
+
+// key と mask が一致するエントリを二分探索で探す
+static const usb_ctrl_entry_t *usb_ctrl_find(const usb_ctrl_table_t *table,
+                                             uint32_t key, uint32_t mask) {
+  uint32_t lo = 0;
+  uint32_t hi = table->count;
+
+  // key 以上の最初のエントリ
+  while (lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    if (table->entries[mid].key < key) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  // 同じキーでワイルドカードだけ違うエントリが並ぶことがある
+  for (; lo < table->count && table->entries[lo].key == key; lo++) {
+    if (table->entries[lo].mask == mask) {
+      return &table->entries[lo];
+    }
+  }
+  return NULL;
+}
+
+// SETUP のキー（マスク前）
+uint32_t usb_ctrl_key(const USB_SetupPacket *setup) {
+  return USB_CTRL_KEY(setup->bmRequestType, setup->bRequest,
+                      setup->wValue >> 8, usb_ctrl_index(setup));
+}
+
+// SETUP に当たるエントリを登録テーブルから探す。無ければ NULL
+const usb_ctrl_entry_t *usb_ctrl_lookup(const USB_SetupPacket *setup) {
+  uint32_t key = usb_ctrl_key(setup);
+
+  for (uint32_t m = 0; m < USB_CTRL_MASK_COUNT; m++) {
+    uint32_t mask = usb_ctrl_masks[m];
+
+    for (uint32_t t = 0; t < usb_ctrl_table_count; t++) {
+      const usb_ctrl_entry_t *entry =
+          usb_ctrl_find(usb_ctrl_tables[t], key & mask, mask);
+      if (entry != NULL) {
+        return entry;
+      }
+    }
+  }
+  return NULL;
+}
+
+// SETUP を登録テーブルから探して処理する。見つからなければ false
+bool usb_ctrl_dispatch(USB_SetupPacket *setup) {
+  const usb_ctrl_entry_t *entry = usb_ctrl_lookup(setup);
+
+  if (entry == NULL) {
+    return false;
+  }
+
+  LOG_DEBUG("usb_ctrl: key=0x%08X mask=0x%08X\r\n", entry->key, entry->mask);
+  if (entry->handler != NULL) {
+    entry->handler(setup);
+  } else {
+    uint16_t len = setup->wLength < entry->response_len ? setup->wLength
+                                                        : entry->response_len;
+    usb_control_send_data((uint8_t *)entry->response, len);
+  }
+  return true;
+}
@@ -1,7 +1,7 @@
 #include "usb_desc.h"
 #include "usb_audio.h"
 
-const USB_DeviceDescriptor device_descriptor = {
+const USB_DeviceDescriptor device_descriptor __attribute__((aligned(4))) = {
     .bLength = sizeof(USB_DeviceDescriptor),
     .bDescriptorType = 0x01,
     .bcdUSB = 0x0200,
@@ -18,7 +18,76 @@ const USB_DeviceDescriptor device_descriptor = {
     .bNumConfigurations = 0x01,
 };
 
-const UAC2_ConfigurationDescriptor configuration_descriptor = {
+// Operational alternate setting with the given subslot size / resolution
+#define UAC2_AS_ALT_SETTING(alt, subslot, bits)                                \
+  {                                                                            \
+    .as_interface =                                                            \
+        {                                                                      \
+            .bLength = sizeof(USB_InterfaceDescriptor),                        \
+            .bDescriptorType = 0x04, /* INTERFACE */                           \
+            .bInterfaceNumber = 1,                                             \
+            .bAlternateSetting = (alt),                                        \
+            .bNumEndpoints = 2, /* Data OUT + feedback IN */                   \
+            .bInterfaceClass = USB_CLASS_AUDIO,                                \
+            .bInterfaceSubClass = USB_SUBCLASS_AUDIOSTREAMING,                 \
+            .bInterfaceProtocol = UAC2_AF_VERSION_02_00,                       \
+            .iInterface = 0,                                                   \
+        },                                                                     \
+    .as_general =                                                              \
+        {                                                                      \
+            .bLength = sizeof(UAC2_ASGeneralDescriptor),                       \
+            .bDescriptorType = USB_DTYPE_CS_INTERFACE,                         \
+            .bDescriptorSubtype = UAC2_AS_GENERAL,                             \
+            .bTerminalLink = UAC2_ENTITY_ID_INPUT_TERMINAL,                    \
+            .bmControls = 0x00,                                                \
+            .bFormatType = UAC2_FORMAT_TYPE_I,                                 \
+            .bmFormats = UAC2_FORMAT_PCM,                                      \
+            .bNrChannels = 2,                                                  \
+            .bmChannelConfig = 0x00000003, /* Left Front + Right Front */      \
+            .iChannelNames = 0,                                                \
+        },                                                                     \
+    .format_type =                                                             \
+        {                                                                      \
+            .bLength = sizeof(UAC2_FormatTypeDescriptor),                      \
+            .bDescriptorType = USB_DTYPE_CS_INTERFACE,                         \
+            .bDescriptorSubtype = UAC2_FORMAT_TYPE,                            \
+            .bFormatType = UAC2_FORMAT_TYPE_I,                                 \
+            .bSubslotSize = (subslot),                                         \
+            .bBitResolution = (bits),                                          \
+        },                                                                     \
+    .as_endpoint =                                                             \
+        {                                                                      \
+            .bLength = sizeof(USB_EndpointDescriptor),                         \
+            .bDescriptorType = 0x05,  /* ENDPOINT */                           \
+            .bEndpointAddress = 0x01, /* EP1 OUT */                            \
+            .bmAttributes = 0x05,     /* Isochronous, Asynchronous */          \
+            .wMaxPacketSize =                                                  \
+                AUDIO_PACKET_SIZE(UAC2_SAMPLE_RATE_MAX, subslot),              \
+            .bInterval = 1, /* 1ms interval (Full Speed) */                    \
+        },                                                                     \
+    .as_ep_desc =                                                              \
+        {                                                                      \
+            .bLength = sizeof(UAC2_ASEndpointDescriptor),                      \
+            .bDescriptorType = USB_DTYPE_CS_ENDPOINT,                          \
+            .bDescriptorSubtype = UAC2_EP_GENERAL,                             \
+            .bmAttributes = 0x00,                                              \
+            .bmControls = 0x00,                                                \
+            .bLockDelayUnits = 0x02, /* Decoded PCM samples */                 \
+            .wLockDelay = 0x0000,                                              \
+        },                                                                     \
+    .as_fb_endpoint =                                                          \
+        {                                                                      \
+            .bLength = sizeof(USB_EndpointDescriptor),                         \
+            .bDescriptorType = 0x05,  /* ENDPOINT */                           \
+            .bEndpointAddress = 0x81, /* EP1 IN */                             \
+            .bmAttributes = 0x11,     /* Isochronous, Feedback */              \
+            .wMaxPacketSize = 3,      /* 10.14 fixed point (Full Speed) */     \
+            .bInterval = 1,           /* Every frame */                        \
+        },                                                                     \
+  }
+
+const UAC2_ConfigurationDescriptor configuration_descriptor
+    __attribute__((aligned(4))) = {
     // Configuration Descriptor
     .config =
         {
@@ -84,8 +153,8 @@ const UAC2_ConfigurationDescriptor configuration_descriptor = {
             .bDescriptorType = USB_DTYPE_CS_INTERFACE, // CS_INTERFACE (0x24)
             .bDescriptorSubtype = UAC2_CLOCK_SOURCE,   // CLOCK_SOURCE (0x0A)
             .bClockID = UAC2_ENTITY_ID_CLOCK_SOURCE,   // Clock source ID
-            .bmAttributes = 0x01,                      // Internal fixed clock
-            .bmControls = 0x01,     // Clock frequency control (read-only)
+            .bmAttributes = 0x03, // Internal programmable clock
+            .bmControls = 0x07,   // Frequency (read/write), validity (read)
             .bAssocTerminal = 0x00, // No associated terminal
             .iClockSource = 0       // No string descriptor
         },
@@ -140,69 +209,17 @@ const UAC2_ConfigurationDescriptor configuration_descriptor = {
          .bInterfaceProtocol = UAC2_AF_VERSION_02_00, // UAC 2.0 (0x20)
          .iInterface = 0},
 
-    // Audio Streaming Interface (Interface 1, Alt 1 - Operational)
-    .as_interface_alt1 =
-        {.bLength = sizeof(USB_InterfaceDescriptor),
-         .bDescriptorType = 0x04, // INTERFACE
-         .bInterfaceNumber = 1,
-         .bAlternateSetting = 1,
-         .bNumEndpoints = 1,                 // One isochronous endpoint
-         .bInterfaceClass = USB_CLASS_AUDIO, // Audio (0x01)
-         .bInterfaceSubClass =
-             USB_SUBCLASS_AUDIOSTREAMING,             // Audio Streaming (0x02)
-         .bInterfaceProtocol = UAC2_AF_VERSION_02_00, // UAC 2.0 (0x20)
-         .iInterface = 0},
-
-    // Audio Streaming General Descriptor
-    .as_general =
-        {
-            .bLength = sizeof(UAC2_ASGeneralDescriptor),
-            .bDescriptorType = USB_DTYPE_CS_INTERFACE, // CS_INTERFACE (0x24)
-            .bDescriptorSubtype = UAC2_AS_GENERAL,     // AS_GENERAL (0x01)
-            .bTerminalLink =
-                UAC2_ENTITY_ID_INPUT_TERMINAL, // Connected to input terminal
-            .bmControls = 0x00,                // No controls
-            .bFormatType = UAC2_FORMAT_TYPE_I, // Format Type I (0x01)
-            .bmFormats = UAC2_FORMAT_PCM,      // PCM format (0x00000001)
-            .bNrChannels = 2,                  // 2 channels
-            .bmChannelConfig = 0x00000003,     // Left Front + Right Front
-            .iChannelNames = 0                 // No string descriptor
-        },
-
-    // Type I Format Descriptor
-    .format_type =
-        {
-            .bLength = sizeof(UAC2_FormatTypeDescriptor),
-            .bDescriptorType = USB_DTYPE_CS_INTERFACE, // CS_INTERFACE (0x24)
-            .bDescriptorSubtype = UAC2_FORMAT_TYPE,    // FORMAT_TYPE (0x02)
-            .bFormatType = UAC2_FORMAT_TYPE_I,         // Format Type I (0x01)
-            .bSubslotSize = 2,    // 2 bytes per sample (16bit)
-            .bBitResolution = 16, // 16 bits per sample
-        },
-
-    // Audio Streaming Endpoint (Isochronous OUT)
-    .as_endpoint =
+    // Audio Streaming Interface (Interface 1, Alt 1..3 - Operational)
+    .as_alt =
         {
-            .bLength = sizeof(USB_EndpointDescriptor),
-            .bDescriptorType = 0x05,  // ENDPOINT
-            .bEndpointAddress = 0x01, // EP1 OUT
-            .bmAttributes = 0x09,     // Isochronous, Adaptive
-            .wMaxPacketSize = 192,    // 48kHz * 2ch * 2bytes + overhead
-            .bInterval = 1            // 1ms interval (Full Speed)
+            UAC2_AS_ALT_SETTING(UAC2_AS_ALT_PCM16, 2, 16),
+            UAC2_AS_ALT_SETTING(UAC2_AS_ALT_PCM24_IN_32, 4, 24),
+            UAC2_AS_ALT_SETTING(UAC2_AS_ALT_PCM24_PACKED, 3, 24),
         },
+};
 
-    // Audio Streaming Endpoint Descriptor
-    .as_ep_desc = {
-        .bLength = sizeof(UAC2_ASEndpointDescriptor),
-        .bDescriptorType = USB_DTYPE_CS_ENDPOINT, // CS_ENDPOINT (0x25)
-        .bDescriptorSubtype = UAC2_EP_GENERAL,    // EP_GENERAL (0x01)
-        .bmAttributes = 0x00,                     // No attributes
-        .bmControls = 0x00,                       // No controls
-        .bLockDelayUnits = 0x02,                  // Decoded PCM samples
-        .wLockDelay = 0x0000                      // No lock delay
-    }};
-
-const USB_DeviceQualifierDescriptor device_qualifier_descriptor = {
+const USB_DeviceQualifierDescriptor device_qualifier_descriptor
+    __attribute__((aligned(4))) = {
     .bLength = sizeof(USB_DeviceQualifierDescriptor),
     .bDescriptorType = 0x06, // DEVICE_QUALIFIER
     .bcdUSB = 0x0200,        // USB 2.0
@@ -214,14 +231,14 @@ const USB_DeviceQualifierDescriptor device_qualifier_descriptor = {
     .bReserved = 0};
 
 // Language ID descriptor (English US)
-const uint8_t string_lang_descriptor[] = {
+const uint8_t string_lang_descriptor[] __attribute__((aligned(4))) = {
     4,         // bLength
     0x03,      // bDescriptorType (STRING)
     0x09, 0x04 // wLANGID (0x0409 = English)
 };
 
 // Manufacturer string
-const uint8_t string_manufacturer_descriptor[] = {
+const uint8_t string_manufacturer_descriptor[] __attribute__((aligned(4))) = {
     18,   // bLength
     0x03, // bDescriptorType (STRING)
     'y',  0, 'a', 0, 'm', 0, 'a', 0,
@@ -229,7 +246,7 @@ const uint8_t string_manufacturer_descriptor[] = {
 };
 
 // Product string
-const uint8_t string_product_descriptor[] = {
+const uint8_t string_product_descriptor[] __attribute__((aligned(4))) = {
     28,   // bLength
     0x03, // bDescriptorType (STRING)
     'y',  0, 'a', 0, 'm', 0, 'a', 0, 's', 0, 'h', 0, 'u', 0,
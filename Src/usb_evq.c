@@ -0,0 +1,43 @@
+#include "usb_evq.h"
+#include <stddef.h>
+#include <stm32f411xe.h>
+
+#define USB_EVQ_MASK (USB_EVQ_SLOTS - 1)
+
+void usb_evq_init(usb_evq_t *q) {
+  q->head = 0;
+  q->tail = 0;
+  q->overflow_count = 0;
+}
+
+// 空きスロットを取る（プロデューサ側）。満杯なら NULL
+usb_event_t *usb_evq_alloc(usb_evq_t *q) {
+  if (q->head - q->tail >= USB_EVQ_SLOTS) {
+    q->overflow_count++;
+    return NULL;
+  }
+  return &q->slot[q->head & USB_EVQ_MASK];
+}
+
+// usb_evq_alloc で取ったスロットを公開する
+void usb_evq_commit(usb_evq_t *q) {
+  // スロットを書き終えてから head を公開する
+  __DMB();
+  q->head++;
+}
+
+// 先頭のイベントを見る（コンシューマ側）。空なら NULL
+usb_event_t *usb_evq_peek(usb_evq_t *q) {
+  if (q->head == q->tail) {
+    return NULL;
+  }
+  // head を読んでからスロットを読む
+  __DMB();
+  return &q->slot[q->tail & USB_EVQ_MASK];
+}
+
+// usb_evq_peek で見たイベントを処理し終えたら返す
+void usb_evq_release(usb_evq_t *q) {
+  __DMB();
+  q->tail++;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+// ホスト上のマイクロベンチマーク用の計時
+// 絶対値はホストの CPU のもの。同じ実行の中での前後比較に使う
+#define BENCH_REPEAT 7
+
+static inline uint64_t bench_now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// fn(ctx, iters) を BENCH_REPEAT 回計り, 1回あたりの最短時間 [ns] を返す
+static inline double bench_best_ns(void (*fn)(void *ctx, uint32_t iters),
+                                   void *ctx, uint32_t iters) {
+  double best = 0;
+
+  fn(ctx, iters); // キャッシュを温める
+  for (int r = 0; r < BENCH_REPEAT; r++) {
+    uint64_t start = bench_now_ns();
+    fn(ctx, iters);
+    double ns = (double)(bench_now_ns() - start) / iters;
+    if (r == 0 || ns < best) {
+      best = ns;
+    }
+  }
+  return best;
+}
@@ -0,0 +1,187 @@
+#include "audio_ring.h"
+#include "audio_unpack.h"
+#include "bench.h"
+#include "test.h"
+#include "usb_audio.h"
+#include <stdint.h>
+
+// RXFLVL ハンドラの展開カーネル（RX FIFO → リング）の書式ごとのスループット
+// と, バイトバッファを経由していた頃の3パスとの比較
+// FIFO は読むたびに次のワードが出てくるポートなので, ホストでは
+// 1ワードの volatile 変数を読み続けて代わりにする
+#define PACKETS 20000
+
+static audio_ring_t ring;
+static volatile uint32_t fifo_port;
+
+// 比較用: FIFO から直接展開する前の3パス
+//   FIFO → バイトバッファ → （24bit は）展開バッファ → audio_ring_write
+static uint8_t before_rx_buf[AUDIO_EP_MAX_PACKET_SIZE]
+    __attribute__((aligned(4)));
+static uint32_t before_unpack_buf[AUDIO_EP_MAX_PACKET_SIZE];
+
+static uint32_t before_pcm16(const uint8_t *data, uint32_t len,
+                             const uint32_t **frames) {
+  *frames = (const uint32_t *)data;
+  return len / 4;
+}
+
+static uint32_t before_pcm24_in_32(const uint8_t *data, uint32_t len,
+                                   const uint32_t **frames) {
+  const uint32_t *src = (const uint32_t *)data;
+  uint32_t words = len / 8 * 2;
+
+  for (uint32_t i = 0; i < words; i++) {
+    before_unpack_buf[i] = audio_i2s_word(src[i]);
+  }
+  *frames = before_unpack_buf;
+  return words / 2;
+}
+
+static uint32_t before_pcm24_packed(const uint8_t *data, uint32_t len,
+                                    const uint32_t **frames) {
+  uint32_t words = len / 6 * 2;
+
+  for (uint32_t i = 0; i < words; i++) {
+    const uint8_t *p = &data[i * 3];
+    uint32_t sample = ((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16) |
+                      ((uint32_t)p[2] << 24);
+    before_unpack_buf[i] = audio_i2s_word(sample);
+  }
+  *frames = before_unpack_buf;
+  return words / 2;
+}
+
+typedef struct {
+  const char *name;
+  uint32_t subslot_size;
+  uint32_t frame_words;
+  void (*unpack)(audio_ring_t *ring, volatile uint32_t *fifo, uint32_t words,
+                 uint32_t frames);
+  uint32_t (*before)(const uint8_t *data, uint32_t len,
+                     const uint32_t **frames);
+} format_t;
+
+static const format_t formats[] = {
+    {"pcm16", 2, 1, audio_unpack_pcm16, before_pcm16},
+    {"pcm24_in_32", 4, 2, audio_unpack_pcm24_in_32, before_pcm24_in_32},
+    {"pcm24_packed", 3, 2, audio_unpack_pcm24_packed, before_pcm24_packed},
+};
+
+typedef struct {
+  const format_t *format;
+  uint32_t bytes; // 1パケットのバイト数
+} packet_t;
+
+// uac2_read_audio_from_fifo と同じ手順で1パケットずつ展開する
+static void run_unpack(void *ctx, uint32_t iters) {
+  const packet_t *p = ctx;
+  uint32_t words = (p->bytes + 3) / 4;
+  uint32_t frame_bytes = p->format->subslot_size * 2;
+
+  for (uint32_t n = 0; n < iters; n++) {
+    uint32_t frames = audio_ring_write_begin(&ring, p->bytes / frame_bytes);
+    p->format->unpack(&ring, &fifo_port, words, frames);
+    audio_ring_write_end(&ring, frames);
+    audio_ring_flush(&ring);
+  }
+}
+
+static void run_before(void *ctx, uint32_t iters) {
+  const packet_t *p = ctx;
+  uint32_t words = (p->bytes + 3) / 4;
+
+  for (uint32_t n = 0; n < iters; n++) {
+    const uint32_t *frames;
+    uint32_t index = 0;
+
+    for (uint32_t i = 0; i < words; i++) {
+      uint32_t data = fifo_port;
+      if (index + 3 < sizeof(before_rx_buf)) {
+        before_rx_buf[index++] = (uint8_t)(data >> 0) & 0xff;
+        before_rx_buf[index++] = (uint8_t)(data >> 8) & 0xff;
+        before_rx_buf[index++] = (uint8_t)(data >> 16) & 0xff;
+        before_rx_buf[index++] = (uint8_t)(data >> 24) & 0xff;
+      }
+    }
+    uint32_t count = p->format->before(before_rx_buf, p->bytes, &frames);
+    audio_ring_write(&ring, frames, count);
+    audio_ring_flush(&ring);
+  }
+}
+
+// FIFO に同じワードが並んでいる時の展開結果を確かめる
+static void test_unpack_words(void) {
+  packet_t p = {&formats[0], 48 * 4};
+
+  fifo_port = 0x44332211;
+
+  audio_ring_set_frame_words(&ring, 1);
+  run_unpack(&p, 1);
+  CHECK_EQ(ring.buf[(ring.head - 1) & (AUDIO_RING_WORDS - 1)], 0x44332211);
+
+  p.format = &formats[1];
+  p.bytes = 48 * 8;
+  audio_ring_set_frame_words(&ring, 2);
+  run_unpack(&p, 1);
+  CHECK_EQ(ring.buf[(ring.head - 1) & (AUDIO_RING_WORDS - 1)], 0x22114433);
+
+  // 3ワード = 4サンプル: 11 22 33 | 44 11 22 | 33 44 11 | 22 33 44
+  p.format = &formats[2];
+  p.bytes = 48 * 6;
+  run_unpack(&p, 1);
+  for (uint32_t i = 4; i > 0; i--) {
+    static const uint32_t expect[4] = {0x11003322, 0x44002211, 0x33001144,
+                                       0x22004433};
+    CHECK_EQ(ring.buf[(ring.head - i) & (AUDIO_RING_WORDS - 1)], expect[4 - i]);
+  }
+}
+
+// 3パスの頃と同じワードがリングに入る
+static void test_unpack_matches_before(void) {
+  uint32_t after[AUDIO_EP_MAX_PACKET_SIZE / 4];
+
+  fifo_port = 0x8C7B6A59;
+  for (uint32_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+    packet_t p = {&formats[f], 96 * formats[f].subslot_size * 2};
+    uint32_t words = 96 * formats[f].frame_words;
+
+    audio_ring_set_frame_words(&ring, formats[f].frame_words);
+    run_unpack(&p, 1);
+    for (uint32_t i = 0; i < words; i++) {
+      after[i] = ring.buf[(ring.head - words + i) & (AUDIO_RING_WORDS - 1)];
+    }
+    run_before(&p, 1);
+    for (uint32_t i = 0; i < words; i++) {
+      CHECK_EQ(ring.buf[(ring.head - words + i) & (AUDIO_RING_WORDS - 1)],
+               after[i]);
+    }
+  }
+}
+
+static void bench_formats(void) {
+  static const uint32_t rates[] = {48000, 96000};
+
+  for (uint32_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+    for (uint32_t r = 0; r < 2; r++) {
+      uint32_t frames = rates[r] / 1000;
+      packet_t p = {&formats[f], frames * formats[f].subslot_size * 2};
+
+      audio_ring_set_frame_words(&ring, formats[f].frame_words);
+      double ns = bench_best_ns(run_unpack, &p, PACKETS);
+      double before = bench_best_ns(run_before, &p, PACKETS);
+      printf("bench %-12s %2u kHz %3u B/packet: %7.1f ns/packet "
+             "%6.1f frames/us (3-pass %7.1f ns, x%.2f)\n",
+             formats[f].name, rates[r] / 1000, p.bytes, ns, frames * 1000 / ns,
+             before, before / ns);
+    }
+  }
+}
+
+int main(void) {
+  audio_ring_init(&ring);
+  RUN(test_unpack_words);
+  RUN(test_unpack_matches_before);
+  RUN(bench_formats);
+  return 0;
+}
@@ -0,0 +1,131 @@
+#include "bench.h"
+#include "test.h"
+#include "usb_audio.h"
+#include "usb_ctrl.h"
+#include <stdint.h>
+#include <stdio.h>
+
+// 制御リクエストの検索（SETUP から当たるエントリを引くまで）の時間
+// usb.c / usb_audio.c のテーブルをそのまま登録し, 列挙で来る SETUP の
+// 並びを流す。比較用に, 同じエントリを先頭から順に見る線形探索と,
+// 置き換える前の分岐が出していた LOG_INFO の整形も計る
+// ハンドラはレジスタを触るので呼ばない
+#define ROUNDS 20000
+
+static const usb_ctrl_table_t *const tables[] = {&usb_std_table,
+                                                 &uac2_request_table};
+#define TABLE_COUNT (sizeof(tables) / sizeof(tables[0]))
+
+// 列挙から再生開始までに来る典型的な SETUP の並び
+static const USB_SetupPacket enumeration[] = {
+    {0x80, 0x06, 0x0100, 0x0000, 64},  {0x00, 0x05, 0x0007, 0x0000, 0},
+    {0x80, 0x06, 0x0100, 0x0000, 18},  {0x80, 0x06, 0x0600, 0x0000, 10},
+    {0x80, 0x06, 0x0200, 0x0000, 9},   {0x80, 0x06, 0x0200, 0x0000, 255},
+    {0x80, 0x06, 0x0300, 0x0000, 255}, {0x80, 0x06, 0x0302, 0x0409, 255},
+    {0x80, 0x06, 0x0301, 0x0409, 255}, {0x00, 0x09, 0x0001, 0x0000, 0},
+    {0xa1, 0x02, 0x0100, 0x1000, 2},   {0xa1, 0x02, 0x0100, 0x1000, 14},
+    {0xa1, 0x01, 0x0100, 0x1000, 4},   {0xa1, 0x01, 0x0200, 0x1000, 1},
+    {0xa1, 0x01, 0x0000, 0x1100, 1},   {0x21, 0x01, 0x0100, 0x1000, 4},
+    {0x01, 0x0b, 0x0000, 0x0001, 0},   {0x01, 0x0b, 0x0001, 0x0001, 0},
+    {0x22, 0x01, 0x0100, 0x0001, 3},   {0x80, 0x00, 0x0000, 0x0000, 2},
+};
+#define ENUMERATION_COUNT (sizeof(enumeration) / sizeof(enumeration[0]))
+
+// 比較用: 同じキーとマスクの順で全エントリを先頭から見る
+static const usb_ctrl_entry_t *linear_find(const USB_SetupPacket *setup) {
+  uint32_t key = usb_ctrl_key(setup);
+
+  for (uint32_t m = 0; m < USB_CTRL_MASK_COUNT; m++) {
+    uint32_t mask = usb_ctrl_masks[m];
+
+    for (uint32_t t = 0; t < TABLE_COUNT; t++) {
+      for (uint32_t i = 0; i < tables[t]->count; i++) {
+        const usb_ctrl_entry_t *e = &tables[t]->entries[i];
+        if (e->mask == mask && e->key == (key & mask)) {
+          return e;
+        }
+      }
+    }
+  }
+  return NULL;
+}
+
+static void run_lookup(void *ctx, uint32_t iters) {
+  volatile uintptr_t sink = 0;
+
+  for (uint32_t n = 0; n < iters; n++) {
+    for (uint32_t i = 0; i < ENUMERATION_COUNT; i++) {
+      sink += (uintptr_t)usb_ctrl_lookup(&enumeration[i]);
+    }
+  }
+}
+
+static void run_linear(void *ctx, uint32_t iters) {
+  volatile uintptr_t sink = 0;
+
+  for (uint32_t n = 0; n < iters; n++) {
+    for (uint32_t i = 0; i < ENUMERATION_COUNT; i++) {
+      sink += (uintptr_t)linear_find(&enumeration[i]);
+    }
+  }
+}
+
+// 置き換える前の GET_DESCRIPTOR(DEVICE) が出していた LOG_INFO 4行の整形
+static void run_old_log(void *ctx, uint32_t iters) {
+  static char line[128];
+  volatile uint32_t sink = 0;
+
+  for (uint32_t n = 0; n < iters; n++) {
+    sink += snprintf(line, sizeof(line),
+                     "GET_DESCRIPTOR: Type=0x%02X, Index=0x%02X, "
+                     "Length=%d\r\n",
+                     0x01, 0x00, 64);
+    sink += snprintf(line, sizeof(line), "Requesting device descriptor\r\n");
+    sink += snprintf(line, sizeof(line),
+                     "Device descriptor: addr=0x%08X, size=%d\r\n",
+                     0x08001234u, 18);
+    sink += snprintf(line, sizeof(line),
+                     "Sending %d bytes of descriptor (requested: %d, "
+                     "actual: %d)\r\n",
+                     18, 64, 18);
+  }
+}
+
+// 列挙の SETUP はすべてテーブルにあり, 線形探索と同じエントリに当たる
+static void test_lookup_matches_linear(void) {
+  for (uint32_t i = 0; i < ENUMERATION_COUNT; i++) {
+    const usb_ctrl_entry_t *e = linear_find(&enumeration[i]);
+
+    CHECK(e != NULL);
+    CHECK(usb_ctrl_lookup(&enumeration[i]) == e);
+  }
+}
+
+// ベンダーリクエストの未定義番号はどのテーブルにも当たらない
+static void test_lookup_unknown(void) {
+  USB_SetupPacket setup = {0xc0, 0x7f, 0x0000, 0x0000, 4};
+
+  CHECK(usb_ctrl_lookup(&setup) == NULL);
+  CHECK(linear_find(&setup) == NULL);
+}
+
+static void bench_lookup(void) {
+  double lookup = bench_best_ns(run_lookup, NULL, ROUNDS);
+  double linear = bench_best_ns(run_linear, NULL, ROUNDS);
+  double old_log = bench_best_ns(run_old_log, NULL, ROUNDS);
+
+  printf("bench lookup %5.1f ns/setup, linear scan %5.1f ns/setup, "
+         "old GET_DESCRIPTOR log lines %6.1f ns\n",
+         lookup / ENUMERATION_COUNT, linear / ENUMERATION_COUNT, old_log);
+}
+
+int main(void) {
+  usb_ctrl_reset();
+  for (uint32_t t = 0; t < TABLE_COUNT; t++) {
+    CHECK(usb_ctrl_register(tables[t]));
+  }
+  RUN(test_lookup_matches_linear);
+  RUN(test_lookup_unknown);
+  RUN(bench_lookup);
+  return 0;
+}
@@ -0,0 +1,132 @@
+#include "bench.h"
+#include "test.h"
+#include "usb_fifo.h"
+#include <stdint.h>
+#include <string.h>
+
+// usb_read_packet / usb_write_packet の FIFO コピーを, 1バイトずつ境界を
+// 確かめていた頃のループと比べる
+// FIFO ポートはホストでは1ワードの volatile 変数で代わりにする
+#define PACKETS 50000
+
+static volatile uint32_t fifo_port;
+static uint8_t buf[256 + 4] __attribute__((aligned(4)));
+
+// 比較用: ワード境界の高速経路を入れる前のコピー
+static void before_read(volatile uint32_t *fifo, uint8_t *dest,
+                        uint32_t bcnt) {
+  uint32_t nwords = (bcnt + 3) / 4;
+  uint32_t data;
+
+  for (uint32_t i = 0; i < nwords; i++) {
+    data = *fifo;
+    if (dest != NULL) {
+      for (uint8_t j = 0; j < 4 && (i * 4 + j) < bcnt; j++) {
+        dest[i * 4 + j] = (uint8_t)(data >> (j * 8));
+      }
+    }
+  }
+}
+
+static void before_write(volatile uint32_t *fifo, const uint8_t *src,
+                         uint32_t len) {
+  uint32_t nwords = (len + 3) / 4;
+  uint32_t data;
+
+  for (uint32_t i = 0; i < nwords; i++) {
+    data = 0;
+    for (uint8_t j = 0; j < 4; j++) {
+      if (i * 4 + j < len) {
+        data |= (uint32_t)(src[i * 4 + j]) << (j * 8);
+      }
+    }
+    *fifo = data;
+  }
+}
+
+typedef struct {
+  void (*read)(volatile uint32_t *fifo, uint8_t *dest, uint32_t bcnt);
+  void (*write)(volatile uint32_t *fifo, const uint8_t *src, uint32_t len);
+  uint8_t *buf;
+  uint32_t len;
+} copy_t;
+
+static void after_read(volatile uint32_t *fifo, uint8_t *dest, uint32_t bcnt) {
+  usb_fifo_read(fifo, dest, bcnt);
+}
+
+static void after_write(volatile uint32_t *fifo, const uint8_t *src,
+                        uint32_t len) {
+  usb_fifo_write(fifo, src, len);
+}
+
+static void run_read(void *ctx, uint32_t iters) {
+  const copy_t *c = ctx;
+
+  for (uint32_t n = 0; n < iters; n++) {
+    c->read(&fifo_port, c->buf, c->len);
+  }
+}
+
+static void run_write(void *ctx, uint32_t iters) {
+  const copy_t *c = ctx;
+
+  for (uint32_t n = 0; n < iters; n++) {
+    c->write(&fifo_port, c->buf, c->len);
+  }
+}
+
+// 境界・端数バイトの組み合わせで, 前と同じバイト列・ワードになる
+static void test_copy_matches_before(void) {
+  uint8_t expect[sizeof(buf)];
+
+  fifo_port = 0x44332211;
+  for (uint32_t offset = 0; offset < 4; offset++) {
+    for (uint32_t len = 0; len <= 20; len++) {
+      memset(buf, 0xEE, sizeof(buf));
+      before_read(&fifo_port, buf + offset, len);
+      memcpy(expect, buf, sizeof(buf));
+      memset(buf, 0xEE, sizeof(buf));
+      usb_fifo_read(&fifo_port, buf + offset, len);
+      CHECK(memcmp(buf, expect, sizeof(buf)) == 0);
+
+      for (uint32_t i = 0; i < sizeof(buf); i++) {
+        buf[i] = (uint8_t)(i * 7 + 1);
+      }
+      // 最後に書かれるワード（端数があれば端数のワード）を比べる
+      before_write(&fifo_port, buf + offset, len);
+      uint32_t last = fifo_port;
+      fifo_port = 0;
+      usb_fifo_write(&fifo_port, buf + offset, len);
+      CHECK_EQ(fifo_port, len ? last : 0);
+      fifo_port = 0x44332211;
+    }
+  }
+}
+
+static void bench_copy(void) {
+  static const uint32_t lens[] = {8, 64, 192};
+
+  for (uint32_t l = 0; l < 3; l++) {
+    for (uint32_t offset = 0; offset < 2; offset++) {
+      copy_t after = {after_read, after_write, buf + offset, lens[l]};
+      copy_t before = {before_read, before_write, buf + offset, lens[l]};
+      double read_ns = bench_best_ns(run_read, &after, PACKETS);
+      double read_before = bench_best_ns(run_read, &before, PACKETS);
+      double write_ns = bench_best_ns(run_write, &after, PACKETS);
+      double write_before = bench_best_ns(run_write, &before, PACKETS);
+
+      printf("bench %3u B %-9s read %6.1f ns %5.2f B/ns (before %6.1f ns, "
+             "x%.2f) write %6.1f ns %5.2f B/ns (before %6.1f ns, x%.2f)\n",
+             lens[l], offset ? "unaligned" : "aligned", read_ns,
+             lens[l] / read_ns, read_before, read_before / read_ns, write_ns,
+             lens[l] / write_ns, write_before, write_before / write_ns);
+    }
+  }
+}
+
+int main(void) {
+  RUN(test_copy_matches_before);
+  RUN(bench_copy);
+  return 0;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+// ホストテスト用の Cortex-M4 コア定義。stm32f411xe.h から
+// Drivers/CMSIS/Include/core_cm4.h の代わりに読まれる。
+// バリアはコンパイラ/CPUのフェンス, コア周辺は host.c の RAM に置く
+
+#include <stdint.h>
+
+#define __I volatile const
+#define __O volatile
+#define __IO volatile
+#define __IM volatile const
+#define __OM volatile
+#define __IOM volatile
+
+#define __STATIC_INLINE static inline
+#define __STATIC_FORCEINLINE static inline
+#define __ASM __asm__
+#define __ALIGNED(x) __attribute__((aligned(x)))
+#define __PACKED __attribute__((packed))
+#define __WEAK __attribute__((weak))
+#define __NOP() ((void)0)
+
+static inline void __DMB(void) { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+static inline void __DSB(void) { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+static inline void __ISB(void) { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+
+static inline uint8_t __CLZ(uint32_t value) {
+  return value ? (uint8_t)__builtin_clz(value) : 32;
+}
+
+static inline void __disable_irq(void) {}
+static inline void __enable_irq(void) {}
+
+typedef struct {
+  __IOM uint32_t CTRL;
+  __IOM uint32_t CYCCNT;
+} DWT_Type;
+
+#define DWT_CTRL_CYCCNTENA_Pos 0U
+#define DWT_CTRL_CYCCNTENA_Msk (1UL << DWT_CTRL_CYCCNTENA_Pos)
+
+typedef struct {
+  __IOM uint32_t DHCSR;
+  __OM uint32_t DCRSR;
+  __IOM uint32_t DCRDR;
+  __IOM uint32_t DEMCR;
+} CoreDebug_Type;
+
+#define CoreDebug_DEMCR_TRCENA_Pos 24U
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << CoreDebug_DEMCR_TRCENA_Pos)
+
+// SCB は PendSV の保留ビットだけ（シミュレータがボトムハーフを呼ぶ）
+typedef struct {
+  __IM uint32_t CPUID;
+  __IOM uint32_t ICSR;
+} SCB_Type;
+
+#define SCB_ICSR_PENDSVSET_Pos 28U
+#define SCB_ICSR_PENDSVSET_Msk (1UL << SCB_ICSR_PENDSVSET_Pos)
+
+extern DWT_Type host_dwt;
+extern CoreDebug_Type host_core_debug;
+extern SCB_Type host_scb;
+#define DWT (&host_dwt)
+#define CoreDebug (&host_core_debug)
+#define SCB (&host_scb)
+
+// NVIC は有効/優先度だけを覚えておく（テストから確認できる）
+#define HOST_NVIC_IRQS 96
+extern uint8_t host_nvic_enabled[HOST_NVIC_IRQS];
+extern uint8_t host_nvic_priority[HOST_NVIC_IRQS];
+
+static inline void NVIC_EnableIRQ(IRQn_Type irq) {
+  if (irq >= 0) {
+    host_nvic_enabled[irq] = 1;
+  }
+}
+
+static inline void NVIC_DisableIRQ(IRQn_Type irq) {
+  if (irq >= 0) {
+    host_nvic_enabled[irq] = 0;
+  }
+}
+
+static inline void NVIC_SetPriority(IRQn_Type irq, uint32_t priority) {
+  if (irq >= 0) {
+    host_nvic_priority[irq] = (uint8_t)priority;
+  }
+}
@@ -0,0 +1,20 @@
+#include <stm32f411xe.h>
+
+DWT_Type host_dwt;
+CoreDebug_Type host_core_debug;
+SCB_Type host_scb;
+uint8_t host_nvic_enabled[HOST_NVIC_IRQS];
+uint8_t host_nvic_priority[HOST_NVIC_IRQS];
+
+TIM_TypeDef host_tim2;
+TIM_TypeDef host_tim5;
+DMA_TypeDef host_dma1;
+DMA_Stream_TypeDef host_dma1_stream5;
+DMA_Stream_TypeDef host_dma1_stream6;
+SPI_TypeDef host_spi3;
+void (*host_dma1_stream5_hook)(void);
+USART_TypeDef host_usart2;
+RCC_TypeDef host_rcc;
+uint32_t host_otg_fs[HOST_OTG_FS_WORDS];
+
+uint32_t SystemCoreClock = 96000000;
@@ -0,0 +1,49 @@
+#pragma once
+
+// ホストテスト用の stm32f411xe.h。型とビット定義は本物をそのまま使い,
+// テストが触る周辺だけ host.c の RAM に付け替える
+#include_next <stm32f411xe.h>
+
+#undef TIM2
+#undef TIM5
+#undef DMA1
+#undef DMA1_Stream5
+#undef DMA1_Stream6
+#undef SPI3
+#undef USART2
+#undef RCC
+#undef USB_OTG_FS
+
+extern TIM_TypeDef host_tim2;
+extern TIM_TypeDef host_tim5;
+extern DMA_TypeDef host_dma1;
+extern DMA_Stream_TypeDef host_dma1_stream5;
+extern DMA_Stream_TypeDef host_dma1_stream6;
+extern SPI_TypeDef host_spi3;
+extern USART_TypeDef host_usart2;
+extern RCC_TypeDef host_rcc;
+
+#define TIM2 (&host_tim2)
+#define TIM5 (&host_tim5)
+#define DMA1 (&host_dma1)
+// DMA1_Stream5 はアクセスのたびに host_dma1_stream5_hook を呼ぶ
+// （テストが DMA の動きや割り込みの横取りをそこで模擬する）
+extern void (*host_dma1_stream5_hook)(void);
+static inline DMA_Stream_TypeDef *host_dma1_stream5_access(void) {
+  if (host_dma1_stream5_hook != 0) {
+    host_dma1_stream5_hook();
+  }
+  return &host_dma1_stream5;
+}
+#define DMA1_Stream5 (host_dma1_stream5_access())
+#define DMA1_Stream6 (&host_dma1_stream6)
+#define SPI3 (&host_spi3)
+#define USART2 (&host_usart2)
+#define RCC (&host_rcc)
+
+// OTG FS はレジスタから FIFO ポートまでを RAM に置く。取り出しや
+// 1で消えるビットの動きは test/sim のモデルが usb_reg_read /
+// usb_reg_write に付ける
+#define HOST_OTG_FS_WORDS ((USB_OTG_FIFO_BASE + 4 * USB_OTG_FIFO_SIZE) / 4)
+extern uint32_t host_otg_fs[HOST_OTG_FS_WORDS];
+#define USB_OTG_FS ((USB_OTG_GlobalTypeDef *)host_otg_fs)
@@ -0,0 +1,503 @@
+#include "otg_model.h"
+#include "usb.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stm32f411xe.h>
+
+// GRXSTSP の PKTSTS（RM0383 22.17.2）
+#define PKTSTS_OUT_DATA 2
+#define PKTSTS_OUT_COMPLETE 3
+#define PKTSTS_SETUP_COMPLETE 4
+#define PKTSTS_SETUP_DATA 6
+
+// DxEPCTL のビット16: iso では偶数/奇数フレーム, それ以外は DATA0/1
+#define EPCTL_EONUM (1UL << 16)
+#define EPCTL_EPTYP_ISO (1UL << 18)
+
+// GINTSTS のうち1を書くと消えるビット。RXFLVL, IEPINT, OEPINT は
+// FIFO や DAINT から決まるので書いても変わらない
+#define GINTSTS_W1C                                                            \
+  (USB_OTG_GINTSTS_MMIS | USB_OTG_GINTSTS_SOF | USB_OTG_GINTSTS_ESUSP |        \
+   USB_OTG_GINTSTS_USBSUSP | USB_OTG_GINTSTS_USBRST |                          \
+   USB_OTG_GINTSTS_ENUMDNE | USB_OTG_GINTSTS_ISOODRP |                         \
+   USB_OTG_GINTSTS_EOPF | USB_OTG_GINTSTS_IISOIXFR |                           \
+   USB_OTG_GINTSTS_PXFR_INCOMPISOOUT | USB_OTG_GINTSTS_CIDSCHG |               \
+   USB_OTG_GINTSTS_DISCINT | USB_OTG_GINTSTS_SRQINT | USB_OTG_GINTSTS_WKUINT)
+
+// フルスピードの最大パケット（iso 1023バイト）
+#define MAX_PACKET_WORDS 256
+#define RX_ENTRIES 16
+#define TX_FIFO_WORDS 512
+
+typedef struct {
+  uint32_t status; // GRXSTSP の値
+  uint16_t nwords;
+  uint32_t words[MAX_PACKET_WORDS];
+} rx_entry_t;
+
+otg_model_stats_t otg_model_stats;
+
+// 割り込み関係のレジスタはモデルが正本を持ち, RAM へ写す
+static uint32_t gintsts;
+static uint32_t diepint[OTG_MODEL_EPS];
+static uint32_t doepint[OTG_MODEL_EPS];
+
+static rx_entry_t rx_queue[RX_ENTRIES];
+static uint32_t rx_head;
+static uint32_t rx_count;
+static rx_entry_t rx_current; // GRXSTSP で取り出し, FIFO(0) で読んでいる
+static uint16_t rx_read;
+
+static uint32_t tx_fifo[OTG_MODEL_EPS][TX_FIFO_WORDS];
+static uint32_t tx_count[OTG_MODEL_EPS];
+
+static uint32_t frame;
+static bool out_received[OTG_MODEL_EPS]; // このフレームで受けた iso OUT
+
+static void fail(const char *fmt, ...) {
+  va_list args;
+
+  fprintf(stderr, "otg_model: ");
+  va_start(args, fmt);
+  vfprintf(stderr, fmt, args);
+  va_end(args);
+  fprintf(stderr, "\n");
+  exit(1);
+}
+
+static uint32_t rx_used_words(void) {
+  uint32_t words = rx_current.nwords - rx_read;
+
+  for (uint32_t i = 0; i < rx_count; i++) {
+    words += 1 + rx_queue[(rx_head + i) % RX_ENTRIES].nwords;
+  }
+  return words;
+}
+
+static uint32_t rx_fifo_words(void) {
+  return USB_OTG_FS->GRXFSIZ & USB_OTG_GRXFSIZ_RXFD;
+}
+
+static uint32_t tx_fifo_words(uint8_t ep) {
+  uint32_t txf = ep == 0 ? USB_OTG_FS->DIEPTXF0_HNPTXFSIZ
+                         : USB_OTG_FS->DIEPTXF[ep - 1];
+  return txf >> USB_OTG_TX0FD_Pos;
+}
+
+// 割り込み要因を求め直して RAM へ写す
+static void update_irq(void) {
+  uint32_t daint = 0;
+  uint32_t daintmsk = USB_DEVICE->DAINTMSK;
+
+  for (uint8_t ep = 0; ep < OTG_MODEL_EPS; ep++) {
+    if (diepint[ep] & USB_DEVICE->DIEPMSK) {
+      daint |= 1UL << ep;
+    }
+    if (doepint[ep] & USB_DEVICE->DOEPMSK) {
+      daint |= 1UL << (USB_OTG_DAINT_OEPINT_Pos + ep);
+    }
+    USB_INEP[ep].DIEPINT = diepint[ep];
+    USB_OUTEP[ep].DOEPINT = doepint[ep];
+  }
+  USB_DEVICE->DAINT = daint;
+
+  gintsts &= ~(USB_OTG_GINTSTS_RXFLVL | USB_OTG_GINTSTS_IEPINT |
+               USB_OTG_GINTSTS_OEPINT);
+  if (rx_count > 0) {
+    gintsts |= USB_OTG_GINTSTS_RXFLVL;
+  }
+  if (daint & daintmsk & USB_OTG_DAINT_IEPINT) {
+    gintsts |= USB_OTG_GINTSTS_IEPINT;
+  }
+  if (daint & daintmsk & USB_OTG_DAINT_OEPINT) {
+    gintsts |= USB_OTG_GINTSTS_OEPINT;
+  }
+  USB_OTG_FS->GINTSTS = gintsts;
+}
+
+void otg_model_check(void) {
+  if (USB_OTG_FS->GINTSTS != gintsts) {
+    fail("GINTSTS written without usb_reg_write (0x%08x, expected 0x%08x)",
+         USB_OTG_FS->GINTSTS, gintsts);
+  }
+  for (uint8_t ep = 0; ep < OTG_MODEL_EPS; ep++) {
+    if (USB_INEP[ep].DIEPINT != diepint[ep]) {
+      fail("DIEPINT%d written without usb_reg_write", ep);
+    }
+    if (USB_OUTEP[ep].DOEPINT != doepint[ep]) {
+      fail("DOEPINT%d written without usb_reg_write", ep);
+    }
+  }
+}
+
+// 書き込み専用ビットを反映する。EPDIS は次の読み出しまでに完了する
+static uint32_t ep_ctl_sync(uint32_t ctl, uint32_t *intr, uint32_t epdisd) {
+  if (ctl & USB_OTG_DIEPCTL_SD0PID_SEVNFRM) {
+    ctl &= ~EPCTL_EONUM;
+  }
+  if (ctl & USB_OTG_DIEPCTL_SODDFRM) {
+    ctl |= EPCTL_EONUM;
+  }
+  if (ctl & USB_OTG_DIEPCTL_EPDIS) {
+    if (ctl & USB_OTG_DIEPCTL_EPENA) {
+      ctl &= ~USB_OTG_DIEPCTL_EPENA;
+      *intr |= epdisd;
+    }
+  }
+  return ctl & ~(USB_OTG_DIEPCTL_SD0PID_SEVNFRM | USB_OTG_DIEPCTL_SODDFRM |
+                 USB_OTG_DIEPCTL_EPDIS | USB_OTG_DIEPCTL_CNAK |
+                 USB_OTG_DIEPCTL_SNAK);
+}
+
+void otg_model_sync(void) {
+  otg_model_check();
+  for (uint8_t ep = 0; ep < OTG_MODEL_EPS; ep++) {
+    USB_INEP[ep].DIEPCTL =
+        ep_ctl_sync(USB_INEP[ep].DIEPCTL, &diepint[ep], USB_OTG_DIEPINT_EPDISD);
+    USB_OUTEP[ep].DOEPCTL = ep_ctl_sync(USB_OUTEP[ep].DOEPCTL, &doepint[ep],
+                                        USB_OTG_DOEPINT_EPDISD);
+  }
+  update_irq();
+}
+
+uint32_t otg_model_pending(void) {
+  if (!(USB_OTG_FS->GAHBCFG & USB_OTG_GAHBCFG_GINT)) {
+    return 0;
+  }
+  return gintsts & USB_OTG_FS->GINTMSK;
+}
+
+void otg_model_reset(void) {
+  memset(host_otg_fs, 0, sizeof(host_otg_fs));
+  memset(&otg_model_stats, 0, sizeof(otg_model_stats));
+  memset(diepint, 0, sizeof(diepint));
+  memset(doepint, 0, sizeof(doepint));
+  memset(tx_count, 0, sizeof(tx_count));
+  memset(out_received, 0, sizeof(out_received));
+  gintsts = 0;
+  rx_head = 0;
+  rx_count = 0;
+  rx_current.nwords = 0;
+  rx_read = 0;
+  frame = 0;
+  USB_OTG_FS->GRSTCTL = USB_OTG_GRSTCTL_AHBIDL;
+  update_irq();
+}
+
+// アドレスから FIFO ポートの番号を求める（FIFO 以外は -1）
+static int fifo_index(volatile uint32_t *reg) {
+  uintptr_t offset = (uintptr_t)reg - (uintptr_t)host_otg_fs;
+
+  if (offset >= sizeof(host_otg_fs)) {
+    fail("access outside the OTG FS block (%p)", (void *)reg);
+  }
+  if (offset < USB_OTG_FIFO_BASE) {
+    return -1;
+  }
+  return (int)((offset - USB_OTG_FIFO_BASE) / USB_OTG_FIFO_SIZE);
+}
+
+// 受信エントリを1つ取り出す。取り出すと SETUP 完了は STUP,
+// OUT 転送完了は XFRC になる（RM0383 22.17.6）
+static uint32_t rx_pop_status(void) {
+  rx_entry_t *entry;
+  uint32_t ep;
+
+  if (rx_read != rx_current.nwords) {
+    fail("GRXSTSP popped with %d words of the last packet unread",
+         rx_current.nwords - rx_read);
+  }
+  if (rx_count == 0) {
+    fail("GRXSTSP popped from an empty RX FIFO");
+  }
+  entry = &rx_queue[rx_head];
+  rx_head = (rx_head + 1) % RX_ENTRIES;
+  rx_count--;
+  rx_current = *entry;
+  rx_read = 0;
+
+  ep = rx_current.status & USB_OTG_GRXSTSP_EPNUM;
+  switch ((rx_current.status & USB_OTG_GRXSTSP_PKTSTS) >>
+          USB_OTG_GRXSTSP_PKTSTS_Pos) {
+  case PKTSTS_SETUP_COMPLETE:
+    doepint[ep] |= USB_OTG_DOEPINT_STUP;
+    break;
+  case PKTSTS_OUT_COMPLETE:
+    USB_OUTEP[ep].DOEPCTL &= ~USB_OTG_DOEPCTL_EPENA;
+    doepint[ep] |= USB_OTG_DOEPINT_XFRC;
+    break;
+  default:
+    break;
+  }
+  return rx_current.status;
+}
+
+static uint32_t rx_pop_word(void) {
+  if (rx_read == rx_current.nwords) {
+    fail("FIFO(0) read past the end of the packet");
+  }
+  return rx_current.words[rx_read++];
+}
+
+static void tx_push(uint8_t ep, uint32_t word) {
+  if (tx_count[ep] >= tx_fifo_words(ep) || tx_count[ep] >= TX_FIFO_WORDS) {
+    fail("TX FIFO %d overflow (%d words)", ep, tx_fifo_words(ep));
+  }
+  tx_fifo[ep][tx_count[ep]++] = word;
+}
+
+static void grstctl_write(uint32_t value) {
+  if (value & USB_OTG_GRSTCTL_TXFFLSH) {
+    uint32_t num =
+        (value & USB_OTG_GRSTCTL_TXFNUM) >> USB_OTG_GRSTCTL_TXFNUM_Pos;
+
+    for (uint8_t ep = 0; ep < OTG_MODEL_EPS; ep++) {
+      if (num == 0x10 || num == ep) {
+        tx_count[ep] = 0;
+      }
+    }
+  }
+  if (value & USB_OTG_GRSTCTL_RXFFLSH) {
+    rx_count = 0;
+    rx_current.nwords = 0;
+    rx_read = 0;
+  }
+  USB_OTG_FS->GRSTCTL =
+      (value | USB_OTG_GRSTCTL_AHBIDL) &
+      ~(USB_OTG_GRSTCTL_CSRST | USB_OTG_GRSTCTL_TXFFLSH |
+        USB_OTG_GRSTCTL_RXFFLSH);
+}
+
+uint32_t usb_reg_read(volatile uint32_t *reg) {
+  int fifo = fifo_index(reg);
+  uint32_t value;
+
+  otg_model_sync();
+  if (fifo == 0) {
+    value = rx_pop_word();
+  } else if (fifo > 0) {
+    fail("FIFO(%d) read: only FIFO(0) pops the RX FIFO", fifo);
+  } else if (reg == &USB_OTG_FS->GRXSTSP) {
+    value = rx_pop_status();
+  } else {
+    value = *reg;
+  }
+  update_irq();
+  return value;
+}
+
+void usb_reg_write(volatile uint32_t *reg, uint32_t value) {
+  int fifo = fifo_index(reg);
+
+  otg_model_sync();
+  if (fifo >= OTG_MODEL_EPS) {
+    fail("FIFO(%d) write: no such endpoint", fifo);
+  } else if (fifo >= 0) {
+    tx_push((uint8_t)fifo, value);
+  } else if (reg == &USB_OTG_FS->GINTSTS) {
+    gintsts &= ~(value & GINTSTS_W1C);
+  } else if (reg == &USB_OTG_FS->GRSTCTL) {
+    grstctl_write(value);
+  } else {
+    bool handled = false;
+
+    for (uint8_t ep = 0; ep < OTG_MODEL_EPS; ep++) {
+      if (reg == &USB_INEP[ep].DIEPINT) {
+        diepint[ep] &= ~value;
+        handled = true;
+      } else if (reg == &USB_OUTEP[ep].DOEPINT) {
+        doepint[ep] &= ~value;
+        handled = true;
+      }
+    }
+    if (!handled) {
+      *reg = value;
+    }
+  }
+  update_irq();
+}
+
+static void rx_push(uint32_t pktsts, uint8_t ep, uint32_t dpid,
+                    const uint8_t *data, uint16_t len) {
+  rx_entry_t *entry = &rx_queue[(rx_head + rx_count) % RX_ENTRIES];
+
+  if (rx_count == RX_ENTRIES) {
+    fail("RX entry queue full");
+  }
+  entry->status = ((uint32_t)ep << USB_OTG_GRXSTSP_EPNUM_Pos) |
+                  ((uint32_t)len << USB_OTG_GRXSTSP_BCNT_Pos) |
+                  (dpid << USB_OTG_GRXSTSP_DPID_Pos) |
+                  (pktsts << USB_OTG_GRXSTSP_PKTSTS_Pos);
+  entry->nwords = (len + 3) / 4;
+  memset(entry->words, 0, entry->nwords * 4);
+  if (len > 0) {
+    memcpy(entry->words, data, len);
+  }
+  rx_count++;
+
+  uint32_t used = rx_used_words();
+  if (used > otg_model_stats.rx_peak_words) {
+    otg_model_stats.rx_peak_words = used;
+  }
+}
+
+// ステータス1ワードずつとデータが RX FIFO に入るか
+static bool rx_fits(uint32_t entries, uint16_t len) {
+  return rx_count + entries <= RX_ENTRIES &&
+         rx_used_words() + entries + (len + 3) / 4 <= rx_fifo_words();
+}
+
+void otg_bus_reset(void) {
+  otg_model_sync();
+  gintsts |= USB_OTG_GINTSTS_USBRST;
+  update_irq();
+}
+
+void otg_sof(uint32_t frame_number) {
+  otg_model_sync();
+  frame = frame_number & 0x3FFF;
+  USB_DEVICE->DSTS = (USB_DEVICE->DSTS & ~USB_OTG_DSTS_FNSOF) |
+                     (frame << USB_OTG_DSTS_FNSOF_Pos);
+  memset(out_received, 0, sizeof(out_received));
+  gintsts |= USB_OTG_GINTSTS_SOF;
+  update_irq();
+}
+
+// 今のフレーム向けに準備された iso OUT が受信しないまま終わった
+void otg_end_of_frame(void) {
+  otg_model_sync();
+  for (uint8_t ep = 1; ep < OTG_MODEL_EPS; ep++) {
+    uint32_t ctl = USB_OUTEP[ep].DOEPCTL;
+
+    if ((ctl & USB_OTG_DOEPCTL_EPTYP) == EPCTL_EPTYP_ISO &&
+        (ctl & USB_OTG_DOEPCTL_EPENA) && !out_received[ep] &&
+        ((ctl & EPCTL_EONUM) != 0) == ((frame & 1) != 0)) {
+      gintsts |= USB_OTG_GINTSTS_PXFR_INCOMPISOOUT;
+    }
+  }
+  update_irq();
+}
+
+// SETUP は常に受け付ける（EP0 の STALL も解ける）
+void otg_host_setup(const uint8_t setup[8]) {
+  otg_model_sync();
+  if (!rx_fits(2, 8)) {
+    fail("no room in the RX FIFO for a SETUP packet");
+  }
+  USB_INEP[0].DIEPCTL &= ~USB_OTG_DIEPCTL_STALL;
+  USB_OUTEP[0].DOEPCTL &= ~USB_OTG_DOEPCTL_STALL;
+  rx_push(PKTSTS_SETUP_DATA, 0, 0, setup, 8);
+  rx_push(PKTSTS_SETUP_COMPLETE, 0, 0, NULL, 0);
+  update_irq();
+}
+
+static uint16_t ep_max_packet(uint8_t ep, uint32_t ctl) {
+  if (ep == 0) {
+    // EP0 は 0:64, 1:32, 2:16, 3:8 バイト
+    return 64 >> (ctl & 3);
+  }
+  return ctl & USB_OTG_DOEPCTL_MPSIZ;
+}
+
+otg_handshake_t otg_host_out(uint8_t ep, const uint8_t *data, uint16_t len) {
+  uint32_t ctl;
+  uint32_t tsiz;
+  uint32_t pktcnt;
+  uint32_t xfrsiz;
+  bool iso;
+
+  otg_model_sync();
+  ctl = USB_OUTEP[ep].DOEPCTL;
+  tsiz = USB_OUTEP[ep].DOEPTSIZ;
+  pktcnt = (tsiz & USB_OTG_DOEPTSIZ_PKTCNT) >> USB_OTG_DOEPTSIZ_PKTCNT_Pos;
+  iso = ep != 0 && (ctl & USB_OTG_DOEPCTL_EPTYP) == EPCTL_EPTYP_ISO;
+
+  if (ctl & USB_OTG_DOEPCTL_STALL) {
+    return OTG_STALL;
+  }
+  if (!(ctl & USB_OTG_DOEPCTL_EPENA) || pktcnt == 0 ||
+      (iso && ((ctl & EPCTL_EONUM) != 0) != ((frame & 1) != 0))) {
+    if (iso) {
+      otg_model_stats.iso_dropped++;
+    }
+    return OTG_NAK;
+  }
+  if (len > ep_max_packet(ep, ctl)) {
+    fail("OUT EP%d: %d bytes exceed the max packet size %d", ep, len,
+         ep_max_packet(ep, ctl));
+  }
+  if (!rx_fits(2, len)) {
+    otg_model_stats.rx_overflows++;
+    return OTG_NAK;
+  }
+
+  rx_push(PKTSTS_OUT_DATA, ep, 0, data, len);
+  pktcnt--;
+  xfrsiz = tsiz & USB_OTG_DOEPTSIZ_XFRSIZ;
+  xfrsiz -= xfrsiz < len ? xfrsiz : len;
+  USB_OUTEP[ep].DOEPTSIZ =
+      (tsiz & ~(USB_OTG_DOEPTSIZ_PKTCNT | USB_OTG_DOEPTSIZ_XFRSIZ)) |
+      (pktcnt << USB_OTG_DOEPTSIZ_PKTCNT_Pos) | xfrsiz;
+  if (pktcnt == 0 || len < ep_max_packet(ep, ctl)) {
+    rx_push(PKTSTS_OUT_COMPLETE, ep, 0, NULL, 0);
+  }
+  out_received[ep] = true;
+  update_irq();
+  return OTG_ACK;
+}
+
+otg_handshake_t otg_host_in(uint8_t ep, uint8_t *buf, uint16_t max,
+                            uint16_t *len) {
+  uint32_t ctl;
+  uint32_t tsiz;
+  uint32_t size;
+  uint32_t pktcnt;
+  uint32_t words;
+
+  otg_model_sync();
+  ctl = USB_INEP[ep].DIEPCTL;
+  tsiz = USB_INEP[ep].DIEPTSIZ;
+
+  if (ctl & USB_OTG_DIEPCTL_STALL) {
+    return OTG_STALL;
+  }
+  if (!(ctl & USB_OTG_DIEPCTL_EPENA) ||
+      (ep != 0 && (ctl & USB_OTG_DIEPCTL_EPTYP) == EPCTL_EPTYP_ISO &&
+       ((ctl & EPCTL_EONUM) != 0) != ((frame & 1) != 0))) {
+    return OTG_NAK;
+  }
+
+  size = tsiz & USB_OTG_DIEPTSIZ_XFRSIZ;
+  if (size > ep_max_packet(ep, ctl)) {
+    size = ep_max_packet(ep, ctl);
+  }
+  words = (size + 3) / 4;
+  if (tx_count[ep] < words) {
+    return OTG_NAK; // まだ FIFO に書き終わっていない
+  }
+  if (size > max) {
+    fail("IN EP%d: %d bytes overrun the host buffer of %d", ep, size, max);
+  }
+  memcpy(buf, tx_fifo[ep], size);
+  memmove(tx_fifo[ep], tx_fifo[ep] + words,
+          (tx_count[ep] - words) * sizeof(uint32_t));
+  tx_count[ep] -= words;
+  *len = (uint16_t)size;
+
+  pktcnt = (tsiz & USB_OTG_DIEPTSIZ_PKTCNT) >> USB_OTG_DIEPTSIZ_PKTCNT_Pos;
+  if (pktcnt > 0) {
+    pktcnt--;
+  }
+  USB_INEP[ep].DIEPTSIZ =
+      (tsiz & ~(USB_OTG_DIEPTSIZ_PKTCNT | USB_OTG_DIEPTSIZ_XFRSIZ)) |
+      (pktcnt << USB_OTG_DIEPTSIZ_PKTCNT_Pos) |
+      ((tsiz & USB_OTG_DIEPTSIZ_XFRSIZ) - size);
+  if (pktcnt == 0) {
+    USB_INEP[ep].DIEPCTL &= ~USB_OTG_DIEPCTL_EPENA;
+    diepint[ep] |= USB_OTG_DIEPINT_XFRC;
+  }
+  update_irq();
+  return OTG_ACK;
+}
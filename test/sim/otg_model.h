@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// OTG FS コア（デバイスモード, フルスピード）の振る舞いモデル
+// レジスタは host_otg_fs の RAM にあり, ファームウェアはそのまま読み書き
+// する。副作用のあるアクセスは usb_reg_read / usb_reg_write がここへ来る
+//   - GRXSTSP を読むと受信エントリを1つ取り出し, FIFO(0) からそのデータを読む
+//   - FIFO(n) へ書くと TX FIFO n に積む
+//   - GINTSTS / DIEPINT / DOEPINT は1を書いたビットを消す
+//   - GRSTCTL の CSRST / TXFFLSH はすぐに終わる
+// DxEPCTL の書き込み専用ビット（CNAK, SNAK, SD0PID, SODDFRM, EPDIS）は
+// 次にモデルを通ったとき（otg_model_sync）に反映する。
+// 使い方の誤り（空の FIFO を読む, 1で消すレジスタへ直接書く など）は
+// 場所を表示して即終了する
+
+#define OTG_MODEL_EPS 4
+
+// ホスト側のトランザクションの結果
+typedef enum {
+  OTG_ACK,
+  OTG_NAK,
+  OTG_STALL,
+} otg_handshake_t;
+
+typedef struct {
+  uint32_t rx_peak_words; // RX FIFO の最大使用量（ワード）
+  uint32_t iso_dropped;   // NAK した iso OUT（未準備, パリティ違い）
+  uint32_t rx_overflows;  // RX FIFO に入らず捨てた OUT パケット
+} otg_model_stats_t;
+
+extern otg_model_stats_t otg_model_stats;
+
+// 電源投入時の状態に戻す
+void otg_model_reset(void);
+// 書き込み専用ビットを反映し, 割り込み要因を求め直す
+void otg_model_sync(void);
+// 1で消すレジスタがモデルを通らずに書き換えられていないか確かめる
+void otg_model_check(void);
+// GINTSTS & GINTMSK（GAHBCFG.GINT が落ちていれば0）
+uint32_t otg_model_pending(void);
+
+// バス側（ホストとフレームのタイミング）
+void otg_bus_reset(void);
+void otg_sof(uint32_t frame);
+void otg_end_of_frame(void);
+void otg_host_setup(const uint8_t setup[8]);
+otg_handshake_t otg_host_out(uint8_t ep, const uint8_t *data, uint16_t len);
+otg_handshake_t otg_host_in(uint8_t ep, uint8_t *buf, uint16_t max,
+                            uint16_t *len);
@@ -0,0 +1,322 @@
+#include "sim.h"
+#include "bench.h"
+#include "i2s.h"
+#include "log.h"
+#include "otg_model.h"
+#include "prof.h"
+#include "tim.h"
+#include "usart.h"
+#include "usb.h"
+#include "usb_audio.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stm32f411xe.h>
+
+// 1回の sim_irq で同じ割り込みに入り続けたら要因が消えていない
+#define SIM_IRQ_STORM 64
+#define SIM_UART_BYTES (1 << 20)
+
+void OTG_FS_IRQHandler(void);
+void DMA1_Stream5_IRQHandler(void);
+
+void (*sim_frame_hook)(uint32_t frame);
+bool sim_verbose;
+sim_stats_t sim_stats;
+
+static uint64_t now_us;
+static bool bus_active;
+static uint32_t frame;
+static bool usb_ready; // usb_init 以後は OTG 割り込みのロックが戻っているはず
+
+// ---------------------------------------------------------------------------
+// 周辺のスタブ（I2C のコーデックと PLL はシミュレーションしない）
+
+static uint32_t plli2s_n = 344;
+static uint32_t plli2s_r = 2;
+
+void clock_set_plli2s(uint32_t n, uint32_t r) {
+  plli2s_n = n;
+  plli2s_r = r;
+}
+
+void cs43l22_set_power(bool on) {}
+
+// ---------------------------------------------------------------------------
+// UART: DMA の代わりに受け取ったバイトをそのまま貯める
+
+static char uart_buf[SIM_UART_BYTES];
+static uint32_t uart_len;
+static uint32_t uart_drops;
+
+void usart2_init(void) {}
+
+void usart2_write(const char *data, uint32_t len) {
+  if (sim_verbose) {
+    fwrite(data, 1, len, stdout);
+  }
+  if (uart_len + len >= SIM_UART_BYTES) {
+    uart_drops++;
+    return;
+  }
+  memcpy(&uart_buf[uart_len], data, len);
+  uart_len += len;
+  uart_buf[uart_len] = '\0';
+}
+
+void printf_usart2(const char *fmt, ...) {
+  char line[USART_TX_LINE_MAX];
+  va_list args;
+  int len;
+
+  va_start(args, fmt);
+  len = vsnprintf(line, sizeof(line), fmt, args);
+  va_end(args);
+  if (len < 0) {
+    return;
+  }
+  if (len >= (int)sizeof(line)) {
+    len = sizeof(line) - 1;
+  }
+  usart2_write(line, len);
+}
+
+uint32_t usart2_get_drop_count(void) { return uart_drops; }
+
+const char *sim_uart_log(void) { return uart_buf; }
+
+void sim_uart_clear(void) {
+  uart_len = 0;
+  uart_buf[0] = '\0';
+}
+
+// ---------------------------------------------------------------------------
+// DMA1 Stream5 + SPI3（I2S 送信）
+//   - EN を落とすと TCIF5 が立ち, TCIE なら割り込み
+//   - 時間が進むと I2S のレートでフレームを送り出し, NDTR が半分で HTIF5,
+//     0 で TCIF5 を立てて再装填する
+
+static bool dma_enabled;
+static uint32_t dma_reload; // EN を立てた時の NDTR
+static bool in_dma_isr;
+static uint64_t i2s_phase; // 送り出し途中のフレームの端数 [mHz * us]
+
+static void dma_irq(void) {
+  in_dma_isr = true;
+  DMA1_Stream5_IRQHandler();
+  in_dma_isr = false;
+  sim_stats.dma_irqs++;
+  host_dma1.HISR &= ~host_dma1.HIFCR;
+  host_dma1.HIFCR = 0;
+}
+
+static void dma_hook(void) {
+  uint32_t cr = host_dma1_stream5.CR;
+
+  if (in_dma_isr) {
+    return;
+  }
+  host_dma1.HISR &= ~host_dma1.HIFCR;
+  host_dma1.HIFCR = 0;
+  if (dma_enabled && !(cr & DMA_SxCR_EN)) {
+    host_dma1.HISR |= DMA_HISR_TCIF5;
+    if (cr & DMA_SxCR_TCIE) {
+      dma_irq();
+    }
+  } else if (!dma_enabled && (cr & DMA_SxCR_EN)) {
+    dma_reload = host_dma1_stream5.NDTR;
+  }
+  dma_enabled = cr & DMA_SxCR_EN;
+}
+
+// Fs = PLLI2S(1MHz * N / R) / (256 * (2 * DIV + ODD))（MCK 出力時）
+uint64_t sim_i2s_rate_mhz(void) {
+  uint32_t div = (host_spi3.I2SPR & SPI_I2SPR_I2SDIV) >> SPI_I2SPR_I2SDIV_Pos;
+  uint32_t odd = (host_spi3.I2SPR & SPI_I2SPR_ODD) ? 1 : 0;
+
+  return 1000000000ULL * plli2s_n / plli2s_r / (256 * (2 * div + odd));
+}
+
+static void i2s_play(uint32_t us) {
+  uint32_t halfwords = (host_spi3.I2SCFGR & SPI_I2SCFGR_CHLEN) ? 4 : 2;
+  uint64_t frames;
+
+  if (!dma_enabled || !(host_spi3.I2SCFGR & SPI_I2SCFGR_I2SE)) {
+    return;
+  }
+  i2s_phase += sim_i2s_rate_mhz() * us;
+  frames = i2s_phase / 1000000000ULL;
+  i2s_phase %= 1000000000ULL;
+
+  for (uint64_t i = 0; i < frames; i++) {
+    host_dma1_stream5.NDTR -= halfwords;
+    if (host_dma1_stream5.NDTR == dma_reload / 2) {
+      host_dma1.HISR |= DMA_HISR_HTIF5;
+      if (host_dma1_stream5.CR & DMA_SxCR_HTIE) {
+        dma_irq();
+      }
+    } else if (host_dma1_stream5.NDTR == 0) {
+      host_dma1_stream5.NDTR = dma_reload;
+      host_dma1.HISR |= DMA_HISR_TCIF5;
+      if (host_dma1_stream5.CR & DMA_SxCR_TCIE) {
+        dma_irq();
+      }
+    }
+  }
+  sim_stats.i2s_frames += frames;
+}
+
+// ---------------------------------------------------------------------------
+// 割り込み
+
+static void check_unlocked(const char *where) {
+  if (usb_ready && !host_nvic_enabled[OTG_FS_IRQn]) {
+    fprintf(stderr, "sim: OTG interrupt left masked after %s\n", where);
+    exit(1);
+  }
+}
+
+void sim_irq(void) {
+  uint32_t storm = 0;
+
+  for (;;) {
+    otg_model_sync();
+    if (host_nvic_enabled[OTG_FS_IRQn] && otg_model_pending()) {
+      uint64_t start = bench_now_ns();
+      uint64_t ns;
+
+      if (++storm == SIM_IRQ_STORM) {
+        fprintf(stderr, "sim: OTG interrupt storm (GINTSTS & GINTMSK 0x%08x)\n",
+                otg_model_pending());
+        exit(1);
+      }
+      OTG_FS_IRQHandler();
+      ns = bench_now_ns() - start;
+      otg_model_check();
+      check_unlocked("OTG_FS_IRQHandler");
+      sim_stats.otg_irqs++;
+      sim_stats.otg_irq_ns_total += ns;
+      if (ns > sim_stats.otg_irq_ns_max) {
+        sim_stats.otg_irq_ns_max = ns;
+      }
+      continue;
+    }
+    storm = 0;
+    if (host_scb.ICSR & SCB_ICSR_PENDSVSET_Msk) {
+      // PendSV_Handler はボトムハーフを呼ぶだけ
+      host_scb.ICSR &= ~SCB_ICSR_PENDSVSET_Msk;
+      usb_bottom_half();
+      otg_model_check();
+      check_unlocked("usb_bottom_half");
+      sim_stats.bottom_halves++;
+      continue;
+    }
+    return;
+  }
+}
+
+// ---------------------------------------------------------------------------
+// 時間とフレーム
+
+static void update_timers(void) {
+  host_tim5.CNT = (uint32_t)now_us;
+  host_tim2.CNT = (uint32_t)(now_us * (SystemCoreClock / 1000000));
+}
+
+// SOF: TIM2 が ITR1 で CCR1 にラッチし, OTG が SOF 割り込みを出す
+static void sof(void) {
+  if (host_tim2.SR & TIM_SR_CC1IF) {
+    host_tim2.SR |= TIM_SR_CC1OF;
+  }
+  host_tim2.CCR1 = host_tim2.CNT;
+  host_tim2.SR |= TIM_SR_CC1IF;
+  otg_sof(frame);
+  sim_irq();
+  // CCR1 を読むと CC1IF が消える（SOF 割り込みの tim2_sof_capture が読む）
+  host_tim2.SR &= ~TIM_SR_CC1IF;
+  if (sim_frame_hook != NULL) {
+    sim_frame_hook(frame);
+  }
+}
+
+// メインループの sched_add と同じ周期の仕事
+static void main_tasks(void) {
+  uac2_stream_task();
+  if (now_us % 1000000 == 0) {
+    uac2_latency_task();
+    uac2_log_stream_stats();
+    usb_log_irq_stats();
+  }
+}
+
+void sim_advance_us(uint32_t us) {
+  uint64_t target = now_us + us;
+
+  while (now_us < target) {
+    uint64_t next = (now_us / 1000 + 1) * 1000;
+
+    if (next > target) {
+      next = target;
+    }
+    i2s_play((uint32_t)(next - now_us));
+    now_us = next;
+    update_timers();
+    sim_irq();
+    if (now_us % 1000 != 0) {
+      continue;
+    }
+    main_tasks();
+    sim_irq();
+    if (bus_active) {
+      otg_end_of_frame();
+      sim_irq();
+      frame = (frame + 1) & 0x7FF;
+      sof();
+    }
+  }
+}
+
+uint64_t sim_now_us(void) { return now_us; }
+
+uint32_t sim_frame(void) { return frame; }
+
+void sim_bus_reset(void) {
+  otg_bus_reset();
+  sim_irq();
+  bus_active = true;
+  frame = 0;
+}
+
+void sim_init(void) {
+  otg_model_reset();
+  memset(&sim_stats, 0, sizeof(sim_stats));
+  memset(&host_dma1, 0, sizeof(host_dma1));
+  memset(&host_dma1_stream5, 0, sizeof(host_dma1_stream5));
+  memset(&host_spi3, 0, sizeof(host_spi3));
+  memset(&host_tim2, 0, sizeof(host_tim2));
+  memset(&host_tim5, 0, sizeof(host_tim5));
+  memset(&host_scb, 0, sizeof(host_scb));
+  memset(host_nvic_enabled, 0, sizeof(host_nvic_enabled));
+  sim_uart_clear();
+  now_us = 0;
+  frame = 0;
+  bus_active = false;
+  usb_ready = false;
+  dma_enabled = false;
+  i2s_phase = 0;
+  sim_frame_hook = NULL;
+  host_spi3.SR = SPI_SR_TXE;
+  host_dma1_stream5_hook = dma_hook;
+
+  // main() と同じ順（クロック, GPIO, I2C とコーデックは除く）
+  prof_init();
+  usart2_init();
+  log_set_level(LOG_INFO);
+  tim5_init();
+  tim2_sof_init();
+  i2s3_init();
+  usb_init();
+  usb_ready = true;
+  sim_irq();
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// 基板のシミュレーション: 時間, 割り込み, SOF と TIM2, I2S の DMA, UART
+// 時間はホストのスクリプトが sim_advance_us で進める。バスが動いていれば
+// 1ms ごとにフレームを締めて SOF を出し, sim_frame_hook を呼ぶ。
+// 割り込みはホストの操作の合間に sim_irq で優先度順に入る
+
+// SOF の直後に呼ばれる（iso の IN / OUT はここで流す）。
+// フックの中から sim_advance_us は呼ばないこと
+extern void (*sim_frame_hook)(uint32_t frame);
+// UART の出力を標準出力にも流す
+extern bool sim_verbose;
+
+typedef struct {
+  uint32_t otg_irqs;          // OTG_FS_IRQHandler を呼んだ回数
+  uint32_t bottom_halves;     // PendSV（usb_bottom_half）を呼んだ回数
+  uint32_t dma_irqs;          // DMA1_Stream5_IRQHandler を呼んだ回数
+  uint64_t otg_irq_ns_total;  // OTG 割り込みのホスト上の時間の合計と最大
+  uint64_t otg_irq_ns_max;
+  uint64_t i2s_frames;        // I2S が送り出したフレーム数
+} sim_stats_t;
+
+extern sim_stats_t sim_stats;
+
+// モデルを初期状態にし, main() と同じ順にファームウェアを初期化する。
+// ファームウェアの静的な状態は戻せないので, 1プロセスで1回だけ呼ぶ
+void sim_init(void);
+// 保留中の割り込みを, なくなるまで優先度順に処理する
+void sim_irq(void);
+// バスリセット。以後 1ms ごとに SOF が出る
+void sim_bus_reset(void);
+void sim_advance_us(uint32_t us);
+uint64_t sim_now_us(void);
+uint32_t sim_frame(void);
+// I2S のサンプルレート（PLLI2S と I2SPR から求めた実際の値）[mHz]
+uint64_t sim_i2s_rate_mhz(void);
+
+// UART に出たログ（NUL 終端）
+const char *sim_uart_log(void);
+void sim_uart_clear(void);
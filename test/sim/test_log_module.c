@@ -0,0 +1,49 @@
+#include "log.h"
+#include "sim.h"
+#include "test.h"
+#include "usb_audio.h"
+#include "usb_host.h"
+#include <string.h>
+
+// usb.c は LOG_MODULE_LEVEL=LOG_LEVEL_INFO で組まれる。実行時のレベルを
+// TRACE にして列挙を流し, usb.c の DEBUG 以下だけがコードごと消え,
+// 他のモジュールの DEBUG と usb.c の INFO は出ることを確かめる
+
+#if LOG_COMPILE_LEVEL < LOG_LEVEL_DEBUG
+#error "test_log_module needs LOG_DEBUG compiled in for the other modules"
+#endif
+
+static bool logged(const char *text) {
+  return strstr(sim_uart_log(), text) != NULL;
+}
+
+static void test_usb_module_level(void) {
+  uint32_t rate = 0;
+
+  log_set_level(LOG_TRACE);
+  sim_uart_clear();
+  usb_host_enumerate(5);
+  CHECK_EQ(usb_host_control(0xA1, UAC2_REQUEST_CUR,
+                            UAC2_CS_SAM_FREQ_CONTROL << 8,
+                            UAC2_ENTITY_ID_CLOCK_SOURCE << 8, 4, &rate),
+           4);
+
+  // usb.c: INFO は残り, DEBUG / SETUP / DATA は消えている
+  CHECK(logged("SET_ADDRESS: device_addr=0x05"));
+  CHECK(logged("SET_CONFIGURATION: configuration_value=0x01"));
+  CHECK(!logged("Write packet: epnum="));
+  CHECK(!logged("RXFLVL: EP"));
+  CHECK(!logged("EP0 IN complete"));
+  CHECK(!logged("[SETUP] "));
+  CHECK(!logged("[DATA]  "));
+
+  // usb_ctrl.c と usb_audio.c の DEBUG は実行時のレベルどおり出る
+  CHECK(logged("usb_ctrl: key=0x"));
+  CHECK(logged("GET_CUR Sample Rate: 48000 Hz"));
+}
+
+int main(void) {
+  sim_init();
+  RUN(test_usb_module_level);
+  return 0;
+}
@@ -0,0 +1,212 @@
+#include "usb_host.h"
+#include "otg_model.h"
+#include "sim.h"
+#include "test.h"
+#include "usb_audio.h"
+#include "usb_desc.h"
+#include <string.h>
+#include <stm32f411xe.h>
+
+// 1トランザクションでバスを使う時間と, NAK で再試行する回数
+#define XACT_US 20
+#define NAK_LIMIT 16
+#define EP0_MPS 64
+
+extern const USB_DeviceDescriptor device_descriptor;
+extern const UAC2_ConfigurationDescriptor configuration_descriptor;
+extern const uint8_t string_lang_descriptor[];
+extern const uint8_t string_manufacturer_descriptor[];
+extern const uint8_t string_product_descriptor[];
+
+usb_host_stream_t usb_host_stream;
+
+static uint32_t stream_phase; // 送り残したフレームの端数（10.14 形式）
+
+static otg_handshake_t host_in(uint8_t ep, uint8_t *buf, uint16_t max,
+                               uint16_t *len) {
+  otg_handshake_t r = OTG_NAK;
+
+  for (int i = 0; i < NAK_LIMIT && r == OTG_NAK; i++) {
+    r = otg_host_in(ep, buf, max, len);
+    sim_irq();
+    sim_advance_us(XACT_US);
+  }
+  CHECK(r != OTG_NAK);
+  return r;
+}
+
+static otg_handshake_t host_out(uint8_t ep, const uint8_t *data,
+                                uint16_t len) {
+  otg_handshake_t r = OTG_NAK;
+
+  for (int i = 0; i < NAK_LIMIT && r == OTG_NAK; i++) {
+    r = otg_host_out(ep, data, len);
+    sim_irq();
+    sim_advance_us(XACT_US);
+  }
+  CHECK(r != OTG_NAK);
+  return r;
+}
+
+int usb_host_control(uint8_t type, uint8_t request, uint16_t value,
+                     uint16_t index, uint16_t length, void *data) {
+  uint8_t setup[8] = {type,
+                      request,
+                      (uint8_t)value,
+                      (uint8_t)(value >> 8),
+                      (uint8_t)index,
+                      (uint8_t)(index >> 8),
+                      (uint8_t)length,
+                      (uint8_t)(length >> 8)};
+  uint8_t *buf = data;
+  uint16_t done = 0;
+  uint16_t n;
+
+  otg_host_setup(setup);
+  sim_irq();
+  sim_advance_us(XACT_US);
+
+  if (type & 0x80) {
+    // データ IN（短いパケットか wLength で終わり）, ステータス OUT
+    while (done < length) {
+      uint16_t max = length - done < EP0_MPS ? length - done : EP0_MPS;
+
+      if (host_in(0, buf + done, max, &n) == OTG_STALL) {
+        return -1;
+      }
+      done += n;
+      if (n < EP0_MPS) {
+        break;
+      }
+    }
+    if (host_out(0, NULL, 0) == OTG_STALL) {
+      return -1;
+    }
+  } else {
+    // データ OUT, ステータス IN（長さ0）
+    while (done < length) {
+      n = length - done < EP0_MPS ? length - done : EP0_MPS;
+      if (host_out(0, buf + done, n) == OTG_STALL) {
+        return -1;
+      }
+      done += n;
+    }
+    uint8_t zlp[1];
+    if (host_in(0, zlp, 0, &n) == OTG_STALL) {
+      return -1;
+    }
+    CHECK_EQ(n, 0);
+  }
+  return done;
+}
+
+static void get_descriptor(uint8_t type, uint8_t index, const void *expected,
+                           uint16_t length) {
+  static uint8_t buf[512];
+
+  CHECK(length <= sizeof(buf));
+  CHECK_EQ(usb_host_control(0x80, 0x06, (type << 8) | index, 0, length, buf),
+           length);
+  CHECK(memcmp(buf, expected, length) == 0);
+}
+
+void usb_host_enumerate(uint8_t address) {
+  const USB_ConfigurationDescriptor *config =
+      (const USB_ConfigurationDescriptor *)&configuration_descriptor;
+  uint8_t buf[64];
+
+  // Linux と同じく, 先頭64バイトを要求してからリセットし直す
+  sim_bus_reset();
+  sim_advance_us(10000);
+  CHECK_EQ(usb_host_control(0x80, 0x06, 0x0100, 0, 64, buf),
+           sizeof(USB_DeviceDescriptor));
+  CHECK(memcmp(buf, &device_descriptor, sizeof(USB_DeviceDescriptor)) == 0);
+  sim_bus_reset();
+  sim_advance_us(10000);
+
+  CHECK_EQ(usb_host_control(0x00, 0x05, address, 0, 0, NULL), 0);
+  CHECK_EQ((USB_DEVICE->DCFG & USB_OTG_DCFG_DAD) >> USB_OTG_DCFG_DAD_Pos,
+           address);
+  sim_advance_us(2000);
+
+  get_descriptor(0x01, 0, &device_descriptor, sizeof(USB_DeviceDescriptor));
+  get_descriptor(0x02, 0, config, sizeof(USB_ConfigurationDescriptor));
+  get_descriptor(0x02, 0, config, config->wTotalLength);
+  get_descriptor(0x03, 0, string_lang_descriptor, string_lang_descriptor[0]);
+  get_descriptor(0x03, 1, string_manufacturer_descriptor,
+                 string_manufacturer_descriptor[0]);
+  get_descriptor(0x03, 2, string_product_descriptor,
+                 string_product_descriptor[0]);
+
+  CHECK_EQ(usb_host_control(0x00, 0x09, 1, 0, 0, NULL), 0);
+}
+
+// 毎フレーム: フィードバックを読み, それに合わせた長さの OUT を送る
+static void stream_frame(uint32_t frame) {
+  usb_host_stream_t *s = &usb_host_stream;
+  uint8_t fb[3];
+  uint8_t packet[AUDIO_EP_MAX_PACKET_SIZE];
+  uint16_t n;
+  uint32_t frames;
+  uint32_t len;
+
+  if (otg_host_in(1, fb, sizeof(fb), &n) == OTG_ACK && n == sizeof(fb)) {
+    s->feedback = fb[0] | (fb[1] << 8) | (fb[2] << 16);
+    s->feedback_rx++;
+    if (s->feedback < s->feedback_min) {
+      s->feedback_min = s->feedback;
+    }
+    if (s->feedback > s->feedback_max) {
+      s->feedback_max = s->feedback;
+    }
+  }
+  sim_irq();
+
+  stream_phase += s->feedback;
+  frames = stream_phase >> 14;
+  stream_phase &= (1 << 14) - 1;
+  if (s->skip_every != 0 && frame % s->skip_every == 0) {
+    s->skipped++;
+    return;
+  }
+  len = frames * 2 * s->subslot;
+  CHECK(len <= sizeof(packet));
+  for (uint32_t i = 0; i < len; i++) {
+    packet[i] = (uint8_t)(frame + i);
+  }
+  if (otg_host_out(1, packet, (uint16_t)len) == OTG_ACK) {
+    s->packets++;
+  } else {
+    s->nak++;
+  }
+  sim_irq();
+}
+
+void usb_host_set_interface(uint8_t alt, uint32_t rate, uint8_t subslot) {
+  sim_frame_hook = NULL;
+  CHECK_EQ(usb_host_control(0x01, 0x0B, alt, UAC2_INTERFACE_STREAMING, 0, NULL),
+           0);
+  if (alt == 0) {
+    return;
+  }
+
+  memset(&usb_host_stream, 0, sizeof(usb_host_stream));
+  usb_host_stream.rate = rate;
+  usb_host_stream.subslot = subslot;
+  // フィードバックが届くまでは公称レートで送る
+  usb_host_stream.feedback = (uint32_t)(((uint64_t)rate << 14) / 1000);
+  usb_host_stream.feedback_min = UINT32_MAX;
+  stream_phase = 0;
+  sim_frame_hook = stream_frame;
+}
+
+void usb_host_set_sample_rate(uint32_t rate) {
+  uint8_t data[4] = {(uint8_t)rate, (uint8_t)(rate >> 8),
+                     (uint8_t)(rate >> 16), (uint8_t)(rate >> 24)};
+
+  CHECK_EQ(usb_host_control(0x21, UAC2_REQUEST_CUR,
+                            UAC2_CS_SAM_FREQ_CONTROL << 8,
+                            UAC2_ENTITY_ID_CLOCK_SOURCE << 8, sizeof(data),
+                            data),
+           sizeof(data));
+}
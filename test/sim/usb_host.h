@@ -0,0 +1,38 @@
+#pragma once
+
+#include "usb.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// スクリプトで動かす USB ホスト。トランザクションごとに割り込みを処理し,
+// 時間を少し進める。NAK が続いたり STALL されたりしたら呼び出し元へ返す
+
+// 制御転送。data は wLength バイト（IN は受け取り先, OUT は送る内容）。
+// データステージで転送したバイト数, STALL なら -1 を返す
+int usb_host_control(uint8_t type, uint8_t request, uint16_t value,
+                     uint16_t index, uint16_t length, void *data);
+
+// バスリセットから SET_CONFIGURATION(1) までの列挙。ディスクリプタは
+// ファームウェアの定義と突き合わせる
+void usb_host_enumerate(uint8_t address);
+
+// 1ms ごとの iso ストリーミング
+typedef struct {
+  uint32_t rate;        // ホスト側のサンプルレート [Hz]
+  uint8_t subslot;      // 1サンプルのバイト数（2, 3, 4）
+  uint32_t skip_every;  // 0 でなければこのフレーム数ごとに1回送らない
+  uint32_t skipped;     // skip_every で送らなかったフレーム
+  uint32_t packets;     // 送った OUT パケット
+  uint32_t nak;         // 受け付けられなかった OUT パケット
+  uint32_t feedback_rx; // 受け取ったフィードバック
+  uint32_t feedback;    // 最新のフィードバック（10.14 形式 [frames/ms]）
+  uint32_t feedback_min;
+  uint32_t feedback_max;
+} usb_host_stream_t;
+
+extern usb_host_stream_t usb_host_stream;
+
+// SET_INTERFACE(1, alt) を送り, alt が0でなければ毎フレーム送り始める
+void usb_host_set_interface(uint8_t alt, uint32_t rate, uint8_t subslot);
+// SET_CUR でサンプルレートを変える
+void usb_host_set_sample_rate(uint32_t rate);
@@ -0,0 +1,165 @@
+#include "audio_conceal.h"
+#include "otg_model.h"
+#include "sim.h"
+#include "test.h"
+#include "usb_audio.h"
+#include "usb_host.h"
+#include <stdio.h>
+#include <string.h>
+
+// OTG FS のシミュレーション: 列挙, SET_INTERFACE, 1ms ごとの iso 転送を
+// スクリプトのホストで流し, ファームウェアの統計を確かめて表示する
+//   usb_sim [-v]   -v で UART のログも表示する
+
+#define DEVICE_ADDRESS 5
+#define STREAM_MS 3000
+
+static uint64_t enumerate_us;
+
+static void print_stats(const char *name) {
+  usb_host_stream_t *s = &usb_host_stream;
+
+  printf("%s: packets=%u nak=%u received=%u missed=%u incomplete=%u\n", name,
+         s->packets, s->nak, uac2_iso_stats.received, uac2_iso_stats.missed,
+         uac2_iso_stats.incomplete);
+  printf("  feedback %u..%u (x 2^-14 frames/ms), ring fill %u frames, "
+         "underruns %u, drops %u\n",
+         s->feedback_min, s->feedback_max,
+         audio_ring_fill(&audio_playback_ring), audio_conceal_stats.underruns,
+         audio_conceal_stats.drops);
+  printf("  RX FIFO peak %u words, OTG IRQ %u (avg %llu ns, max %llu ns on "
+         "this host)\n",
+         otg_model_stats.rx_peak_words, sim_stats.otg_irqs,
+         sim_stats.otg_irqs ? (unsigned long long)(sim_stats.otg_irq_ns_total /
+                                                   sim_stats.otg_irqs)
+                            : 0ULL,
+         (unsigned long long)sim_stats.otg_irq_ns_max);
+}
+
+static void test_enumerate(void) {
+  uint64_t start = sim_now_us();
+
+  usb_host_enumerate(DEVICE_ADDRESS);
+  enumerate_us = sim_now_us() - start;
+  printf("enumeration: %llu us\n", (unsigned long long)enumerate_us);
+}
+
+// クラスリクエスト: サンプルレートの読み出し, 未定義のリクエストは STALL
+static void test_class_requests(void) {
+  uint32_t rate = 0;
+  uint8_t buf[4];
+
+  CHECK_EQ(usb_host_control(0xA1, UAC2_REQUEST_CUR,
+                            UAC2_CS_SAM_FREQ_CONTROL << 8,
+                            UAC2_ENTITY_ID_CLOCK_SOURCE << 8, 4, &rate),
+           4);
+  CHECK_EQ(rate, 48000);
+  CHECK_EQ(usb_host_control(0xC0, 0x7F, 0, 0, sizeof(buf), buf), -1);
+}
+
+// 実際の I2S レートでの 10.14 形式のフィードバック
+static uint32_t device_feedback(void) {
+  return (uint32_t)((sim_i2s_rate_mhz() << 14) / 1000000);
+}
+
+// 1ストリームを流し, 取りこぼしなく再生でき, フィードバックが実際の
+// I2S レートに収束してリングが目標付近に留まることを確かめる
+static void stream(const char *name, uint8_t alt, uint32_t rate,
+                   uint8_t subslot) {
+  usb_host_stream_t *s = &usb_host_stream;
+  uint32_t nominal = (uint32_t)(((uint64_t)rate << 14) / 1000);
+  uint32_t underruns = audio_conceal_stats.underruns;
+  uint32_t drops = audio_conceal_stats.drops;
+  uint32_t incomplete = uac2_iso_stats.incomplete;
+  UAC2_Latency latency;
+
+  usb_host_set_interface(alt, rate, subslot);
+  sim_advance_us(STREAM_MS * 1000);
+  print_stats(name);
+
+  CHECK_EQ(uac2_stream_state, UAC2_STREAM_RUNNING);
+  CHECK_EQ(s->packets, STREAM_MS);
+  CHECK_EQ(s->nak, 0);
+  CHECK_EQ(uac2_iso_stats.received, s->packets);
+  CHECK_EQ(uac2_iso_stats.missed, 0);
+  CHECK_EQ(uac2_iso_stats.incomplete, incomplete);
+  CHECK(s->feedback_rx >= STREAM_MS - 2);
+  CHECK(s->feedback_min >= nominal - (nominal >> 6));
+  CHECK(s->feedback_max <= nominal + (nominal >> 6));
+  // 最後のフィードバックは公称値ではなく実際のレートの 0.1% 以内
+  CHECK(s->feedback + (nominal >> 10) >= device_feedback());
+  CHECK(s->feedback <= device_feedback() + (nominal >> 10));
+  uac2_get_latency(&latency);
+  CHECK(latency.latency_frames >= latency.target_frames / 2);
+  CHECK(latency.latency_frames <= latency.target_frames * 2);
+  CHECK_EQ(audio_conceal_stats.underruns, underruns);
+  CHECK_EQ(audio_conceal_stats.drops, drops);
+}
+
+static void test_stream_48k(void) {
+  stream("48 kHz / 16 bit", UAC2_AS_ALT_PCM16, 48000, 2);
+}
+
+// 10フレームに1回ホストが送らない: 締めたフレームで INCOMPISOOUT が出て
+// ファームウェアが次のフレームへ向け直し, 続くパケットは受け付けられる。
+// 送らなかった分の音は失われるので, リングのアンダーランは問わない
+static void test_packet_loss(void) {
+  usb_host_stream_t *s = &usb_host_stream;
+  uint32_t incomplete = uac2_iso_stats.incomplete;
+
+  s->skip_every = 10;
+  sim_advance_us(1000 * 1000);
+  print_stats("  with every 10th packet skipped");
+
+  CHECK(s->skipped >= 99);
+  CHECK_EQ(s->nak, 0);
+  CHECK_EQ(s->packets + s->skipped, STREAM_MS + 1000);
+  CHECK_EQ(uac2_iso_stats.received, s->packets);
+  CHECK(uac2_iso_stats.missed + 1 >= s->skipped);
+  CHECK(uac2_iso_stats.missed <= s->skipped);
+  CHECK(uac2_iso_stats.incomplete - incomplete + 1 >= s->skipped);
+  s->skip_every = 0;
+}
+
+// alt 0: 無音にしてから IDLE に戻り, EP1 OUT は受け付けなくなる
+static void test_stream_stop(void) {
+  uint8_t packet[4] = {0};
+  uint32_t stops = uac2_stream_latency.stops;
+
+  usb_host_set_interface(UAC2_AS_ALT_ZERO_BANDWIDTH, 0, 0);
+  sim_advance_us(50 * 1000);
+  CHECK_EQ(uac2_stream_state, UAC2_STREAM_IDLE);
+  CHECK_EQ(uac2_stream_latency.stops, stops + 1);
+  CHECK(uac2_stream_latency.stop_latency_us > 0);
+  CHECK(uac2_stream_latency.stop_latency_us <= UAC2_LATENCY_US_MAX);
+  CHECK_EQ(otg_host_out(1, packet, sizeof(packet)), OTG_NAK);
+  sim_irq();
+}
+
+// 止めた状態でレートを変え, 24bit packed で流し直す
+static void test_stream_96k_24bit(void) {
+  uint32_t rate = 0;
+
+  usb_host_set_sample_rate(96000);
+  CHECK_EQ(usb_host_control(0xA1, UAC2_REQUEST_CUR,
+                            UAC2_CS_SAM_FREQ_CONTROL << 8,
+                            UAC2_ENTITY_ID_CLOCK_SOURCE << 8, 4, &rate),
+           4);
+  CHECK_EQ(rate, 96000);
+  stream("96 kHz / 24 bit packed", UAC2_AS_ALT_PCM24_PACKED, 96000, 3);
+  CHECK_EQ(uac2_stream_format.subslot_size, 3);
+  CHECK_EQ(uac2_stream_format.bit_depth, 24);
+}
+
+int main(int argc, char **argv) {
+  sim_verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+  sim_init();
+
+  RUN(test_enumerate);
+  RUN(test_class_requests);
+  RUN(test_stream_48k);
+  RUN(test_packet_loss);
+  RUN(test_stream_stop);
+  RUN(test_stream_96k_24bit);
+  return 0;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// 最小限のテストマクロ。失敗は場所を表示して即終了する
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      exit(1);                                                                 \
+    }                                                                          \
+  } while (0)
+
+#define CHECK_EQ(a, b)                                                         \
+  do {                                                                         \
+    long long a_ = (long long)(a);                                             \
+    long long b_ = (long long)(b);                                             \
+    if (a_ != b_) {                                                            \
+      fprintf(stderr, "%s:%d: %s == %s failed (%lld != %lld)\n", __FILE__,     \
+              __LINE__, #a, #b, a_, b_);                                       \
+      exit(1);                                                                 \
+    }                                                                          \
+  } while (0)
+
+#define RUN(test)                                                              \
+  do {                                                                         \
+    test();                                                                    \
+    printf("ok %s\n", #test);                                                  \
+  } while (0)
@@ -0,0 +1,160 @@
+#include "audio_conceal.h"
+#include "audio_ring.h"
+#include "test.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// サイン波をリング越しに流し, 出力の隣り合うサンプルの差の最大値
+// （クリックの大きさ）を元の信号の最大の差と比べる
+#define RATE 48000
+#define AMPLITUDE 0x600000       // 24bit フルスケールの 3/4
+#define PERIOD 48                // I2S DMA 1周期のフレーム数
+#define NO_DROP AUDIO_RING_WORDS // 間引かない高水位
+
+static audio_ring_t ring;
+static uint32_t frame_words;
+static double tone;
+static double phase;
+static int32_t last_out;
+static bool have_last;
+static int64_t max_step;
+
+// 左詰め32bit ⇔ リングのワード（16bit: L/R を1ワード, 24bit: 入れ替え済み）
+static int32_t tone_sample(void) {
+  int32_t s = (int32_t)(AMPLITUDE * sin(phase)) * 256;
+  phase += 2 * M_PI * tone / RATE;
+  return frame_words == 1 ? (int32_t)((uint32_t)s & 0xFFFF0000) : s;
+}
+
+static void produce(uint32_t frames) {
+  uint32_t words[2];
+
+  for (uint32_t i = 0; i < frames; i++) {
+    uint32_t s = (uint32_t)tone_sample();
+    if (frame_words == 1) {
+      words[0] = (s >> 16) | (s & 0xFFFF0000);
+    } else {
+      words[0] = words[1] = (s << 16) | (s >> 16);
+    }
+    CHECK_EQ(audio_ring_write(&ring, words, 1), 1);
+  }
+}
+
+static void skip(uint32_t frames) { phase += 2 * M_PI * tone / RATE * frames; }
+
+static void consume(uint32_t high_water) {
+  uint32_t out[PERIOD * 2];
+
+  CHECK_EQ(audio_conceal_read(&ring, out, PERIOD, high_water), PERIOD);
+  for (uint32_t i = 0; i < PERIOD; i++) {
+    uint32_t w = out[i * frame_words];
+    int32_t l = frame_words == 1 ? (int32_t)(w << 16)
+                                 : (int32_t)((w << 16) | (w >> 16));
+    int64_t step = llabs((int64_t)l - last_out);
+    if (have_last && step > max_step) {
+      max_step = step;
+    }
+    last_out = l;
+    have_last = true;
+  }
+}
+
+static void start(uint32_t words, double hz, double start_phase) {
+  audio_ring_init(&ring);
+  audio_ring_set_frame_words(&ring, words);
+  audio_conceal_reset();
+  frame_words = words;
+  tone = hz;
+  phase = start_phase;
+  have_last = false;
+  max_step = 0;
+}
+
+// 元の信号の隣り合うサンプルの最大差
+static int64_t natural_step(void) {
+  return (int64_t)(AMPLITUDE * 256.0 * 2 * M_PI * tone / RATE);
+}
+
+// 欠落: 繰り返し → 無音へフェード → 復帰のどこにも段差がない
+static void test_underrun_is_smooth(void) {
+  for (uint32_t words = 1; words <= 2; words++) {
+    // 短い欠落（補間中に復帰）と長い欠落（無音まで落ちてから復帰）
+    static const uint32_t gaps[] = {1, 3, 20};
+
+    for (uint32_t g = 0; g < sizeof(gaps) / sizeof(gaps[0]); g++) {
+      uint32_t underruns = audio_conceal_stats.underruns;
+      uint32_t fades = audio_conceal_stats.fades;
+
+      start(words, 1000, 0.3);
+      produce(PERIOD);
+      consume(NO_DROP);
+      produce(PERIOD / 2); // 周期の途中で途切れる
+      consume(NO_DROP);
+      skip(PERIOD / 2);
+      for (uint32_t p = 1; p < gaps[g]; p++) {
+        consume(NO_DROP);
+        skip(PERIOD);
+      }
+      for (uint32_t p = 0; p < 4; p++) {
+        produce(PERIOD);
+        consume(NO_DROP);
+      }
+
+      CHECK(max_step <= 2 * natural_step());
+      CHECK_EQ(audio_conceal_stats.underruns - underruns, 1);
+      CHECK_EQ(audio_conceal_stats.fades - fades,
+               (gaps[g] - 1) * PERIOD + PERIOD / 2 >= AUDIO_CONCEAL_FADE);
+    }
+  }
+}
+
+// 間引き: どの位相から始めても（一番静かな位置が周期の末尾に来ても）
+// クロスフェードは周期内で終わり, 段差が残らない。
+// 500Hz は2周期で1回しかゼロを横切らないので, 末尾に来る位相が必ずある
+static void test_drop_splice_is_smooth(void) {
+  for (uint32_t words = 1; words <= 2; words++) {
+    for (uint32_t offset = 0; offset < 2 * PERIOD; offset++) {
+      uint32_t drops = audio_conceal_stats.drops;
+      uint32_t dropped = audio_conceal_stats.dropped_frames;
+
+      start(words, 500, M_PI * offset / PERIOD);
+      produce(PERIOD);
+      consume(NO_DROP);
+      // 高水位を大きく超えさせて毎周期 AUDIO_CONCEAL_DROP ずつ間引かせる
+      produce(8 * PERIOD);
+      for (uint32_t p = 0; p < 4; p++) {
+        produce(PERIOD);
+        consume(PERIOD);
+      }
+
+      CHECK(max_step <= 2 * natural_step());
+      CHECK_EQ(audio_conceal_stats.drops - drops, 4);
+      CHECK_EQ(audio_conceal_stats.dropped_frames - dropped,
+               4 * AUDIO_CONCEAL_DROP);
+    }
+  }
+}
+
+// クロスフェード長に満たない周期では間引かない
+static void test_short_period_does_not_drop(void) {
+  uint32_t out[AUDIO_CONCEAL_XFADE];
+  uint32_t drops = audio_conceal_stats.drops;
+
+  start(1, 1000, 0);
+  produce(16 * PERIOD);
+  CHECK_EQ(audio_conceal_read(&ring, out, AUDIO_CONCEAL_XFADE - 1, 0),
+           AUDIO_CONCEAL_XFADE - 1);
+  CHECK_EQ(audio_conceal_stats.drops, drops);
+  CHECK_EQ(audio_conceal_read(&ring, out, AUDIO_CONCEAL_XFADE, 0),
+           AUDIO_CONCEAL_XFADE);
+  CHECK_EQ(audio_conceal_stats.drops, drops + 1);
+}
+
+int main(void) {
+  RUN(test_underrun_is_smooth);
+  RUN(test_drop_splice_is_smooth);
+  RUN(test_short_period_does_not_drop);
+  return 0;
+}
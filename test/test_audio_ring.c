@@ -0,0 +1,220 @@
+#include "audio_ring.h"
+#include "test.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+
+static audio_ring_t ring;
+
+static void test_fill_and_space(void) {
+  uint32_t src[64];
+  uint32_t dst[64];
+
+  for (uint32_t frame_words = 1; frame_words <= 2; frame_words++) {
+    audio_ring_init(&ring);
+    audio_ring_set_frame_words(&ring, frame_words);
+    uint32_t capacity = AUDIO_RING_WORDS / frame_words;
+    CHECK_EQ(audio_ring_capacity(&ring), capacity);
+    CHECK_EQ(audio_ring_fill(&ring), 0);
+    CHECK_EQ(audio_ring_space(&ring), capacity);
+
+    for (uint32_t i = 0; i < 64; i++) {
+      src[i] = 0x1000 + i;
+    }
+    CHECK_EQ(audio_ring_write(&ring, src, 32 / frame_words), 32 / frame_words);
+    CHECK_EQ(audio_ring_fill(&ring), 32 / frame_words);
+    CHECK_EQ(audio_ring_space(&ring), capacity - 32 / frame_words);
+
+    CHECK_EQ(audio_ring_read(&ring, dst, 32 / frame_words), 32 / frame_words);
+    CHECK(memcmp(src, dst, 32 * 4) == 0);
+    CHECK_EQ(audio_ring_fill(&ring), 0);
+    CHECK_EQ(ring.overrun_count, 0);
+    CHECK_EQ(ring.underrun_count, 0);
+  }
+}
+
+// head/tail が AUDIO_RING_WORDS と 2^32 の両方を跨いでも順序が保たれる
+static void test_wrap_around(void) {
+  uint32_t buf[97 * 2];
+  uint32_t next_write = 0;
+  uint32_t next_read = 0;
+
+  for (uint32_t frame_words = 1; frame_words <= 2; frame_words++) {
+    audio_ring_init(&ring);
+    audio_ring_set_frame_words(&ring, frame_words);
+    // インデックスの桁あふれ直前から始める
+    ring.head = ring.tail = 0u - 5 * AUDIO_RING_WORDS / 2;
+
+    for (uint32_t round = 0; round < 2000; round++) {
+      uint32_t n = 97;
+      for (uint32_t i = 0; i < n * frame_words; i++) {
+        buf[i] = next_write++;
+      }
+      CHECK_EQ(audio_ring_write(&ring, buf, n), n);
+      CHECK_EQ(audio_ring_read(&ring, buf, n), n);
+      for (uint32_t i = 0; i < n * frame_words; i++) {
+        CHECK_EQ(buf[i], next_read++);
+      }
+    }
+    CHECK(ring.head < ring.tail + AUDIO_RING_WORDS); // 2^32 を跨いだ
+    CHECK_EQ(ring.overrun_count, 0);
+    CHECK_EQ(ring.underrun_count, 0);
+  }
+}
+
+// 入り切らない分は新しい側を捨て, 古いデータは残る
+static void test_overrun(void) {
+  static uint32_t src[AUDIO_RING_WORDS + 16];
+  static uint32_t dst[AUDIO_RING_WORDS + 16];
+
+  audio_ring_init(&ring);
+  for (uint32_t i = 0; i < AUDIO_RING_WORDS + 16; i++) {
+    src[i] = i;
+  }
+  CHECK_EQ(audio_ring_write(&ring, src, AUDIO_RING_WORDS - 8),
+           AUDIO_RING_WORDS - 8);
+  CHECK_EQ(audio_ring_write(&ring, src + AUDIO_RING_WORDS - 8, 24), 8);
+  CHECK_EQ(ring.overrun_count, 1);
+  CHECK_EQ(audio_ring_space(&ring), 0);
+  CHECK_EQ(audio_ring_write(&ring, src, 1), 0);
+  CHECK_EQ(ring.overrun_count, 2);
+
+  // ゼロコピー側も同じ数え方
+  CHECK_EQ(audio_ring_write_begin(&ring, 4), 0);
+  CHECK_EQ(ring.overrun_count, 3);
+
+  CHECK_EQ(audio_ring_read(&ring, dst, AUDIO_RING_WORDS), AUDIO_RING_WORDS);
+  CHECK(memcmp(src, dst, AUDIO_RING_WORDS * 4) == 0);
+  CHECK_EQ(ring.underrun_count, 0);
+}
+
+static void test_underrun(void) {
+  uint32_t src[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+  uint32_t dst[16];
+
+  audio_ring_init(&ring);
+  audio_ring_set_frame_words(&ring, 2);
+  CHECK_EQ(audio_ring_write(&ring, src, 3), 3);
+  CHECK_EQ(audio_ring_read(&ring, dst, 8), 3);
+  CHECK(memcmp(src, dst, 6 * 4) == 0);
+  CHECK_EQ(ring.underrun_count, 1);
+  CHECK_EQ(audio_ring_read(&ring, dst, 1), 0);
+  CHECK_EQ(ring.underrun_count, 2);
+  CHECK_EQ(audio_ring_read(&ring, dst, 0), 0);
+  CHECK_EQ(ring.underrun_count, 2);
+  CHECK_EQ(ring.overrun_count, 0);
+}
+
+// プロデューサとコンシューマを別々の速さで交互に動かす。
+// 受け付けたフレームは欠けず順番どおりに出てきて, 溢れ/不足の回数は
+// 各呼び出しの時点の fill/space から数えた期待値と一致する
+static void run_interleaving(uint32_t frame_words, uint32_t write_frames,
+                             uint32_t read_frames, uint32_t writes_per_read) {
+  static uint32_t buf[1024];
+  uint32_t next_write = 0;
+  uint32_t next_read = 0;
+  uint32_t overruns = 0;
+  uint32_t underruns = 0;
+
+  audio_ring_init(&ring);
+  audio_ring_set_frame_words(&ring, frame_words);
+
+  for (uint32_t step = 0; step < 20000; step++) {
+    if (step % (writes_per_read + 1) != writes_per_read) {
+      // 周期的に1フレーム多い/少ないパケットを混ぜる
+      uint32_t n = write_frames + (step % 7 == 0) - (step % 11 == 0);
+      uint32_t space = audio_ring_space(&ring);
+      for (uint32_t i = 0; i < n * frame_words; i++) {
+        buf[i] = next_write + i;
+      }
+      uint32_t written = audio_ring_write(&ring, buf, n);
+      CHECK_EQ(written, n < space ? n : space);
+      overruns += n > space;
+      next_write += written * frame_words;
+    } else {
+      uint32_t fill = audio_ring_fill(&ring);
+      uint32_t got = audio_ring_read(&ring, buf, read_frames);
+      CHECK_EQ(got, read_frames < fill ? read_frames : fill);
+      underruns += read_frames > fill;
+      for (uint32_t i = 0; i < got * frame_words; i++) {
+        CHECK_EQ(buf[i], next_read++);
+      }
+    }
+    CHECK_EQ(ring.overrun_count, overruns);
+    CHECK_EQ(ring.underrun_count, underruns);
+  }
+}
+
+static void test_interleavings(void) {
+  for (uint32_t frame_words = 1; frame_words <= 2; frame_words++) {
+    run_interleaving(frame_words, 48, 48, 1); // 釣り合い
+    run_interleaving(frame_words, 48, 96, 2); // 消費が2倍の周期
+    run_interleaving(frame_words, 12, 250, 20);
+
+    run_interleaving(frame_words, 44, 100, 1); // 消費が速い: 不足が続く
+    CHECK(ring.underrun_count > 1000);
+    run_interleaving(frame_words, 97, 96, 1); // 生産が速い: 溢れが続く
+    CHECK(ring.overrun_count > 1000);
+  }
+}
+
+// 本物の2スレッドで回す（x86 でも volatile + フェンスで足りることの確認）
+#define THREAD_WORDS (1u << 21)
+
+static void *producer_thread(void *arg) {
+  uint32_t next = 0;
+  uint32_t n = 1;
+
+  (void)arg;
+  while (next < THREAD_WORDS) {
+    // ゼロコピーの書き込み経路
+    uint32_t frames = audio_ring_write_begin(&ring, n);
+    for (uint32_t i = 0; i < frames * 2; i++) {
+      audio_ring_put(&ring, i, next + i);
+    }
+    audio_ring_write_end(&ring, frames);
+    next += frames * 2;
+    if (frames == 0) {
+      sched_yield(); // 1コアでも相手のスレッドに回す
+    }
+    n = n % 61 + 1;
+  }
+  return NULL;
+}
+
+static void test_threads(void) {
+  static uint32_t buf[128];
+  pthread_t producer;
+  uint32_t next = 0;
+  uint32_t n = 1;
+
+  audio_ring_init(&ring);
+  audio_ring_set_frame_words(&ring, 2);
+  CHECK(pthread_create(&producer, NULL, producer_thread, NULL) == 0);
+  while (next < THREAD_WORDS) {
+    uint32_t got = audio_ring_read(&ring, buf, n);
+    if (got == 0) {
+      sched_yield();
+    }
+    for (uint32_t i = 0; i < got * 2; i++) {
+      if (buf[i] != next) {
+        CHECK_EQ(buf[i], next);
+      }
+      next++;
+    }
+    n = n % 53 + 1;
+  }
+  pthread_join(producer, NULL);
+  CHECK_EQ(audio_ring_fill(&ring), 0);
+}
+
+int main(void) {
+  RUN(test_fill_and_space);
+  RUN(test_wrap_around);
+  RUN(test_overrun);
+  RUN(test_underrun);
+  RUN(test_interleavings);
+  RUN(test_threads);
+  return 0;
+}
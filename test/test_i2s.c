@@ -0,0 +1,122 @@
+#include "audio_ring.h"
+#include "i2s.h"
+#include "test.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stm32f411xe.h>
+
+// DMA1 Stream5 の簡単なモデル
+//   - EN を落とすと TCIF5 が立ち, TCIE なら割り込み（呼び出し元より高優先度）
+//   - play() で NDTR を進め, 半分で HTIF5, 0 で TCIF5 を立てて再装填する
+// 割り込みはレジスタアクセスの合間に入る（host_dma1_stream5_hook）
+
+audio_ring_t audio_playback_ring;
+
+void DMA1_Stream5_IRQHandler(void);
+
+void clock_set_plli2s(uint32_t n, uint32_t r) {}
+
+static bool dma_enabled;
+static uint32_t dma_reload; // EN を立てた時の NDTR
+static bool in_isr;
+
+static void dma_irq(void) {
+  in_isr = true;
+  DMA1_Stream5_IRQHandler();
+  in_isr = false;
+  host_dma1.HISR &= ~host_dma1.HIFCR;
+  host_dma1.HIFCR = 0;
+}
+
+static void dma_hook(void) {
+  uint32_t cr = host_dma1_stream5.CR;
+
+  if (in_isr) {
+    return;
+  }
+  host_dma1.HISR &= ~host_dma1.HIFCR;
+  host_dma1.HIFCR = 0;
+  if (dma_enabled && !(cr & DMA_SxCR_EN)) {
+    host_dma1.HISR |= DMA_HISR_TCIF5;
+    if (cr & DMA_SxCR_TCIE) {
+      dma_irq();
+    }
+  } else if (!dma_enabled && (cr & DMA_SxCR_EN)) {
+    dma_reload = host_dma1_stream5.NDTR;
+  }
+  dma_enabled = cr & DMA_SxCR_EN;
+}
+
+// frames フレーム送り出す。halfwords はフレームあたりのハーフワード数
+static void play(uint32_t frames, uint32_t halfwords) {
+  for (uint32_t i = 0; i < frames; i++) {
+    host_dma1_stream5.NDTR -= halfwords;
+    if (host_dma1_stream5.NDTR == dma_reload / 2) {
+      host_dma1.HISR |= DMA_HISR_HTIF5;
+      if (host_dma1_stream5.CR & DMA_SxCR_HTIE) {
+        dma_irq();
+      }
+    } else if (host_dma1_stream5.NDTR == 0) {
+      host_dma1_stream5.NDTR = dma_reload;
+      host_dma1.HISR |= DMA_HISR_TCIF5;
+      if (host_dma1_stream5.CR & DMA_SxCR_TCIE) {
+        dma_irq();
+      }
+    }
+  }
+}
+
+static void setup(void) {
+  host_spi3.SR = SPI_SR_TXE;
+  host_dma1_stream5_hook = dma_hook;
+  audio_ring_init(&audio_playback_ring);
+  i2s3_init();
+}
+
+// レートや形式を変えても再生フレーム数は停止位置から続く
+static void test_frames_continuous(void) {
+  uint32_t played = 0;
+
+  setup();
+  play(30, 2);
+  played += 30;
+  CHECK_EQ(i2s3_frames_played(), played);
+
+  CHECK(i2s3_set_sample_rate(96000));
+  CHECK_EQ(i2s3_frames_played(), played);
+  play(3 * i2s3_period_frames() + 7, 2); // 半分と周回を跨ぐ
+  played += 3 * i2s3_period_frames() + 7;
+  CHECK_EQ(i2s3_frames_played(), played);
+
+  CHECK(i2s3_set_format(24));
+  CHECK_EQ(i2s3_frames_played(), played);
+  play(i2s3_period_frames() + 5, 4);
+  played += i2s3_period_frames() + 5;
+  CHECK_EQ(i2s3_frames_played(), played);
+
+  CHECK(i2s3_set_sample_rate(48000));
+  CHECK_EQ(i2s3_frames_played(), played);
+  CHECK(i2s3_set_format(16));
+  CHECK_EQ(i2s3_frames_played(), played);
+  play(2 * i2s3_period_frames(), 2);
+  played += 2 * i2s3_period_frames();
+  CHECK_EQ(i2s3_frames_played(), played);
+}
+
+// 一時停止中にレートを変えても割り込みは止めたまま
+static void test_pause_survives_restart(void) {
+  setup();
+  i2s3_pause();
+  CHECK(i2s3_set_sample_rate(96000));
+  CHECK_EQ(host_dma1_stream5.CR & (DMA_SxCR_HTIE | DMA_SxCR_TCIE), 0);
+  CHECK(host_dma1_stream5.CR & DMA_SxCR_EN);
+  i2s3_resume();
+  CHECK_EQ(host_dma1_stream5.CR & (DMA_SxCR_HTIE | DMA_SxCR_TCIE),
+           DMA_SxCR_HTIE | DMA_SxCR_TCIE);
+}
+
+int main(void) {
+  RUN(test_frames_continuous);
+  RUN(test_pause_survives_restart);
+  return 0;
+}
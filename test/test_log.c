@@ -0,0 +1,49 @@
+#include "log.h"
+#include "test.h"
+#include "usart.h"
+#include <stdint.h>
+
+// LOG_COMPILE_LEVEL=LOG_LEVEL_INFO で組む（リリースビルドと同じ）
+#if LOG_COMPILE_LEVEL != LOG_LEVEL_INFO
+#error "test_log must be built with LOG_COMPILE_LEVEL=LOG_LEVEL_INFO"
+#endif
+
+static uint32_t evaluated;
+
+static int arg(void) {
+  evaluated++;
+  return 0;
+}
+
+// コンパイル時に外したレベルは引数も評価しない
+static void test_compiled_out_levels(void) {
+  current_log_level = LOG_TRACE;
+  evaluated = 0;
+  LOG_DEBUG("%d\r\n", arg());
+  LOG_TRACE("%d\r\n", arg());
+  USB_SETUP("%d\r\n", arg());
+  USB_DATA("%d\r\n", arg());
+  CHECK_EQ(evaluated, 0);
+}
+
+// 残したレベルは実行時のレベルで絞る
+static void test_runtime_filter(void) {
+  evaluated = 0;
+  current_log_level = LOG_WARN;
+  LOG_INFO("%d\r\n", arg());
+  USB_LOG("%d\r\n", arg());
+  CHECK_EQ(evaluated, 0);
+  LOG_WARN("%d\r\n", arg());
+  CHECK_EQ(evaluated, 1);
+
+  current_log_level = LOG_INFO;
+  LOG_INFO("%d\r\n", arg());
+  USB_LOG("%d\r\n", arg());
+  CHECK_EQ(evaluated, 3);
+}
+
+int main(void) {
+  RUN(test_compiled_out_levels);
+  RUN(test_runtime_filter);
+  return 0;
+}
@@ -0,0 +1,76 @@
+#include "prof.h"
+#include "test.h"
+#include <stdint.h>
+
+// bin 0: 0, bin k: [2^(k-1), 2^k), 最後の bin はそれ以上すべて
+static void test_hist_bin_edges(void) {
+  CHECK_EQ(prof_hist_bin(0), 0);
+  CHECK_EQ(prof_hist_bin(1), 1);
+  for (uint32_t k = 2; k < PROF_HIST_BINS; k++) {
+    uint32_t lo = 1u << (k - 1);
+    CHECK_EQ(prof_hist_bin(lo - 1), k - 1);
+    CHECK_EQ(prof_hist_bin(lo), k);
+    CHECK_EQ(prof_hist_bin((lo << 1) - 1), k);
+  }
+  CHECK_EQ(prof_hist_bin(1u << (PROF_HIST_BINS - 1)), PROF_HIST_BINS - 1);
+  CHECK_EQ(prof_hist_bin(UINT32_MAX), PROF_HIST_BINS - 1);
+}
+
+static void test_record_and_export(void) {
+  static const uint32_t samples[] = {0, 1, 3, 100, 100, 40000, UINT32_MAX};
+  uint32_t words[PROF_EXPORT_WORDS];
+  uint64_t sum = 0;
+
+  prof_init();
+  for (uint32_t i = 0; i < sizeof(samples) / sizeof(samples[0]); i++) {
+    prof_record(PROF_USB_RXFLVL, samples[i]);
+    sum += samples[i];
+  }
+
+  CHECK_EQ(prof_export(PROF_USB_RXFLVL, words), PROF_EXPORT_WORDS * 4);
+  CHECK_EQ(words[0], 7);
+  CHECK_EQ(words[1], 0);
+  CHECK_EQ(words[2], UINT32_MAX);
+  CHECK_EQ(words[3], (uint32_t)sum);
+  CHECK_EQ(words[4], (uint32_t)(sum >> 32));
+  CHECK_EQ(words[5 + 0], 1);  // 0
+  CHECK_EQ(words[5 + 1], 1);  // 1
+  CHECK_EQ(words[5 + 2], 1);  // 3
+  CHECK_EQ(words[5 + 7], 2);  // 100
+  CHECK_EQ(words[5 + 15], 2); // 40000, UINT32_MAX
+  CHECK_EQ(prof_get(PROF_OTG_FS_IRQ)->count, 0);
+  CHECK_EQ(prof_export(PROF_PROBE_COUNT, words), 0);
+}
+
+// prof_reset は印を付けるだけで, 統計は記録側の次の prof_record で消える。
+// それまでのエクスポートは空を返す
+static void test_reset_is_applied_by_recorder(void) {
+  uint32_t words[PROF_EXPORT_WORDS];
+
+  prof_init();
+  prof_record(PROF_I2S_DMA_IRQ, 2000);
+  prof_record(PROF_I2S_DMA_IRQ, 5000);
+  prof_reset();
+
+  CHECK_EQ(prof_get(PROF_I2S_DMA_IRQ)->count, 2); // まだ触らない
+  prof_export(PROF_I2S_DMA_IRQ, words);
+  for (uint32_t i = 0; i < PROF_EXPORT_WORDS; i++) {
+    CHECK_EQ(words[i], 0);
+  }
+
+  prof_record(PROF_I2S_DMA_IRQ, 300);
+  prof_export(PROF_I2S_DMA_IRQ, words);
+  CHECK_EQ(words[0], 1);
+  CHECK_EQ(words[1], 300);
+  CHECK_EQ(words[2], 300);
+  CHECK_EQ(words[3], 300);
+  CHECK_EQ(words[5 + prof_hist_bin(300)], 1);
+  CHECK_EQ(words[5 + prof_hist_bin(2000)], 0);
+}
+
+int main(void) {
+  RUN(test_hist_bin_edges);
+  RUN(test_record_and_export);
+  RUN(test_reset_is_applied_by_recorder);
+  return 0;
+}
@@ -0,0 +1,185 @@
+#include "test.h"
+#include "tim.h"
+#include <signal.h>
+#include <stm32f411xe.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+void TIM5_IRQHandler(void);
+
+// TIM5 のモデル。SIGALRM のハンドラが「ハードウェア」と「割り込み」を兼ねる。
+// シグナルは割り込みと同じく time_now_us の任意の命令の間に入り,
+// 入った処理は最後まで走ってから戻る
+static volatile uint64_t model_us;    // 真の経過時間（CNT + 桁あふれ）
+static volatile int irq_pending;      // UIF は立ったが割り込みはまだ
+static volatile uint32_t model_wraps; // モデルが桁あふれさせた回数
+static volatile uint32_t model_ticks;
+static uint32_t rng = 12345;
+
+static uint32_t next_random(void) {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+static void tim5_tick(int sig) {
+  (void)sig;
+  model_ticks++;
+
+  // 割り込み処理が遅れる場合（同優先度から読まれている等）は保留したまま進む
+  if (irq_pending && next_random() % 4 != 0) {
+    TIM5_IRQHandler();
+    irq_pending = 0;
+  }
+
+  uint32_t cnt = TIM5->CNT;
+  uint32_t step = next_random() % 0x40000000 + 1;
+  if (irq_pending && (uint64_t)cnt + step >= 0x80000000) {
+    // 未処理の桁あふれがある間は CNT が上半分に届かない（実機では 35 分後）
+    return;
+  }
+  model_us += step;
+  TIM5->CNT = (uint32_t)model_us;
+  if ((uint32_t)model_us < cnt) {
+    TIM5->SR |= TIM_SR_UIF;
+    irq_pending = 1;
+    model_wraps++;
+  }
+}
+
+static void test_time_now_us_static_cases(void) {
+  memset(TIM5, 0, sizeof(*TIM5));
+  tim5_init();
+  CHECK_EQ(time_now_us(), 0);
+
+  TIM5->CNT = 0xFFFFFFF0;
+  CHECK_EQ(time_now_us(), 0xFFFFFFF0);
+
+  // 桁あふれ直後, 割り込み未処理: 上位を1つ進める
+  TIM5->CNT = 5;
+  TIM5->SR |= TIM_SR_UIF;
+  CHECK_EQ(time_now_us(), 0x100000005ull);
+
+  // 桁あふれ直前に CNT を読んでから UIF が立った: 進めない
+  TIM5->CNT = 0xFFFFFFFF;
+  CHECK_EQ(time_now_us(), 0xFFFFFFFFull);
+
+  // 割り込みが済めばカウンタの値だけで決まる
+  TIM5->CNT = 5;
+  TIM5_IRQHandler();
+  CHECK(!(TIM5->SR & TIM_SR_UIF));
+  CHECK_EQ(time_now_us(), 0x100000005ull);
+}
+
+// 読み出しのどの位置に桁あふれと割り込みが入っても, 値は真の時刻の
+// 範囲内に収まり単調に増える
+static void test_time_now_us_preempted(void) {
+  struct sigaction sa;
+  struct sigevent sev = {.sigev_notify = SIGEV_SIGNAL, .sigev_signo = SIGALRM};
+  struct itimerspec period = {{0, 20000}, {0, 20000}};
+  timer_t timer;
+  uint64_t last = 0;
+  uint64_t calls = 0;
+
+  memset(TIM5, 0, sizeof(*TIM5));
+  tim5_init();
+  model_us = time_now_us(); // 上位は前のテストの桁あふれ回数から
+  irq_pending = 0;
+  model_wraps = 0;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = tim5_tick;
+  CHECK(sigaction(SIGALRM, &sa, NULL) == 0);
+  CHECK(timer_create(CLOCK_MONOTONIC, &sev, &timer) == 0);
+  CHECK(timer_settime(timer, 0, &period, NULL) == 0);
+
+  while (model_wraps < 5000) {
+    uint64_t before = model_us;
+    uint64_t now = time_now_us();
+    uint64_t after = model_us;
+
+    CHECK(now >= before);
+    CHECK(now <= after);
+    CHECK(now >= last);
+    last = now;
+    calls++;
+  }
+
+  timer_delete(timer);
+  signal(SIGALRM, SIG_DFL);
+  printf("  %llu reads across %u wraps, %u ticks\n", (unsigned long long)calls,
+         (unsigned)model_wraps, (unsigned)model_ticks);
+}
+
+// TIM2 の入力キャプチャ: SOF で CCR1 にラッチして CC1IF を立てる。
+// 読み損ねたまま次のSOFが来ると CC1OF も立つ
+static uint32_t sof_capture(uint32_t stamp, int overcapture) {
+  TIM2->CCR1 = stamp;
+  TIM2->SR |= TIM_SR_CC1IF | (overcapture ? TIM_SR_CC1OF : 0);
+  uint32_t period = tim2_sof_capture();
+  TIM2->SR &= ~TIM_SR_CC1IF; // 実機では CCR1 の読み出しで消える
+  return period;
+}
+
+static void test_sof_moving_sum(void) {
+  uint32_t periods[3 * TIM2_SOF_AVG_FRAMES];
+  uint32_t stamp = 0xFFFF0000; // 途中で 2^32 を跨ぐ
+
+  memset(TIM2, 0, sizeof(*TIM2));
+  tim2_sof_init();
+  CHECK_EQ(tim2_sof_capture(), 0);    // まだラッチされていない
+  CHECK_EQ(sof_capture(stamp, 0), 0); // 最初のSOFは基準だけ
+  CHECK_EQ(tim2_sof_period_sum(), 0);
+
+  for (uint32_t i = 0; i < 3 * TIM2_SOF_AVG_FRAMES; i++) {
+    periods[i] = 96000 + (i * 37) % 61 - 30; // 96MHz / 1kHz ± 30 tick
+    stamp += periods[i];
+    CHECK_EQ(sof_capture(stamp, 0), periods[i]);
+    CHECK_EQ(tim2_sof_period(), periods[i]);
+    CHECK_EQ(tim2_sof_stamp(), stamp);
+
+    uint32_t n = i + 1 < TIM2_SOF_AVG_FRAMES ? i + 1 : TIM2_SOF_AVG_FRAMES;
+    uint64_t sum = 0;
+    for (uint32_t k = i + 1 - n; k <= i; k++) {
+      sum += periods[k];
+    }
+    if (n < TIM2_SOF_AVG_FRAMES) {
+      // 埋まるまでは平均を同じスケールに直した値
+      CHECK_EQ(tim2_sof_period_sum(), (sum << TIM2_SOF_AVG_SHIFT) / n);
+    } else {
+      CHECK_EQ(tim2_sof_period_sum(), sum);
+    }
+  }
+}
+
+// 読み損ねたSOFの後は2フレーム分の間隔を平均に入れず, 次から測り直す
+static void test_sof_overcapture(void) {
+  memset(TIM2, 0, sizeof(*TIM2));
+  tim2_sof_init();
+  uint32_t lost = tim2_sof_overcapture_count();
+
+  sof_capture(1000, 0);
+  for (uint32_t i = 1; i <= TIM2_SOF_AVG_FRAMES; i++) {
+    sof_capture(1000 + i * 96000, 0);
+  }
+  CHECK_EQ(tim2_sof_period_sum(), 96000u << TIM2_SOF_AVG_SHIFT);
+
+  uint32_t stamp = 1000 + (TIM2_SOF_AVG_FRAMES + 2) * 96000;
+  CHECK_EQ(sof_capture(stamp, 1), 0);
+  CHECK(!(TIM2->SR & TIM_SR_CC1OF));
+  CHECK_EQ(tim2_sof_overcapture_count(), lost + 1);
+  CHECK_EQ(tim2_sof_period_sum(), 96000u << TIM2_SOF_AVG_SHIFT);
+
+  CHECK_EQ(sof_capture(stamp + 96010, 0), 96010);
+  CHECK_EQ(tim2_sof_period_sum(), (96000u << TIM2_SOF_AVG_SHIFT) + 10);
+}
+
+int main(void) {
+  RUN(test_time_now_us_static_cases);
+  RUN(test_time_now_us_preempted);
+  RUN(test_sof_moving_sum);
+  RUN(test_sof_overcapture);
+  return 0;
+}
@@ -0,0 +1,199 @@
+// リングの内部状態（tx_buf, tx_tail）を見るためにソースごと取り込む
+#include "../Src/usart.c"
+#include "test.h"
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+
+// DMA1 Stream6 のモデル。転送を始めた割り込み（またはメイン）から戻る前に
+// tail から NDTR バイトを取り込み, 完了時に次の転送へ進める
+static char out[1 << 24];
+static volatile uint32_t out_len;
+static volatile uint32_t captured_len;
+
+static void dma_capture(void) {
+  if (!(DMA1_Stream6->CR & DMA_SxCR_EN) || captured_len != 0) {
+    return;
+  }
+  for (uint32_t i = 0; i < DMA1_Stream6->NDTR; i++) {
+    out[out_len + i] = tx_buf[(tx_tail + i) & USART_TX_MASK];
+  }
+  captured_len = DMA1_Stream6->NDTR;
+}
+
+static void dma_complete(void) {
+  dma_capture();
+  if (captured_len == 0) {
+    return;
+  }
+  out_len += captured_len;
+  captured_len = 0;
+  DMA1_Stream6->CR &= ~DMA_SxCR_EN;
+  DMA1->HISR |= DMA_HISR_TCIF6;
+  DMA1_Stream6_IRQHandler();
+  DMA1->HISR &= ~DMA_HISR_TCIF6;
+  dma_capture();
+}
+
+static void drain(void) {
+  while (DMA1_Stream6->CR & DMA_SxCR_EN) {
+    dma_complete();
+  }
+}
+
+static void reset(void) {
+  drain();
+  memset(DMA1, 0, sizeof(*DMA1));
+  memset(DMA1_Stream6, 0, sizeof(*DMA1_Stream6));
+  usart2_init();
+  out_len = 0;
+  captured_len = 0;
+}
+
+static void test_single_producer(void) {
+  char line[32];
+  uint32_t expect = 0;
+
+  reset();
+  // リングを何周もさせる
+  for (uint32_t i = 0; i < 2000; i++) {
+    int len = snprintf(line, sizeof(line), "line %u\n", i);
+    usart2_write(line, len);
+    expect += len;
+    if (i % 3 == 0) {
+      dma_complete();
+    }
+  }
+  drain();
+  CHECK_EQ(out_len, expect);
+  CHECK_EQ(usart2_get_drop_count(), 0);
+  for (uint32_t i = 0, pos = 0; i < 2000; i++) {
+    int len = snprintf(line, sizeof(line), "line %u\n", i);
+    CHECK(memcmp(&out[pos], line, len) == 0);
+    pos += len;
+  }
+}
+
+// DMA が止まっていれば入り切らないメッセージは丸ごと捨てる
+static void test_full_ring_drops(void) {
+  char msg[100];
+  uint32_t drops = usart2_get_drop_count();
+
+  reset();
+  memset(msg, 'x', sizeof(msg));
+  // 先頭のメッセージで DMA が走り出したまま完了しない
+  uint32_t fit = USART_TX_RING_SIZE / sizeof(msg);
+  for (uint32_t i = 0; i < fit + 5; i++) {
+    usart2_write(msg, sizeof(msg));
+  }
+  CHECK_EQ(usart2_get_drop_count() - drops, 5);
+  drain();
+  CHECK_EQ(out_len, fit * sizeof(msg));
+}
+
+// 割り込み（シグナル）からの書き込みと DMA 完了がメインの書き込みの
+// 任意の位置に割り込んでも, 各メッセージは丸ごと順番どおり届くか,
+// 丸ごと捨てられて数えられる
+static volatile uint32_t isr_sent;
+static uint32_t rng = 1;
+
+static uint32_t next_random(void) {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+// 書き込み中に割り込まれやすいよう長めの1行: タグ, 連番6桁, 詰め物, 改行
+#define LINE_LEN 64
+
+static int format_line(char *line, char tag, uint32_t seq) {
+  snprintf(line, LINE_LEN, "%c%06u", tag, seq);
+  memset(line + 7, '.', LINE_LEN - 8);
+  line[LINE_LEN - 1] = '\n';
+  return LINE_LEN;
+}
+
+static void isr_tick(int sig) {
+  char line[LINE_LEN];
+  (void)sig;
+
+  // 送れるものは送り切ってから書くので, 書いた直後に DMA が走り出す
+  drain();
+  if (next_random() % 2) {
+    usart2_write(line, format_line(line, 'I', isr_sent++));
+    dma_capture();
+  }
+}
+
+static void check_stream(uint32_t main_sent, uint32_t drops) {
+  uint32_t next_main = 0;
+  uint32_t next_isr = 0;
+  uint32_t lines = 0;
+
+  CHECK(out_len % LINE_LEN == 0);
+  for (uint32_t pos = 0; pos < out_len; pos += LINE_LEN) {
+    char expect[LINE_LEN];
+    char tag = out[pos];
+    uint32_t seq = 0;
+    for (uint32_t i = 1; i <= 6; i++) {
+      CHECK(out[pos + i] >= '0' && out[pos + i] <= '9');
+      seq = seq * 10 + (out[pos + i] - '0');
+    }
+    format_line(expect, tag, seq);
+    CHECK(memcmp(&out[pos], expect, LINE_LEN) == 0);
+    if (tag == 'M') {
+      CHECK(seq >= next_main);
+      next_main = seq + 1;
+    } else {
+      CHECK(tag == 'I');
+      CHECK(seq >= next_isr);
+      next_isr = seq + 1;
+    }
+    lines++;
+  }
+  CHECK_EQ(lines + drops, main_sent + isr_sent);
+}
+
+static void test_preempted_producers(void) {
+  struct sigaction sa;
+  struct sigevent sev = {.sigev_notify = SIGEV_SIGNAL, .sigev_signo = SIGALRM};
+  struct itimerspec period = {{0, 20000}, {0, 20000}};
+  timer_t timer;
+  char line[LINE_LEN];
+  uint32_t main_sent = 0;
+
+  reset();
+  uint32_t drops = usart2_get_drop_count();
+  isr_sent = 0;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = isr_tick;
+  CHECK(sigaction(SIGALRM, &sa, NULL) == 0);
+  CHECK(timer_create(CLOCK_MONOTONIC, &sev, &timer) == 0);
+  CHECK(timer_settime(timer, 0, &period, NULL) == 0);
+
+  while (isr_sent < 2000 && main_sent < 999999) {
+    // 溢れている間は予約せずに捨てるだけで, コピー中に割り込まれる機会が
+    // ないので, 半分を超えたら DMA が空けるまで待つ
+    if (TX_INDEX(atomic_load(&tx_state) - tx_tail) > USART_TX_RING_SIZE / 2) {
+      continue;
+    }
+    usart2_write(line, format_line(line, 'M', main_sent++));
+  }
+
+  timer_delete(timer);
+  signal(SIGALRM, SIG_DFL);
+  drain();
+  drops = usart2_get_drop_count() - drops;
+  check_stream(main_sent, drops);
+  printf("  main %u, isr %u, dropped %u\n", main_sent, (unsigned)isr_sent,
+         drops);
+}
+
+int main(void) {
+  RUN(test_single_producer);
+  RUN(test_full_ring_drops);
+  RUN(test_preempted_producers);
+  return 0;
+}
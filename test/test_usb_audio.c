@@ -0,0 +1,67 @@
+#include "test.h"
+#include "usb_audio.h"
+#include <stdint.h>
+
+// 10.14 固定小数点: 1 frame/ms = 1 << 14
+#define FB_ONE (1 << 14)
+
+static void test_feedback_nominal(void) {
+  CHECK_EQ(uac2_feedback_nominal(48000), 48 * FB_ONE);
+  CHECK_EQ(uac2_feedback_nominal(96000), 96 * FB_ONE);
+  CHECK_EQ(uac2_feedback_nominal(44100), 722534); // 44.1 * 16384 = 722534.4
+  CHECK_EQ(uac2_feedback_nominal(88200), 1445068);
+}
+
+// 64 SOF 分の消費フレーム数をそのまま 10.14 に直す
+static void test_feedback_measured_rate(void) {
+  uint32_t period = 1 << UAC2_FEEDBACK_PERIOD_SHIFT;
+
+  CHECK_EQ(uac2_feedback_calc(48000, 48 * period, 0), 48 * FB_ONE);
+  // 1フレーム多い = 1/64 frame/ms 速い
+  CHECK_EQ(uac2_feedback_calc(48000, 48 * period + 1, 0),
+           48 * FB_ONE + FB_ONE / period);
+  CHECK_EQ(uac2_feedback_calc(48000, 48 * period - 3, 0),
+           48 * FB_ONE - 3 * FB_ONE / period);
+  // 44.1kHz は 64ms で 2822.4 フレーム
+  CHECK_EQ(uac2_feedback_calc(44100, 2822, 0), 2822 * FB_ONE / period);
+}
+
+// リングが目標より少なければ速く, 多ければ遅く送らせる
+static void test_feedback_steering(void) {
+  uint32_t base = uac2_feedback_calc(48000, 3072, 0);
+
+  CHECK_EQ(uac2_feedback_calc(48000, 3072, 10), base + 160);
+  CHECK_EQ(uac2_feedback_calc(48000, 3072, -10), base - 160);
+}
+
+// 測定値や補正がどれだけ外れても公称値 ±1/64 に収まる
+static void test_feedback_clamp(void) {
+  static const uint32_t rates[] = {44100, 48000, 88200, 96000};
+
+  for (uint32_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+    uint32_t nominal = uac2_feedback_nominal(rates[r]);
+    uint32_t limit = nominal >> 6;
+    uint32_t expected = rates[r] * 64 / 1000;
+
+    CHECK_EQ(uac2_feedback_calc(rates[r], 0, 0), nominal - limit);
+    CHECK_EQ(uac2_feedback_calc(rates[r], 2 * expected, 0), nominal + limit);
+    CHECK_EQ(uac2_feedback_calc(rates[r], expected, 100000), nominal + limit);
+    CHECK_EQ(uac2_feedback_calc(rates[r], expected, -100000),
+             nominal - limit);
+
+    for (uint32_t consumed = 0; consumed < 2 * expected; consumed += 7) {
+      for (int32_t error = -2000; error <= 2000; error += 250) {
+        uint32_t v = uac2_feedback_calc(rates[r], consumed, error);
+        CHECK(v >= nominal - limit && v <= nominal + limit);
+      }
+    }
+  }
+}
+
+int main(void) {
+  RUN(test_feedback_nominal);
+  RUN(test_feedback_measured_rate);
+  RUN(test_feedback_steering);
+  RUN(test_feedback_clamp);
+  return 0;
+}
@@ -0,0 +1,153 @@
+#include "test.h"
+#include "usb_evq.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+
+static usb_evq_t q;
+
+static void post(uint32_t seq) {
+  usb_event_t *ev = usb_evq_alloc(&q);
+  CHECK(ev != NULL);
+  ev->type = USB_EVT_OUT_DATA;
+  ev->len = seq % (USB_EVQ_DATA_MAX + 1);
+  ev->data[0] = seq;
+  usb_evq_commit(&q);
+}
+
+static void expect(uint32_t seq) {
+  usb_event_t *ev = usb_evq_peek(&q);
+  CHECK(ev != NULL);
+  CHECK_EQ(ev->type, USB_EVT_OUT_DATA);
+  CHECK_EQ(ev->len, seq % (USB_EVQ_DATA_MAX + 1));
+  CHECK_EQ(ev->data[0], seq);
+  usb_evq_release(&q);
+}
+
+static void test_order_and_empty(void) {
+  usb_evq_init(&q);
+  CHECK(usb_evq_peek(&q) == NULL);
+  for (uint32_t i = 0; i < 3; i++) {
+    post(i);
+  }
+  for (uint32_t i = 0; i < 3; i++) {
+    expect(i);
+  }
+  CHECK(usb_evq_peek(&q) == NULL);
+  CHECK_EQ(q.overflow_count, 0);
+}
+
+// alloc しただけのスロットはコンシューマから見えない
+static void test_uncommitted_slot_is_hidden(void) {
+  usb_evq_init(&q);
+  usb_event_t *ev = usb_evq_alloc(&q);
+  CHECK(ev != NULL);
+  CHECK(usb_evq_peek(&q) == NULL);
+  // 公開しないまま取り直すと同じスロットが返る
+  CHECK(usb_evq_alloc(&q) == ev);
+  usb_evq_commit(&q);
+  CHECK(usb_evq_peek(&q) == ev);
+}
+
+static void test_full_queue_overflows(void) {
+  usb_evq_init(&q);
+  for (uint32_t i = 0; i < USB_EVQ_SLOTS; i++) {
+    post(i);
+  }
+  CHECK(usb_evq_alloc(&q) == NULL);
+  CHECK(usb_evq_alloc(&q) == NULL);
+  CHECK_EQ(q.overflow_count, 2);
+
+  // 1つ返せば1つ取れる
+  expect(0);
+  post(USB_EVQ_SLOTS);
+  CHECK(usb_evq_alloc(&q) == NULL);
+  CHECK_EQ(q.overflow_count, 3);
+  for (uint32_t i = 1; i <= USB_EVQ_SLOTS; i++) {
+    expect(i);
+  }
+  CHECK(usb_evq_peek(&q) == NULL);
+}
+
+// head/tail が 2^32 を跨いでも満杯/空の判定が変わらない
+static void test_index_wrap(void) {
+  usb_evq_init(&q);
+  q.head = q.tail = UINT32_MAX - 2;
+  for (uint32_t round = 0; round < 4; round++) {
+    for (uint32_t i = 0; i < USB_EVQ_SLOTS; i++) {
+      post(round * 100 + i);
+    }
+    CHECK(usb_evq_alloc(&q) == NULL);
+    for (uint32_t i = 0; i < USB_EVQ_SLOTS; i++) {
+      expect(round * 100 + i);
+    }
+    CHECK(usb_evq_peek(&q) == NULL);
+  }
+  CHECK(q.head < 100);
+}
+
+// トップハーフとボトムハーフを別スレッドで回す。溢れた分は捨てて数え,
+// 届いた分は欠けず順番どおりで中身も壊れていない
+#define THREAD_EVENTS 200000
+
+static volatile uint32_t posted;
+
+static void *top_half(void *arg) {
+  (void)arg;
+  for (uint32_t seq = 0; seq < THREAD_EVENTS; seq++) {
+    usb_event_t *ev = usb_evq_alloc(&q);
+    if (ev == NULL) {
+      sched_yield();
+      continue;
+    }
+    ev->type = USB_EVT_SETUP;
+    ev->len = USB_EVQ_DATA_MAX;
+    for (uint32_t i = 0; i < USB_EVQ_DATA_MAX / 4; i++) {
+      ev->data[i] = seq ^ i;
+    }
+    usb_evq_commit(&q);
+    posted++;
+  }
+  return NULL;
+}
+
+static void test_threads(void) {
+  pthread_t producer;
+  uint32_t received = 0;
+  uint32_t last = 0;
+
+  usb_evq_init(&q);
+  posted = 0;
+  CHECK(pthread_create(&producer, NULL, top_half, NULL) == 0);
+  for (;;) {
+    usb_event_t *ev = usb_evq_peek(&q);
+    if (ev == NULL) {
+      if (received == THREAD_EVENTS - q.overflow_count) {
+        break;
+      }
+      sched_yield();
+      continue;
+    }
+    uint32_t seq = ev->data[0];
+    CHECK(received == 0 || seq > last);
+    for (uint32_t i = 0; i < USB_EVQ_DATA_MAX / 4; i++) {
+      CHECK_EQ(ev->data[i], seq ^ i);
+    }
+    last = seq;
+    received++;
+    usb_evq_release(&q);
+  }
+  pthread_join(producer, NULL);
+  CHECK_EQ(received, posted);
+  CHECK_EQ(received + q.overflow_count, THREAD_EVENTS);
+}
+
+int main(void) {
+  RUN(test_order_and_empty);
+  RUN(test_uncommitted_slot_is_hidden);
+  RUN(test_full_queue_overflows);
+  RUN(test_index_wrap);
+  RUN(test_threads);
+  return 0;
+}
@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+"""Decode LOG_BINARY records from the USART2 log stream.
+
+Usage: log_decode.py firmware.elf [capture.bin]   (capture defaults to stdin)
+
+Each record is
+    0xA5, tag << 4 | nargs, format id (u16), timestamp us (u32), nargs * u32
+with all values little-endian. The format id is the string's offset in the
+non-loaded .log_fmt section of the ELF. %s arguments are flash addresses and
+are looked up in the ELF as well. Bytes outside records (plain
+printf_usart2 output) are passed through unchanged.
+"""
+
+import re
+import struct
+import sys
+
+SYNC = 0xA5
+TAGS = ["ERROR", "WARN", "INFO", "DEBUG", "TRACE", "USB", "USB-ERR", "SETUP",
+        "DATA"]
+CONV = re.compile(r"%([-+ #0]*)(\d*)(?:\.(\d+))?(?:hh|h|ll|l|z)?([diuxXcsp%])")
+
+
+class Elf:
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.data = f.read()
+        if self.data[:4] != b"\x7fELF" or self.data[4] != 1:
+            raise ValueError("not a 32-bit ELF file")
+        shoff, = struct.unpack_from("<I", self.data, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from("<HHH", self.data,
+                                                        0x2E)
+        headers = [struct.unpack_from("<IIIIIIIIII", self.data,
+                                      shoff + i * shentsize)
+                   for i in range(shnum)]
+        names = headers[shstrndx][4]
+        self.sections = {}
+        for h in headers:
+            name = self.cstr_at(names + h[0])
+            # name -> (sh_type, sh_flags, sh_addr, sh_offset, sh_size)
+            self.sections[name] = (h[1], h[2], h[3], h[4], h[5])
+
+    def cstr_at(self, offset):
+        end = self.data.index(b"\0", offset)
+        return self.data[offset:end].decode("utf-8", "replace")
+
+    def log_fmt(self, fmt_id):
+        _, _, _, offset, size = self.sections[".log_fmt"]
+        if fmt_id >= size:
+            return None
+        return self.cstr_at(offset + fmt_id)
+
+    def string_at(self, addr):
+        for sh_type, flags, base, offset, size in self.sections.values():
+            # Skip SHT_NOBITS sections such as .bss
+            if flags & 0x2 and sh_type != 8 and base <= addr < base + size:
+                return self.cstr_at(offset + addr - base)
+        return "<0x%08X>" % addr
+
+
+def format_c(fmt, args, elf):
+    args = list(args)
+
+    def repl(m):
+        flags, width, prec, conv = m.groups()
+        if conv == "%":
+            return "%"
+        v = args.pop(0) if args else 0
+        spec = "%" + flags + width + ("." + prec if prec else "")
+        if conv in "di":
+            return (spec + "d") % (v - (1 << 32) if v & 0x80000000 else v)
+        if conv == "u":
+            return (spec + "d") % v
+        if conv == "c":
+            return (spec + "c") % chr(v & 0xFF)
+        if conv == "s":
+            return (spec + "s") % elf.string_at(v)
+        if conv == "p":
+            return "0x%08x" % v
+        return (spec + conv) % v
+
+    return CONV.sub(repl, fmt)
+
+
+def decode(stream, elf, out):
+    buf = b""
+    while True:
+        chunk = stream.read(4096)
+        if not chunk:
+            break
+        buf += chunk
+        while buf:
+            pos = buf.find(bytes([SYNC]))
+            if pos != 0:
+                text = buf if pos < 0 else buf[:pos]
+                out.write(text.decode("utf-8", "replace"))
+                buf = b"" if pos < 0 else buf[pos:]
+                continue
+            if len(buf) < 8:
+                break
+            nargs = buf[1] & 0x0F
+            size = 8 + nargs * 4
+            if len(buf) < size:
+                break
+            tag = buf[1] >> 4
+            fmt_id, ts = struct.unpack_from("<HI", buf, 2)
+            args = struct.unpack_from("<%dI" % nargs, buf, 8)
+            buf = buf[size:]
+
+            fmt = elf.log_fmt(fmt_id)
+            if fmt is None:
+                out.write("<bad record id=0x%04X>\n" % fmt_id)
+                continue
+            name = TAGS[tag] if tag < len(TAGS) else "?"
+            text = format_c(fmt, args, elf).replace("\r\n", "\n")
+            out.write("%10.6f [%s] %s" % (ts / 1e6, name, text))
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        sys.stderr.write(__doc__)
+        return 1
+    elf = Elf(sys.argv[1])
+    if len(sys.argv) == 3:
+        with open(sys.argv[2], "rb") as f:
+            decode(f, elf, sys.stdout)
+    else:
+        decode(sys.stdin.buffer, elf, sys.stdout)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())